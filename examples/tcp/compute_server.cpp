@@ -0,0 +1,38 @@
+#include <bits/stdc++.h>
+#include "computeserver.hpp"
+
+using namespace std;
+
+// Counts the primes below n, so the cost of a request depends on its payload
+static string count_primes(const string& request) {
+  long n = atol(request.c_str());
+  long count = 0;
+  for (long i = 2; i < n; i++) {
+    bool prime = true;
+    for (long d = 2; d * d <= i; d++) {
+      if (i % d == 0) {
+        prime = false;
+        break;
+      }
+    }
+    if (prime) count++;
+  }
+  return to_string(count);
+}
+
+int main() {
+  try {
+    // Two threads read requests on port 8080, every core computes the answers
+    Socket::ComputeServer server(8080, 2, 0);
+
+    // Each request is a framed number; the response is a framed count
+    server.start(count_primes);
+
+    cout << "Serving on port 8080 with " << server.get_pool().get_threads()
+         << " compute threads" << endl;
+    server.join();
+  }
+  catch(std::exception &e) {
+    std::cout << e.what() << std::endl;
+  }
+}
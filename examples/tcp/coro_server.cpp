@@ -0,0 +1,47 @@
+#include <bits/stdc++.h>
+#include "coroutine.hpp"
+
+using namespace std;
+
+// Echoes back whatever the client sends, one coroutine per client
+Socket::Task<> serve(Socket::Scheduler& scheduler, shared_ptr<Socket::TCPSocket> client) {
+  try {
+    uint8_t buffer[256];
+    for (;;) {
+      size_t received = co_await scheduler.async_recv(*client, buffer, sizeof(buffer));
+      co_await scheduler.async_send(*client, buffer, received);
+    }
+  }
+  catch (const Socket::ConnectionException & x) {
+    cout << "Connection closed" << endl;
+  }
+}
+
+// Accepts clients forever, spawning a coroutine for each one
+Socket::Task<> accept_clients(Socket::Scheduler& scheduler, Socket::TCPSocket& server) {
+  for (;;) {
+    shared_ptr<Socket::TCPSocket> client = co_await scheduler.async_accept(server);
+    cout << "Connected client " << client->get_ip_address() << endl;
+    scheduler.spawn(serve(scheduler, client));
+  }
+}
+
+int main() {
+  Socket::TCPSocket server;
+  Socket::EventLoop loop;
+  Socket::Scheduler scheduler(loop);
+
+  try {
+    // Binds the server to port 8080
+    server.bind(8080);
+
+    // Listens for incoming connections
+    server.listen();
+
+    // Serves every client on this thread
+    scheduler.run_until_complete(accept_clients(scheduler, server));
+  }
+  catch(std::exception &e) {
+    std::cout << e.what() << std::endl;
+  }
+}
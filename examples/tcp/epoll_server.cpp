@@ -0,0 +1,104 @@
+#include <bits/stdc++.h>
+#include "eventloop.hpp"
+
+using namespace std;
+
+// An accepted client and the bytes it sent that were not echoed back yet
+struct Client {
+  shared_ptr<Socket::TCPSocket> socket;
+  string unsent;
+};
+
+// Sends as much of the unsent bytes as the socket accepts
+// Returns false if the connection failed
+bool flush(Client& client) {
+  while (!client.unsent.empty()) {
+    Socket::Result<size_t> result = client.socket->try_send(
+      (const uint8_t*) client.unsent.data(), client.unsent.size());
+
+    if (result.ok()) {
+      client.unsent.erase(0, result.value());
+    }
+    else if (result.error() == Socket::Errc::would_block) {
+      // The rest goes out when the socket is writable again
+      return true;
+    }
+    else if (result.error() != Socket::Errc::interrupted) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Echoes back whatever the client sent, without dropping bytes when the
+// socket can't take them all: reading stops until they are sent
+// Returns false if the connection was closed
+bool echo(Client& client) {
+  // Reuses the same buffer for every read, without allocating
+  uint8_t buffer[256];
+  for (;;) {
+    if (!flush(client)) return false;
+    if (!client.unsent.empty()) return true;
+
+    try {
+      size_t received = client.socket->recv_into(buffer, sizeof(buffer));
+      client.unsent.append((const char*) buffer, received);
+    }
+    catch (const Socket::WouldBlock & x) {
+      // Everything available was read
+      return true;
+    }
+    catch (const Socket::ConnectionException & x) {
+      return false;
+    }
+  }
+}
+
+int main() {
+  Socket::TCPSocket server;
+  Socket::EventLoop loop;
+
+  // Keeps accepted clients alive while they are registered in the loop
+  map<int, Client> clients;
+
+  try {
+    // Binds the server to port 8080
+    server.bind(8080);
+
+    // Listens for incoming connections
+    server.listen();
+
+    // Every accepted client echoes back whatever it receives
+    loop.add_listener(server, [&](shared_ptr<Socket::TCPSocket> client) {
+      int fd = client->get_fd();
+      clients[fd].socket = client;
+      cout << "Connected client " << client->get_ip_address() << endl;
+
+      // Called both when there is something to read and when unsent
+      // bytes can go out
+      auto serve = [&, fd]() {
+        if (!echo(clients[fd])) {
+          loop.remove(fd);
+          clients.erase(fd);
+          cout << "Connection closed" << endl;
+        }
+      };
+
+      Socket::EventLoop::Handlers handlers;
+      handlers.on_readable = serve;
+      handlers.on_writable = serve;
+      handlers.on_closed = [&, fd]() {
+        clients.erase(fd);
+        cout << "Connection closed" << endl;
+      };
+
+      loop.add(fd, handlers);
+    });
+
+    // Serves every client on this thread
+    loop.run();
+  }
+  catch(std::exception &e) {
+    std::cout << e.what() << std::endl;
+  }
+}
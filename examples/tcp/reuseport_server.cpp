@@ -0,0 +1,93 @@
+#include <bits/stdc++.h>
+#include "reuseport.hpp"
+
+using namespace std;
+
+// An accepted client and the bytes it sent that were not echoed back yet
+struct Client {
+  shared_ptr<Socket::TCPSocket> socket;
+  string unsent;
+};
+
+// Each worker keeps its own clients, so no locking is needed
+thread_local map<int, Client> clients;
+
+// Sends as much of the unsent bytes as the socket accepts
+// Returns false if the connection failed
+bool flush(Client& client) {
+  while (!client.unsent.empty()) {
+    Socket::Result<size_t> result = client.socket->try_send(
+      (const uint8_t*) client.unsent.data(), client.unsent.size());
+
+    if (result.ok()) {
+      client.unsent.erase(0, result.value());
+    }
+    else if (result.error() == Socket::Errc::would_block) {
+      // The rest goes out when the socket is writable again
+      return true;
+    }
+    else if (result.error() != Socket::Errc::interrupted) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Echoes back whatever the client sent; reading stops while there are
+// bytes the socket could not take yet
+// Returns false if the connection was closed
+bool echo(Client& client) {
+  uint8_t buffer[256];
+  for (;;) {
+    if (!flush(client)) return false;
+    if (!client.unsent.empty()) return true;
+
+    try {
+      size_t received = client.socket->recv_into(buffer, sizeof(buffer));
+      client.unsent.append((const char*) buffer, received);
+    }
+    catch (const Socket::WouldBlock & x) {
+      // Everything available was read
+      return true;
+    }
+    catch (const Socket::ConnectionException & x) {
+      return false;
+    }
+  }
+}
+
+int main() {
+  // One listener, event loop and thread per core, all on port 8080
+  Socket::ReusePortServer server(8080);
+
+  try {
+    server.start([](Socket::EventLoop& loop, shared_ptr<Socket::TCPSocket> client) {
+      int fd = client->get_fd();
+      clients[fd].socket = client;
+
+      // Called both when there is something to read and when unsent
+      // bytes can go out
+      auto serve = [&loop, fd]() {
+        if (!echo(clients[fd])) {
+          loop.remove(fd);
+          clients.erase(fd);
+        }
+      };
+
+      Socket::EventLoop::Handlers handlers;
+      handlers.on_readable = serve;
+      handlers.on_writable = serve;
+      handlers.on_closed = [fd]() {
+        clients.erase(fd);
+      };
+
+      loop.add(fd, handlers);
+    });
+
+    cout << "Serving on " << server.get_workers() << " workers" << endl;
+    server.join();
+  }
+  catch(std::exception &e) {
+    std::cout << e.what() << std::endl;
+  }
+}
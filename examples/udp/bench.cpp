@@ -0,0 +1,120 @@
+#include <bits/stdc++.h>
+#include "sockets.hpp"
+
+using namespace std;
+
+// Compares single-datagram calls against recv_batch()/send_batch() on loopback
+
+const uint32_t PORT = 8081;
+const size_t PACKETS = 200000;
+const size_t PAYLOAD = 64;
+const size_t BATCH = 64;
+
+double seconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void report(const string& name, size_t packets, double seconds) {
+  cout << setw(24) << left << name << setw(10) << right << packets << " packets "
+       << setw(12) << fixed << setprecision(0) << packets / seconds << " packets/s" << endl;
+}
+
+sockaddr_in loopback() {
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(PORT);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return address;
+}
+
+// Sends PACKETS datagrams in batches, used to feed the receive benchmarks
+void flood(atomic<bool>& done) {
+  Socket::UDPSocket sender;
+  vector<Socket::Datagram> batch(BATCH, Socket::Datagram(PAYLOAD));
+  for (size_t i = 0; i < BATCH; i++) {
+    batch[i].resize(PAYLOAD);
+    batch[i].set_peer(loopback());
+  }
+  while (!done) {
+    sender.send_batch(batch, BATCH);
+  }
+}
+
+void bench_send() {
+  Socket::UDPSocket sink;
+  sink.bind(PORT);
+
+  Socket::UDPSocket sender;
+  string message(PAYLOAD, 'x');
+
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < PACKETS; i++) {
+    sender.sendto("127.0.0.1", PORT, message);
+  }
+  report("sendto", PACKETS, seconds_since(start));
+
+  Socket::Endpoint endpoint(loopback());
+
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < PACKETS; i++) {
+    sender.sendto(endpoint, message);
+  }
+  report("sendto(Endpoint)", PACKETS, seconds_since(start));
+
+  vector<Socket::Datagram> batch(BATCH, Socket::Datagram(PAYLOAD));
+  for (size_t i = 0; i < BATCH; i++) {
+    batch[i].resize(PAYLOAD);
+    batch[i].set_peer(loopback());
+  }
+
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < PACKETS; i += BATCH) {
+    sender.send_batch(batch, BATCH);
+  }
+  report("send_batch", PACKETS, seconds_since(start));
+}
+
+void bench_recv(bool batched) {
+  Socket::UDPSocket receiver;
+  receiver.bind(PORT);
+  receiver.set_timeout(1);
+
+  atomic<bool> done(false);
+  thread sender(flood, ref(done));
+
+  size_t received = 0;
+  auto start = chrono::steady_clock::now();
+  try {
+    if (batched) {
+      vector<Socket::Datagram> batch(BATCH, Socket::Datagram(PAYLOAD));
+      while (received < PACKETS) received += receiver.recv_batch(batch, BATCH);
+    }
+    else {
+      Socket::Datagram datagram(PAYLOAD);
+      while (received < PACKETS) {
+        receiver.recvfrom(datagram);
+        received++;
+      }
+    }
+  }
+  catch (const Socket::WouldBlock & x) {
+    // Timed out waiting for the sender
+  }
+  double elapsed = seconds_since(start);
+
+  done = true;
+  sender.join();
+  report(batched ? "recv_batch" : "recvfrom(Datagram&)", received, elapsed);
+}
+
+int main() {
+  try {
+    bench_send();
+    bench_recv(false);
+    bench_recv(true);
+  }
+  catch(std::exception &e) {
+    std::cout << e.what() << std::endl;
+  }
+}
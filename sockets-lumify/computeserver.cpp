@@ -0,0 +1,293 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "computeserver.hpp"
+#include "framing.hpp"
+
+#include <map>
+
+using namespace Socket;
+
+/// Conexão atendida por uma thread de I/O. Usada apenas por essa thread; as
+/// threads do pool guardam só um weak_ptr, que devolvem junto com a resposta.
+struct ComputeServer::Connection {
+
+    Connection(EventLoop& loop, std::shared_ptr<TCPSocket> socket, size_t max_frame,
+        size_t max_in_flight, size_t max_output) :
+        loop(loop), socket(socket), stream(*socket, 64 * 1024, max_frame),
+        max_in_flight(max_in_flight), max_output(max_output) {}
+
+    /// Requisições lidas cuja resposta ainda não foi colocada na saída.
+    size_t in_flight() const {
+        return next_request - next_response;
+    }
+
+    /// Bytes de resposta ainda não enviados.
+    size_t pending_output() const {
+        return output.size() - sent;
+    }
+
+    /// Se a leitura deve parar até as respostas pendentes saírem.
+    bool saturated() const {
+        return in_flight() >= max_in_flight || pending_output() >= max_output;
+    }
+
+    /// Se o cliente encerrou o envio e todas as respostas já foram enviadas.
+    bool drained() const {
+        return eof && in_flight() == 0 && pending_output() == 0;
+    }
+
+    /// Guarda uma resposta e envia as que já podem sair em ordem.
+    void deliver(uint64_t sequence, std::string response) {
+
+        finished[sequence] = std::move(response);
+
+        for (auto it = finished.find(next_response); it != finished.end();
+             it = finished.find(next_response)) {
+
+            size_t length = it->second.size();
+            uint8_t header[FramedStream::HEADER_SIZE] = {
+                (uint8_t) (length >> 24), (uint8_t) (length >> 16),
+                (uint8_t) (length >> 8),  (uint8_t) length
+            };
+
+            output.insert(output.end(), header, header + sizeof(header));
+            output.insert(output.end(), it->second.begin(), it->second.end());
+
+            finished.erase(it);
+            next_response++;
+        }
+
+        flush();
+    }
+
+    /// Envia o que couber do buffer de saída, sem bloquear.
+    void flush() {
+
+        while (open && sent < output.size()) {
+
+            Result<size_t> result = socket->try_send(output.data() + sent, output.size() - sent);
+
+            if (result.ok()) {
+                sent += result.value();
+            }
+            else if (result.error() == Errc::would_block || result.error() == Errc::timed_out) {
+                // Continua quando o laço indicar que a socket aceita mais bytes.
+                return;
+            }
+            else if (result.error() != Errc::interrupted) {
+                close();
+                return;
+            }
+        }
+
+        output.clear();
+        sent = 0;
+    }
+
+    /// Remove a conexão do laço, o que a destrói quando o callback atual
+    /// terminar. Respostas que ainda chegarem são descartadas.
+    void close() {
+        if (!open) return;
+        open = false;
+        loop.remove(*socket);
+    }
+
+    /// Laço da thread de I/O dona da conexão.
+    EventLoop& loop;
+
+    std::shared_ptr<TCPSocket> socket;
+    FramedStream stream;
+
+    /// Se a conexão ainda está no laço.
+    bool open = true;
+
+    /// Se o cliente encerrou o envio. Nada mais é lido, mas as respostas
+    /// das requisições já lidas ainda são enviadas.
+    bool eof = false;
+
+    /// Se a leitura foi pausada por saturated().
+    bool paused = false;
+
+    /// Limites de requisições em andamento e de bytes na saída.
+    size_t max_in_flight;
+    size_t max_output;
+
+    /// Sequência da próxima requisição lida.
+    uint64_t next_request = 0;
+
+    /// Sequência da próxima resposta a ser enviada.
+    uint64_t next_response = 0;
+
+    /// Respostas prontas que esperam uma anterior terminar.
+    std::map<uint64_t, std::string> finished;
+
+    /// Frames de resposta ainda não enviados, a partir de sent.
+    std::vector<uint8_t> output;
+    size_t sent = 0;
+};
+
+/// Callback entregue ao laço da conexão com a resposta de uma requisição.
+struct ComputeServer::ResponseDelivery {
+
+    void operator()() {
+
+        std::shared_ptr<Connection> target = connection.lock();
+        if (!target || !target->open) return;
+
+        if (failed) {
+            target->close();
+            return;
+        }
+
+        target->deliver(sequence, std::move(response));
+        server->resume(target);
+    }
+
+    ComputeServer* server;
+    std::weak_ptr<Connection> connection;
+    uint64_t sequence;
+    std::string response;
+    bool failed;
+};
+
+/// Tarefa do pool: processa uma requisição e devolve a resposta ao laço.
+struct ComputeServer::RequestJob {
+
+    void operator()() {
+
+        ResponseDelivery delivery;
+        delivery.server = server;
+        delivery.connection = connection;
+        delivery.sequence = sequence;
+        delivery.failed = false;
+
+        try {
+            delivery.response = server->handler(request);
+        }
+        catch (...) {
+            delivery.failed = true;
+        }
+
+        loop->post(std::move(delivery));
+    }
+
+    ComputeServer* server;
+    EventLoop* loop;
+    std::weak_ptr<Connection> connection;
+    uint64_t sequence;
+    std::string request;
+};
+
+ComputeServer::ComputeServer(uint32_t port, unsigned io_threads, unsigned compute_threads,
+    size_t max_frame, size_t max_in_flight, size_t max_output) :
+    max_frame(max_frame), max_in_flight(max_in_flight > 0 ? max_in_flight : 1),
+    max_output(max_output > 0 ? max_output : 1), io(port, io_threads, false),
+    pool(compute_threads) {}
+
+ComputeServer::~ComputeServer() {
+    stop();
+    join();
+}
+
+void ComputeServer::start(Handler handler) {
+
+    this->handler = std::move(handler);
+
+    ComputeServer* self = this;
+    io.start([self](EventLoop& loop, std::shared_ptr<TCPSocket> client) {
+        self->serve(loop, client);
+    });
+}
+
+void ComputeServer::stop() {
+    pool.stop();
+    io.stop();
+}
+
+void ComputeServer::join() {
+    pool.join();
+    io.join();
+}
+
+void ComputeServer::serve(EventLoop& loop, std::shared_ptr<TCPSocket> client) {
+
+    std::shared_ptr<Connection> connection = std::make_shared<Connection>(loop, client, max_frame,
+        max_in_flight, max_output);
+    ComputeServer* self = this;
+
+    // Os callbacks são os donos da conexão: remover a socket do laço a destrói.
+    EventLoop::Handlers handlers;
+    handlers.on_readable = [self, connection]() { self->read_requests(connection); };
+    handlers.on_writable = [self, connection]() {
+        connection->flush();
+        self->resume(connection);
+    };
+
+    loop.add(*client, handlers);
+}
+
+void ComputeServer::read_requests(const std::shared_ptr<Connection>& connection) {
+
+    if (!connection->open || connection->eof) return;
+    connection->paused = false;
+
+    // Lê até o kernel não ter mais bytes, já que só haverá uma notificação,
+    // ou até a conexão ter requisições demais esperando resposta.
+    for (;;) {
+
+        try {
+            FrameView frame;
+            while (!connection->saturated() && connection->stream.next_frame(frame)) {
+
+                RequestJob job;
+                job.server = this;
+                job.loop = &connection->loop;
+                job.connection = connection;
+                job.sequence = connection->next_request++;
+                job.request = frame.to_string();
+
+                pool.submit(std::move(job));
+            }
+
+            // Os bytes ficam no kernel, e o cliente que não lê as respostas
+            // acaba bloqueado pela janela do TCP. resume() volta a ler.
+            if (connection->saturated()) {
+                connection->paused = true;
+                return;
+            }
+
+            connection->stream.fill();
+        }
+        catch (const WouldBlock& e) {
+            return;
+        }
+        catch (const ClosedConnection& e) {
+            // O cliente pode ter fechado só o envio: as requisições já lidas
+            // ainda são respondidas, e a conexão é fechada depois da última.
+            connection->eof = true;
+            if (connection->drained()) connection->close();
+            return;
+        }
+        catch (const ConnectionException& e) {
+            // Erro de leitura ou frame maior que max_frame.
+            connection->close();
+            return;
+        }
+    }
+}
+
+void ComputeServer::resume(const std::shared_ptr<Connection>& connection) {
+
+    if (!connection->open) return;
+
+    if (connection->drained()) {
+        connection->close();
+    }
+    else if (connection->paused && !connection->saturated()) {
+        read_requests(connection);
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef COMPUTESERVER_H
+#define COMPUTESERVER_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "reuseport.hpp"
+#include "workpool.hpp"
+
+namespace Socket {
+
+/** Servidor de requisições com I/O e processamento em threads separadas.
+ *
+ *      As threads de I/O (um ReusePortServer) aceitam as conexões, leem as
+ *  requisições no formato do FramedStream (tamanho de 4 bytes big-endian
+ *  seguido do payload) e as entregam a um WorkStealingPool, sem processá-las.
+ *  O handler roda em uma thread do pool, e a resposta volta por
+ *  EventLoop::post() para a thread de I/O dona da conexão, que a envia como
+ *  um frame. Assim uma requisição cara não atrasa as outras conexões da
+ *  mesma thread de I/O.
+ *      As respostas de uma conexão são enviadas na ordem das requisições,
+ *  mesmo que terminem fora de ordem. Se o handler lançar uma exceção, a
+ *  conexão é fechada. Quando o cliente encerra o envio, as requisições já
+ *  lidas ainda são respondidas e a conexão é fechada depois da última.
+ *      A leitura de uma conexão é pausada enquanto ela tiver max_in_flight
+ *  requisições sem resposta enviada ou max_output bytes de resposta
+ *  esperando o cliente ler, assim um cliente que envia sem ler as respostas
+ *  não faz a memória do servidor crescer sem limite.
+ */
+class ComputeServer {
+    public:
+
+        /// Processa o payload de uma requisição e retorna o payload da
+        /// resposta. Chamado em uma thread do pool, possivelmente em paralelo
+        /// para requisições da mesma conexão.
+        typedef std::function<std::string(const std::string& request)> Handler;
+
+        /// Cria o servidor, sem abrir nenhuma socket. As threads do pool já
+        /// são iniciadas.
+        /// @param port            Porta na qual os listeners serão vinculados.
+        /// @param io_threads      Número de threads de I/O, 0 para uma por núcleo.
+        /// @param compute_threads Número de threads do pool, 0 para uma por núcleo.
+        /// @param max_frame       Tamanho máximo aceito para uma requisição.
+        /// @param max_in_flight   Requisições por conexão sem resposta enviada
+        ///                        a partir das quais a leitura é pausada.
+        /// @param max_output      Bytes de resposta por conexão esperando envio
+        ///                        a partir dos quais a leitura é pausada.
+        ComputeServer(uint32_t port, unsigned io_threads = 1, unsigned compute_threads = 0,
+            size_t max_frame = 16 * 1024 * 1024, size_t max_in_flight = 128,
+            size_t max_output = 4 * 1024 * 1024);
+
+        /// Destrutor. Interrompe e aguarda todas as threads.
+        ~ComputeServer();
+
+        ComputeServer(const ComputeServer&) = delete;
+        ComputeServer& operator=(const ComputeServer&) = delete;
+
+        /// Abre os listeners e inicia as threads de I/O.
+        /// @param handler Handler chamado para cada requisição.
+        void start(Handler handler);
+
+        /// Interrompe o pool e as threads de I/O. Pode ser chamada de
+        /// qualquer thread.
+        void stop();
+
+        /// Aguarda o término de todas as threads. O pool termina antes, de
+        /// modo que nenhuma resposta é entregue a um laço já destruído.
+        void join();
+
+        /// Pool que executa o handler.
+        WorkStealingPool& get_pool() {
+            return this->pool;
+        }
+
+    private:
+
+        struct Connection;
+        struct RequestJob;
+        struct ResponseDelivery;
+
+        /// Registra uma conexão aceita no laço da thread de I/O.
+        void serve(EventLoop& loop, std::shared_ptr<TCPSocket> client);
+
+        /// Lê as requisições disponíveis e as entrega ao pool.
+        void read_requests(const std::shared_ptr<Connection>& connection);
+
+        /// Depois de uma resposta entregue ou enviada, fecha a conexão que
+        /// já terminou ou volta a ler a que estava pausada.
+        void resume(const std::shared_ptr<Connection>& connection);
+
+        /// Handler das requisições.
+        Handler handler;
+
+        /// Tamanho máximo aceito para uma requisição.
+        size_t max_frame;
+
+        /// Limites por conexão para pausar a leitura.
+        size_t max_in_flight;
+        size_t max_output;
+
+        /// Threads de I/O.
+        ReusePortServer io;
+
+        /// Pool que executa o handler. Declarado depois de io para ser
+        /// destruído antes, já que as tarefas usam os laços de io.
+        WorkStealingPool pool;
+};
+
+} // End namespace Socket
+
+#endif
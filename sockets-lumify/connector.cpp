@@ -0,0 +1,276 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "connector.hpp"
+
+#include <algorithm>
+
+using namespace Socket;
+
+Connector::Connector(EventLoop& loop, uint32_t attempt_delay) :
+    loop(loop), attempt_delay(attempt_delay) {}
+
+Connector::~Connector() {
+    for (auto it = requests.begin(); it != requests.end(); ++it) {
+        release(*it->second);
+    }
+}
+
+Connector::ConnectId Connector::connect(const std::string& address, uint32_t port,
+    uint32_t timeout_ms, ConnectCallback on_connect) {
+
+    std::shared_ptr<Request> request = std::make_shared<Request>();
+    request->id = next_id++;
+    request->on_connect = std::move(on_connect);
+    request->setup_error = resolve(address, port, request->addresses);
+
+    requests[request->id] = request;
+    Connector* self = this;
+
+    // A primeira tentativa também começa pelo laço, assim o callback nunca
+    // é chamado dentro de connect(), nem mesmo quando a resolução falha.
+    request->attempt_timer = loop.run_after(0, [self, request]() {
+        request->attempt_timer = 0;
+        if (request->setup_error != Errc::none) {
+            self->finish(request, Result<TCPConnection>(request->setup_error));
+            return;
+        }
+        self->start_attempt(request);
+    });
+
+    if (timeout_ms > 0) {
+        request->deadline_timer = loop.run_after(timeout_ms, [self, request]() {
+            request->deadline_timer = 0;
+            self->finish(request, Result<TCPConnection>(Errc::timed_out, ETIMEDOUT));
+        });
+    }
+
+    return request->id;
+}
+
+void Connector::cancel(ConnectId id) {
+
+    auto it = requests.find(id);
+    if (it == requests.end()) return;
+
+    release(*it->second);
+    requests.erase(it);
+}
+
+TCPConnection Connector::connect_blocking(const std::string& address, uint32_t port,
+    uint32_t timeout_ms, uint32_t attempt_delay) {
+
+    EventLoop loop(16);
+    Connector connector(loop, attempt_delay);
+
+    Result<TCPConnection> result(Errc::timed_out);
+    bool done = false;
+
+    connector.connect(address, port, timeout_ms, [&result, &done](Result<TCPConnection> connection) {
+        result = std::move(connection);
+        done = true;
+    });
+
+    while (!done) loop.run_once(-1);
+
+    if (!result.ok()) {
+        throw ConnectionException("Could not connect to " + address + ":" + std::to_string(port)
+            + ". Error: " + std::string(result.message()));
+    }
+
+    return std::move(result.value());
+}
+
+Errc Connector::resolve(const std::string& address, uint32_t port,
+    std::vector<sockaddr_storage>& addresses) {
+
+    sockaddr_storage literal;
+    memset(&literal, 0, sizeof(literal));
+
+    // Endereços IP não precisam do getaddrinfo().
+    sockaddr_in* ipv4 = (sockaddr_in *) &literal;
+    if (::inet_pton(AF_INET, address.c_str(), &ipv4->sin_addr) == 1) {
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons(port);
+        addresses.push_back(literal);
+        return Errc::none;
+    }
+
+    sockaddr_in6* ipv6 = (sockaddr_in6 *) &literal;
+    if (::inet_pton(AF_INET6, address.c_str(), &ipv6->sin6_addr) == 1) {
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons(port);
+        addresses.push_back(literal);
+        return Errc::none;
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    addrinfo* results = NULL;
+    if (::getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &results) != 0) {
+        return Errc::not_found;
+    }
+
+    std::vector<sockaddr_storage> ipv4_addresses, ipv6_addresses;
+    int first_family = results->ai_family;
+
+    for (addrinfo* info = results; info; info = info->ai_next) {
+
+        if (info->ai_addrlen > sizeof(sockaddr_storage)) continue;
+
+        sockaddr_storage resolved;
+        memset(&resolved, 0, sizeof(resolved));
+        memcpy(&resolved, info->ai_addr, info->ai_addrlen);
+
+        if (info->ai_family == AF_INET6) ipv6_addresses.push_back(resolved);
+        else if (info->ai_family == AF_INET) ipv4_addresses.push_back(resolved);
+    }
+
+    freeaddrinfo(results);
+
+    // Intercala as famílias, começando pela preferida pelo getaddrinfo(),
+    // para que um problema em uma delas não atrase a outra.
+    std::vector<sockaddr_storage>& first = first_family == AF_INET6 ? ipv6_addresses : ipv4_addresses;
+    std::vector<sockaddr_storage>& second = first_family == AF_INET6 ? ipv4_addresses : ipv6_addresses;
+
+    for (size_t i = 0; i < first.size() || i < second.size(); i++) {
+        if (i < first.size()) addresses.push_back(first[i]);
+        if (i < second.size()) addresses.push_back(second[i]);
+    }
+
+    return addresses.empty() ? Errc::not_found : Errc::none;
+}
+
+void Connector::start_attempt(std::shared_ptr<Request> request) {
+
+    request->attempt_timer = 0;
+    Connector* self = this;
+
+    while (request->next < request->addresses.size()) {
+
+        const sockaddr_storage& address = request->addresses[request->next++];
+        socklen_t length = address_length(address);
+
+        int fd = ::socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            request->last_error = errno;
+            continue;
+        }
+
+        if (::connect(fd, (const sockaddr *) &address, length) == -1 && errno != EINPROGRESS) {
+            request->last_error = errno;
+            ::close(fd);
+            continue;
+        }
+
+        // Mesmo uma conexão já estabelecida é confirmada pelo laço, que
+        // notifica EPOLLOUT assim que o descritor é registrado.
+        EventLoop::Handlers handlers;
+        handlers.on_writable = [self, request, fd]() {
+            self->check_attempt(request, fd);
+        };
+        handlers.on_closed = handlers.on_writable;
+
+        try {
+            loop.add(fd, handlers);
+        }
+        catch (const SocketException& e) {
+            request->last_error = ENOMEM;
+            ::close(fd);
+            continue;
+        }
+
+        request->attempts.push_back(fd);
+        break;
+    }
+
+    if (request->attempts.empty()) {
+        finish(request, Result<TCPConnection>(errc_from_errno(request->last_error), request->last_error));
+        return;
+    }
+
+    if (request->next < request->addresses.size()) {
+        request->attempt_timer = loop.run_after(attempt_delay, [self, request]() {
+            self->start_attempt(request);
+        });
+    }
+}
+
+void Connector::check_attempt(std::shared_ptr<Request> request, int fd) {
+
+    // A tentativa pode já ter sido encerrada por outra que terminou antes.
+    if (std::find(request->attempts.begin(), request->attempts.end(), fd) == request->attempts.end()) {
+        return;
+    }
+
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == -1) error = errno;
+
+    if (error == 0) {
+
+        sockaddr_storage peer;
+        socklen_t peer_length = sizeof(peer);
+
+        if (::getpeername(fd, (sockaddr *) &peer, &peer_length) == 0) {
+            // O descritor sai do laço e passa a pertencer à conexão.
+            loop.remove(fd);
+            request->attempts.erase(std::find(request->attempts.begin(), request->attempts.end(), fd));
+
+            finish(request, Result<TCPConnection>(TCPConnection(fd, peer, peer_length)));
+            return;
+        }
+
+        error = errno;
+    }
+
+    request->last_error = error;
+    close_attempt(*request, fd);
+
+    // Uma falha inicia a próxima tentativa sem esperar attempt_delay.
+    if (request->next < request->addresses.size()) {
+        loop.cancel_timer(request->attempt_timer);
+        start_attempt(request);
+    }
+    else if (request->attempts.empty()) {
+        finish(request, Result<TCPConnection>(errc_from_errno(error), error));
+    }
+}
+
+void Connector::close_attempt(Request& request, int fd) {
+
+    loop.remove(fd);
+    ::close(fd);
+
+    auto it = std::find(request.attempts.begin(), request.attempts.end(), fd);
+    if (it != request.attempts.end()) request.attempts.erase(it);
+}
+
+void Connector::finish(std::shared_ptr<Request> request, Result<TCPConnection> result) {
+
+    release(*request);
+    requests.erase(request->id);
+
+    // O callback pode destruir o conector, então é chamado por último.
+    ConnectCallback on_connect = std::move(request->on_connect);
+    if (on_connect) on_connect(std::move(result));
+}
+
+void Connector::release(Request& request) {
+
+    if (request.attempt_timer) loop.cancel_timer(request.attempt_timer);
+    if (request.deadline_timer) loop.cancel_timer(request.deadline_timer);
+    request.attempt_timer = 0;
+    request.deadline_timer = 0;
+
+    while (!request.attempts.empty()) {
+        close_attempt(request, request.attempts.back());
+    }
+}
@@ -0,0 +1,143 @@
+#ifndef CONNECTOR_H
+#define CONNECTOR_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "eventloop.hpp"
+
+namespace Socket {
+
+/** Conexões TCP não bloqueantes com prazo, no estilo Happy Eyeballs.
+ *
+ *      Resolve o destino e tenta os endereços encontrados em paralelo: a
+ *  primeira tentativa começa imediatamente e, enquanto nenhuma terminar,
+ *  uma nova é iniciada a cada attempt_delay milissegundos, alternando entre
+ *  IPv6 e IPv4. Uma tentativa que falha inicia a próxima sem esperar. A
+ *  primeira conexão estabelecida é entregue ao callback e as demais são
+ *  fechadas; se o prazo acabar antes, o callback recebe Errc::timed_out.
+ *      Os callbacks são sempre chamados pelo EventLoop, nunca dentro de
+ *  connect(). A resolução do nome ainda é feita com getaddrinfo() bloqueante,
+ *  a menos que o endereço já seja um IP.
+ *      Deve ser usado apenas na thread do EventLoop.
+ */
+class Connector {
+    public:
+
+        /// Identificador de uma conexão em andamento.
+        typedef uint64_t ConnectId;
+
+        /// Recebe a conexão estabelecida, em modo não bloqueante, ou o erro.
+        typedef std::function<void(Result<TCPConnection>)> ConnectCallback;
+
+        /// Cria o conector sobre um laço de eventos, que deve continuar vivo
+        /// enquanto o conector existir.
+        /// @param loop          Laço de eventos que acompanha as tentativas.
+        /// @param attempt_delay Milissegundos entre o início de tentativas paralelas.
+        Connector(EventLoop& loop, uint32_t attempt_delay = 250);
+
+        /// Destrutor. Cancela as conexões em andamento sem chamar os callbacks.
+        ~Connector();
+
+        Connector(const Connector&) = delete;
+        Connector& operator=(const Connector&) = delete;
+
+        /// Inicia uma conexão.
+        /// @param address    Endereço IP ou domínio de destino.
+        /// @param port       Porta de destino.
+        /// @param timeout_ms Prazo total para a conexão, 0 para sem limite.
+        /// @param on_connect Callback chamado uma única vez com o resultado.
+        /// @return Identificador usado por cancel().
+        ConnectId connect(const std::string& address, uint32_t port, uint32_t timeout_ms,
+            ConnectCallback on_connect);
+
+        /// Cancela uma conexão em andamento sem chamar o callback.
+        /// @param id Identificador retornado por connect().
+        void cancel(ConnectId id);
+
+        /// Número de conexões em andamento.
+        size_t pending() const {
+            return this->requests.size();
+        }
+
+        /// Conecta bloqueando a thread atual, com as mesmas tentativas
+        /// paralelas de connect(), usando um EventLoop temporário.
+        /// @param address       Endereço IP ou domínio de destino.
+        /// @param port          Porta de destino.
+        /// @param timeout_ms    Prazo total para a conexão, 0 para sem limite.
+        /// @param attempt_delay Milissegundos entre o início de tentativas paralelas.
+        /// @return Conexão estabelecida, em modo não bloqueante.
+        static TCPConnection connect_blocking(const std::string& address, uint32_t port,
+            uint32_t timeout_ms, uint32_t attempt_delay = 250);
+
+    private:
+
+        /// Estado de uma conexão em andamento.
+        struct Request {
+            ConnectId id;
+
+            /// Endereços resolvidos, na ordem em que serão tentados.
+            std::vector<sockaddr_storage> addresses;
+
+            /// Índice do próximo endereço a ser tentado.
+            size_t next = 0;
+
+            /// Descritores das tentativas em andamento.
+            std::vector<int> attempts;
+
+            /// errno da última tentativa que falhou.
+            int last_error = 0;
+
+            /// Erro encontrado antes da primeira tentativa, como falha na resolução.
+            Errc setup_error = Errc::none;
+
+            EventLoop::TimerId deadline_timer = 0;
+            EventLoop::TimerId attempt_timer = 0;
+
+            ConnectCallback on_connect;
+        };
+
+        /// Resolve o destino, intercalando endereços IPv6 e IPv4.
+        /// @return Errc::none ou Errc::not_found.
+        static Errc resolve(const std::string& address, uint32_t port,
+            std::vector<sockaddr_storage>& addresses);
+
+        /// Inicia tentativas até uma ficar pendente ou os endereços acabarem,
+        /// e agenda a próxima tentativa paralela.
+        void start_attempt(std::shared_ptr<Request> request);
+
+        /// Verifica o resultado de uma tentativa quando o descritor é notificado.
+        void check_attempt(std::shared_ptr<Request> request, int fd);
+
+        /// Fecha uma tentativa e a remove do laço.
+        void close_attempt(Request& request, int fd);
+
+        /// Encerra a conexão, libera as tentativas restantes e chama o callback.
+        void finish(std::shared_ptr<Request> request, Result<TCPConnection> result);
+
+        /// Libera as tentativas e os timers de uma conexão.
+        void release(Request& request);
+
+        /// Laço de eventos que acompanha as tentativas.
+        EventLoop& loop;
+
+        /// Milissegundos entre o início de tentativas paralelas.
+        uint32_t attempt_delay;
+
+        /// Identificador da próxima conexão.
+        ConnectId next_id = 1;
+
+        /// Conexões em andamento.
+        std::unordered_map<ConnectId, std::shared_ptr<Request>> requests;
+};
+
+} // End namespace Socket
+
+#endif
@@ -0,0 +1,310 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "coroutine.hpp"
+
+using namespace Socket;
+
+/// Indica que a operação deve esperar a socket ficar pronta.
+static bool must_wait(Errc error) {
+    return error == Errc::would_block || error == Errc::timed_out;
+}
+
+Scheduler::Scheduler(EventLoop& loop) : loop(loop), connector(loop) {}
+
+Scheduler::~Scheduler() {
+    for (auto& watch : watches) {
+        if (watch.second.registered) loop.remove(watch.first);
+    }
+}
+
+void Scheduler::spawn(Task<> task) {
+    run_detached(std::move(task));
+}
+
+Scheduler::Detached Scheduler::run_detached(Task<> task) {
+
+    active_tasks++;
+
+    try {
+        co_await task;
+    }
+    catch (...) {
+        if (error_handler) error_handler(std::current_exception());
+    }
+
+    active_tasks--;
+}
+
+void Scheduler::run() {
+    loop.run();
+}
+
+void Scheduler::stop() {
+    loop.stop();
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  ESPERA POR DESCRITORES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void Scheduler::watch(int fd, bool write, std::coroutine_handle<> handle) {
+
+    if (fd < 0) {
+        throw SocketException("Can't wait on a socket that is closed");
+    }
+
+    Watch& watch = watches[fd];
+    std::coroutine_handle<>& waiter = write ? watch.writer : watch.reader;
+
+    if (waiter) {
+        throw SocketException("Socket " + std::to_string(fd) + " already has a coroutine waiting to "
+            + (write ? "write" : "read"));
+    }
+    waiter = handle;
+
+    // O descritor é registrado uma vez e, nas esperas seguintes, só tem os
+    // eventos pedidos trocados pelos das corrotinas que esperam. A troca
+    // também faz o epoll reavaliar o estado atual do descritor, já que a
+    // borda pode ter sido consumida enquanto ninguém esperava por ela. Se o
+    // descritor foi fechado e o número reutilizado, o registro é refeito.
+    try {
+        if (!watch.registered || !loop.modify(fd, (bool) watch.reader, (bool) watch.writer)) {
+            register_fd(fd);
+        }
+    }
+    catch (...) {
+        waiter = nullptr;
+        throw;
+    }
+}
+
+void Scheduler::register_fd(int fd) {
+
+    Scheduler* self = this;
+
+    EventLoop::Handlers handlers;
+    handlers.on_readable = [self, fd]() { self->wake(fd, false); };
+    handlers.on_writable = [self, fd]() { self->wake(fd, true); };
+    handlers.on_closed = [self, fd]() { self->wake_closed(fd); };
+
+    Watch& watch = watches[fd];
+    watch.registered = false;
+    loop.add(fd, handlers);
+    watch.registered = true;
+}
+
+void Scheduler::wake(int fd, bool write) {
+
+    auto it = watches.find(fd);
+    if (it == watches.end()) return;
+
+    std::coroutine_handle<> handle = write ? it->second.writer : it->second.reader;
+    if (!handle) return;
+
+    // A corrotina pode voltar a esperar, ou fechar a socket, ao ser retomada.
+    // O descritor continua registrado para a próxima espera.
+    (write ? it->second.writer : it->second.reader) = nullptr;
+
+    handle.resume();
+}
+
+void Scheduler::wake_closed(int fd) {
+
+    auto it = watches.find(fd);
+    if (it == watches.end()) return;
+
+    // O laço já removeu o descritor; as corrotinas refazem a operação e
+    // recebem o fechamento ou o erro da própria chamada de sistema.
+    Watch watch = it->second;
+    watches.erase(it);
+
+    if (watch.reader) watch.reader.resume();
+    if (watch.writer) watch.writer.resume();
+}
+
+void Scheduler::ConnectAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    Result<TCPConnection>* destination = &result;
+    scheduler.connector.connect(address, port, timeout_ms, [destination, handle](Result<TCPConnection> connection) {
+        *destination = std::move(connection);
+        handle.resume();
+    });
+}
+
+void Scheduler::SleepAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    scheduler.loop.run_after(milliseconds, [handle]() { handle.resume(); });
+}
+
+Task<> Scheduler::readable(int fd) {
+    co_await ReadyAwaiter{*this, fd, false};
+}
+
+Task<> Scheduler::writable(int fd) {
+    co_await ReadyAwaiter{*this, fd, true};
+}
+
+Task<> Scheduler::sleep_for(uint32_t milliseconds) {
+    co_await SleepAwaiter{*this, milliseconds};
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  OPERAÇÕES ASSÍNCRONAS
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+Task<std::shared_ptr<TCPSocket>> Scheduler::async_accept(TCPSocket& listener) {
+
+    listener.set_nonblocking(true);
+
+    for (;;) {
+
+        Result<TCPConnection> result = listener.try_accept();
+
+        if (result.ok()) {
+            // O endereço é copiado para dentro do objeto, como em TCPSocket::accept().
+            sockaddr_storage peer = result.value().get_peer();
+            std::shared_ptr<TCPSocket> client = std::make_shared<TCPSocket>(
+                result.value().release(), peer, address_length(peer));
+            client->set_nonblocking(true);
+            co_return client;
+        }
+
+        if (must_wait(result.error())) {
+            co_await ReadyAwaiter{*this, listener.get_fd(), false};
+            continue;
+        }
+
+        // Erros que afetam só a conexão sendo aceita, como uma conexão
+        // abortada ou uma opção herdada que falhou: tenta a próxima.
+        if (result.error() == Errc::option_failed || result.error() == Errc::interrupted ||
+            is_transient_accept_error(result.get_errno())) {
+            continue;
+        }
+
+        // Sem descritores ou memória a conexão continua na fila; espera um
+        // pouco e tenta de novo, como EventLoop::add_listener().
+        if (result.error() == Errc::no_resources) {
+            co_await sleep_for(EventLoop::ACCEPT_RETRY_MS);
+            continue;
+        }
+
+        throw ConnectionException("Error while accepting a connection. Error: "
+            + std::string(result.message()));
+    }
+}
+
+Task<size_t> Scheduler::async_recv(TCPSocket& socket, uint8_t* buffer, size_t capacity) {
+
+    socket.set_nonblocking(true);
+
+    for (;;) {
+
+        Result<size_t> result = socket.try_recv_into(buffer, capacity);
+
+        if (result.ok()) co_return result.value();
+        if (result.error() == Errc::interrupted) continue;
+
+        if (result.error() == Errc::closed) {
+            throw ClosedConnection("Client closed connection.");
+        }
+        if (!must_wait(result.error())) {
+            throw ConnectionException("Could not receive message. Error: "
+                + std::string(result.message()));
+        }
+
+        co_await ReadyAwaiter{*this, socket.get_fd(), false};
+    }
+}
+
+Task<> Scheduler::async_send(TCPSocket& socket, const uint8_t* message, size_t length) {
+
+    socket.set_nonblocking(true);
+
+    size_t bytes_sent = 0;
+
+    while (bytes_sent < length) {
+
+        Result<size_t> result = socket.try_send(message + bytes_sent, length - bytes_sent);
+
+        if (result.ok()) {
+            bytes_sent += result.value();
+            if (bytes_sent == length) break;
+        }
+        else if (result.error() == Errc::interrupted) {
+            continue;
+        }
+        else if (!must_wait(result.error())) {
+            throw ConnectionException("Could not send message. Error: "
+                + std::string(result.message()));
+        }
+
+        co_await ReadyAwaiter{*this, socket.get_fd(), true};
+    }
+}
+
+Task<> Scheduler::async_send(TCPSocket& socket, std::string message) {
+    // A string vive no frame da corrotina até o fim do envio.
+    co_await async_send(socket, (const uint8_t*) message.data(), message.size());
+}
+
+Task<std::shared_ptr<TCPSocket>> Scheduler::async_connect(std::string address, uint32_t port,
+    uint32_t timeout_ms) {
+
+    Result<TCPConnection> result(Errc::not_connected);
+    co_await ConnectAwaiter{*this, address, port, timeout_ms, result};
+
+    if (!result.ok()) {
+        throw ConnectionException("Could not connect to " + address + ":" + std::to_string(port)
+            + ". Error: " + std::string(result.message()));
+    }
+
+    sockaddr_storage peer = result.value().get_peer();
+    std::shared_ptr<TCPSocket> socket = std::make_shared<TCPSocket>(
+        result.value().release(), peer, address_length(peer));
+    socket->set_nonblocking(true);
+
+    co_return socket;
+}
+
+Task<size_t> Scheduler::async_recvfrom(UDPSocket& socket, Datagram& datagram) {
+
+    socket.set_nonblocking(true);
+
+    for (;;) {
+
+        Result<size_t> result = socket.try_recvfrom(datagram);
+
+        if (result.ok()) co_return result.value();
+        if (result.error() == Errc::interrupted) continue;
+
+        if (!must_wait(result.error())) {
+            throw ConnectionException("Could not receive message. Error: "
+                + std::string(result.message()));
+        }
+
+        co_await ReadyAwaiter{*this, socket.get_fd(), false};
+    }
+}
+
+Task<> Scheduler::async_sendto(UDPSocket& socket, Endpoint endpoint, const uint8_t* message,
+    size_t length) {
+
+    socket.set_nonblocking(true);
+
+    for (;;) {
+
+        Result<size_t> result = socket.try_sendto(endpoint, message, length);
+
+        if (result.ok()) co_return;
+        if (result.error() == Errc::interrupted) continue;
+
+        if (!must_wait(result.error())) {
+            throw ConnectionException("Could not send message. Error: "
+                + std::string(result.message()));
+        }
+
+        co_await ReadyAwaiter{*this, socket.get_fd(), true};
+    }
+}
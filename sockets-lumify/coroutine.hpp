@@ -0,0 +1,470 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+// Ao contrário do restante da biblioteca, este arquivo exige C++20.
+#if __cplusplus < 202002L
+#error "coroutine.hpp requires C++20 (-std=c++20)"
+#endif
+
+#include "connector.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace Socket {
+
+template<typename T> class Task;
+
+namespace detail {
+
+/// Parte da promise comum a Task<T> e Task<void>.
+class TaskPromiseBase {
+    public:
+
+        /// Ao terminar, retoma a corrotina que esperava pela task.
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        /// A task só começa quando é esperada com co_await.
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void unhandled_exception() noexcept {
+            this->error = std::current_exception();
+        }
+
+        /// Corrotina retomada quando a task termina.
+        std::coroutine_handle<> continuation;
+
+        /// Exceção lançada pela task, relançada para quem a espera.
+        std::exception_ptr error;
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase {
+    public:
+
+        Task<T> get_return_object() noexcept;
+
+        template<typename U>
+        void return_value(U&& value) {
+            this->value.emplace(std::forward<U>(value));
+        }
+
+        T result() {
+            if (this->error) std::rethrow_exception(this->error);
+            return std::move(*this->value);
+        }
+
+    private:
+
+        std::optional<T> value;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase {
+    public:
+
+        Task<void> get_return_object() noexcept;
+
+        void return_void() noexcept {}
+
+        void result() {
+            if (this->error) std::rethrow_exception(this->error);
+        }
+};
+
+} // End namespace detail
+
+
+/** Corrotina que produz um valor do tipo T.
+ *
+ *      A execução começa apenas quando a task é esperada com co_await, e a
+ *  corrotina que espera é retomada assim que a task termina, recebendo o
+ *  valor retornado com co_return ou a exceção lançada. Pode ser movida mas
+ *  não copiada, e só pode ser esperada uma vez. Para executar uma task sem
+ *  esperar por ela, use Scheduler::spawn().
+ */
+template<typename T = void>
+class Task {
+    public:
+
+        typedef detail::TaskPromise<T> promise_type;
+
+        Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                if (this->handle) this->handle.destroy();
+                this->handle = std::exchange(other.handle, nullptr);
+            }
+            return *this;
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        /// Destrutor. Libera o frame da corrotina.
+        ~Task() {
+            if (this->handle) this->handle.destroy();
+        }
+
+        /// Indica se a task já terminou.
+        bool is_done() const {
+            return !this->handle || this->handle.done();
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        /// Inicia a task, guardando quem deve ser retomado quando ela terminar.
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) noexcept {
+            this->handle.promise().continuation = waiting;
+            return this->handle;
+        }
+
+        T await_resume() {
+            return this->handle.promise().result();
+        }
+
+    private:
+
+        friend class detail::TaskPromise<T>;
+        friend class Scheduler;
+
+        /// Espera a task terminar sem consumir o resultado, que continua
+        /// disponível para await_resume().
+        struct Completion {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) noexcept {
+                this->handle.promise().continuation = waiting;
+                return this->handle;
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+        std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+} // End namespace detail
+
+
+/** Executa corrotinas sobre um EventLoop.
+ *
+ *      As operações async_* tentam a chamada de sistema sem bloquear e, se a
+ *  socket não estiver pronta, suspendem a corrotina até o EventLoop indicar
+ *  que ela pode continuar. Assim o código de cada conexão é escrito em
+ *  sequência, como em um servidor bloqueante, mas milhares de conexões são
+ *  atendidas por uma única thread:
+ *
+ *      Task<> echo(Scheduler& scheduler, std::shared_ptr<TCPSocket> client) {
+ *          uint8_t buffer[4096];
+ *          for (;;) {
+ *              size_t received = co_await scheduler.async_recv(*client, buffer, sizeof(buffer));
+ *              co_await scheduler.async_send(*client, buffer, received);
+ *          }
+ *      }
+ *
+ *      As sockets usadas são colocadas em modo não bloqueante. Uma socket é
+ *  registrada no laço na primeira espera e continua registrada nas seguintes,
+ *  que só trocam os eventos pedidos. Pode ser fechada a qualquer momento em
+ *  que nenhuma corrotina estiver suspensa nela: o kernel a retira do epoll e
+ *  o registro é refeito se o número do descritor voltar a ser usado. Cada
+ *  socket aceita no máximo uma corrotina esperando leitura e uma esperando
+ *  escrita ao mesmo tempo. Corrotinas esperando escrita só são retomadas
+ *  quando a socket aceita mais bytes ou é fechada, e não quando o outro lado
+ *  apenas encerra o envio.
+ *      Deve ser usado apenas na thread do EventLoop.
+ */
+class Scheduler {
+    public:
+
+        /// Cria o scheduler sobre um laço de eventos, que deve continuar vivo
+        /// enquanto o scheduler existir.
+        /// @param loop Laço de eventos que retoma as corrotinas.
+        Scheduler(EventLoop& loop);
+
+        /// Destrutor. As corrotinas ainda suspensas não são retomadas.
+        ~Scheduler();
+
+        Scheduler(const Scheduler&) = delete;
+        Scheduler& operator=(const Scheduler&) = delete;
+
+        /// Inicia uma task sem esperar por ela. A task roda até a primeira
+        /// suspensão antes de spawn() retornar. Exceções não tratadas pela
+        /// task são entregues ao callback de set_error_handler().
+        /// @param task Task a ser executada.
+        void spawn(Task<> task);
+
+        /// Executa o laço até que a task termine.
+        /// @param task Task a ser executada.
+        /// @return Valor retornado pela task. Exceções da task são relançadas.
+        template<typename T>
+        T run_until_complete(Task<T> task);
+
+        /// Executa o laço até stop() ser chamada.
+        void run();
+
+        /// Interrompe run(). Pode ser chamada de qualquer thread.
+        void stop();
+
+        /// Define o callback que recebe exceções não tratadas por tasks
+        /// iniciadas com spawn(). Por padrão são ignoradas.
+        void set_error_handler(std::function<void(std::exception_ptr)> handler) {
+            this->error_handler = std::move(handler);
+        }
+
+        /// Número de tasks iniciadas com spawn() que ainda não terminaram.
+        size_t active() const {
+            return this->active_tasks;
+        }
+
+        /// Laço de eventos usado pelo scheduler.
+        EventLoop& get_loop() {
+            return this->loop;
+        }
+
+        /// Aceita uma conexão sem bloquear a thread. Conexões que falham sozinhas
+        /// são ignoradas e, se faltarem descritores ou memória, o accept é
+        /// repetido a cada EventLoop::ACCEPT_RETRY_MS; só erros do próprio
+        /// listener são lançados.
+        /// @param listener Socket que está ouvindo conexões.
+        /// @return Conexão aceita, em modo não bloqueante.
+        Task<std::shared_ptr<TCPSocket>> async_accept(TCPSocket& listener);
+
+        /// Recebe bytes sem bloquear a thread. Lança ClosedConnection caso o
+        /// outro lado feche a conexão.
+        /// @param socket   Socket conectada.
+        /// @param buffer   Buffer que receberá os bytes.
+        /// @param capacity Número máximo de bytes a serem recebidos.
+        /// @return Número de bytes recebidos, ao menos 1.
+        Task<size_t> async_recv(TCPSocket& socket, uint8_t* buffer, size_t capacity);
+
+        /// Envia todos os bytes sem bloquear a thread.
+        /// @param socket  Socket conectada.
+        /// @param message Bytes a serem enviados, válidos até o fim do envio.
+        /// @param length  Número de bytes.
+        Task<> async_send(TCPSocket& socket, const uint8_t* message, size_t length);
+
+        /// Envia uma string sem bloquear a thread.
+        /// @param socket  Socket conectada.
+        /// @param message Mensagem a ser enviada.
+        Task<> async_send(TCPSocket& socket, std::string message);
+
+        /// Conecta a um destino sem bloquear a thread, com as tentativas
+        /// paralelas do Connector.
+        /// @param address    Endereço IP ou domínio de destino.
+        /// @param port       Porta de destino.
+        /// @param timeout_ms Prazo para a conexão, 0 para sem limite.
+        /// @return Socket conectada, em modo não bloqueante.
+        Task<std::shared_ptr<TCPSocket>> async_connect(std::string address, uint32_t port,
+            uint32_t timeout_ms = 0);
+
+        /// Recebe um datagrama sem bloquear a thread.
+        /// @param socket   Socket UDP.
+        /// @param datagram Datagrama que receberá a mensagem e o transmissor.
+        /// @return Número de bytes recebidos.
+        Task<size_t> async_recvfrom(UDPSocket& socket, Datagram& datagram);
+
+        /// Envia um datagrama sem bloquear a thread.
+        /// @param socket   Socket UDP.
+        /// @param endpoint Destino.
+        /// @param message  Bytes a serem enviados.
+        /// @param length   Número de bytes.
+        Task<> async_sendto(UDPSocket& socket, Endpoint endpoint, const uint8_t* message, size_t length);
+
+        /// Suspende a corrotina por um tempo.
+        /// @param milliseconds Tempo de espera.
+        Task<> sleep_for(uint32_t milliseconds);
+
+        /// Suspende a corrotina até o descritor estar pronto para leitura.
+        Task<> readable(int fd);
+
+        /// Suspende a corrotina até o descritor estar pronto para escrita.
+        Task<> writable(int fd);
+
+    private:
+
+        /// Corrotinas esperando um descritor.
+        struct Watch {
+            std::coroutine_handle<> reader;
+            std::coroutine_handle<> writer;
+
+            /// Se o descritor foi registrado no laço. Continua registrado
+            /// entre as esperas, até o outro lado fechar a conexão.
+            bool registered = false;
+        };
+
+        /// Suspende a corrotina até o descritor ficar pronto.
+        struct ReadyAwaiter {
+            Scheduler& scheduler;
+            int fd;
+            bool write;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                scheduler.watch(fd, write, handle);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        /// Suspende a corrotina até o Connector terminar a conexão.
+        /// Guarda apenas referências: o GCC 12 destrói duas vezes membros não
+        /// triviais de awaiters temporários.
+        struct ConnectAwaiter {
+            Scheduler& scheduler;
+            const std::string& address;
+            uint32_t port;
+            uint32_t timeout_ms;
+            Result<TCPConnection>& result;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle);
+
+            void await_resume() const noexcept {}
+        };
+
+        /// Suspende a corrotina até um timer do laço expirar.
+        struct SleepAwaiter {
+            Scheduler& scheduler;
+            uint32_t milliseconds;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle);
+
+            void await_resume() const noexcept {}
+        };
+
+        /// Corrotina que executa uma task iniciada com spawn() e se destrói
+        /// ao terminar.
+        struct Detached {
+            struct promise_type {
+                Detached get_return_object() noexcept {
+                    return {};
+                }
+                std::suspend_never initial_suspend() noexcept {
+                    return {};
+                }
+                std::suspend_never final_suspend() noexcept {
+                    return {};
+                }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept {}
+            };
+        };
+
+        /// Executa uma task iniciada com spawn().
+        Detached run_detached(Task<> task);
+
+        /// Executa a task de run_until_complete(), marcando done ao terminar.
+        template<typename T>
+        Detached run_tracked(Task<T>& task, bool& done);
+
+        /// Registra a corrotina como esperando o descritor.
+        void watch(int fd, bool write, std::coroutine_handle<> handle);
+
+        /// Retoma a corrotina que espera leitura ou escrita em um descritor.
+        void wake(int fd, bool write);
+
+        /// Retoma as corrotinas de um descritor fechado nos dois sentidos ou
+        /// com erro (EPOLLHUP, EPOLLERR).
+        void wake_closed(int fd);
+
+        /// Registra um descritor no laço com os callbacks do scheduler.
+        void register_fd(int fd);
+
+        /// Laço de eventos que retoma as corrotinas.
+        EventLoop& loop;
+
+        /// Conexões de async_connect().
+        Connector connector;
+
+        /// Corrotinas esperando cada descritor.
+        std::unordered_map<int, Watch> watches;
+
+        /// Tasks iniciadas com spawn() que ainda não terminaram.
+        size_t active_tasks = 0;
+
+        /// Recebe exceções não tratadas de tasks iniciadas com spawn().
+        std::function<void(std::exception_ptr)> error_handler;
+};
+
+template<typename T>
+Scheduler::Detached Scheduler::run_tracked(Task<T>& task, bool& done) {
+    co_await typename Task<T>::Completion{task.handle};
+    done = true;
+}
+
+template<typename T>
+T Scheduler::run_until_complete(Task<T> task) {
+
+    bool done = false;
+
+    // O resultado, ou a exceção, fica na promise da task até o fim.
+    run_tracked(task, done);
+    while (!done) loop.run_once(-1);
+
+    return task.await_resume();
+}
+
+} // End namespace Socket
+
+#endif
@@ -0,0 +1,391 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "eventloop.hpp"
+
+#include <sys/eventfd.h>
+#include <climits>
+
+using namespace Socket;
+
+/// Chave reservada para o eventfd de wakeup().
+static const uint64_t WAKEUP_KEY = ~(uint64_t) 0;
+
+const uint32_t EventLoop::ACCEPT_RETRY_MS;
+
+EventLoop::EventLoop(int max_events) : stop_requested(false), events(max_events > 0 ? max_events : 1) {
+
+    epollfd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1) {
+        throw SocketException("Could not create epoll instance. Error: "
+            + std::string(strerror(errno)));
+    }
+
+    wakefd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakefd == -1) {
+        ::close(epollfd);
+        throw SocketException("Could not create eventfd. Error: "
+            + std::string(strerror(errno)));
+    }
+
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = WAKEUP_KEY;
+    if (::epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &event) == -1) {
+        int error = errno;
+        ::close(wakefd);
+        ::close(epollfd);
+        throw SocketException("Could not add eventfd to epoll instance. Error: "
+            + std::string(strerror(error)));
+    }
+}
+
+EventLoop::~EventLoop() {
+    ::close(wakefd);
+    ::close(epollfd);
+}
+
+void EventLoop::add(BaseSocket& socket, const Handlers& handlers) {
+    socket.set_nonblocking(true);
+    add(socket.get_fd(), handlers);
+}
+
+void EventLoop::add(TCPConnection& connection, const Handlers& handlers) {
+    connection.set_nonblocking(true);
+    add(connection.get_fd(), handlers);
+}
+
+void EventLoop::add(int fd, const Handlers& handlers) {
+
+    if (fd < 0) {
+        throw SocketException("Can not add a closed socket to the event loop");
+    }
+
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->fd = fd;
+    entry->generation = next_generation++;
+    entry->handlers = handlers;
+
+    // Sempre pede leitura e escrita: em modo edge-triggered só há uma
+    // notificação por transição, então não há custo em pedir ambas.
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = ((uint64_t) entry->generation << 32) | (uint32_t) fd;
+
+    if (::epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        if (errno == EEXIST && entries.count(fd)) {
+            throw SocketException("Socket " + std::to_string(fd) + " is already in the event loop");
+        }
+        throw SocketException("Could not add socket to the event loop. Error: "
+            + std::string(strerror(errno)));
+    }
+
+    // Um registro anterior com o mesmo número só pode ser de um descritor
+    // fechado sem remove(), que o kernel já retirou do epoll.
+    entries[fd] = entry;
+}
+
+bool EventLoop::modify(int fd, bool readable, bool writable) {
+
+    auto it = entries.find(fd);
+    if (it == entries.end()) return false;
+
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLET;
+    if (readable) event.events |= EPOLLIN | EPOLLRDHUP;
+    if (writable) event.events |= EPOLLOUT;
+    event.data.u64 = ((uint64_t) it->second->generation << 32) | (uint32_t) fd;
+
+    if (::epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) == -1) {
+        // O descritor foi fechado sem remove(), e o número pode já ser de
+        // outro arquivo: o registro antigo é descartado.
+        if (errno == ENOENT || errno == EBADF) {
+            entries.erase(it);
+            return false;
+        }
+        throw SocketException("Could not modify socket in the event loop. Error: "
+            + std::string(strerror(errno)));
+    }
+
+    return true;
+}
+
+void EventLoop::add_listener(TCPSocket& listener, AcceptCallback on_accept) {
+
+    std::shared_ptr<Listener> state = std::make_shared<Listener>();
+    state->socket = &listener;
+    state->on_accept = std::move(on_accept);
+
+    EventLoop* self = this;
+
+    Handlers handlers;
+    handlers.on_readable = [self, state]() { self->accept_pending(state); };
+
+    add(listener, handlers);
+    state->generation = entries[listener.get_fd()]->generation;
+}
+
+void EventLoop::accept_pending(const std::shared_ptr<Listener>& state) {
+
+    // Aceita todas as conexões pendentes, já que só haverá uma notificação.
+    for (;;) {
+
+        Result<TCPConnection> result = state->socket->try_accept();
+
+        if (result.ok()) {
+            // O endereço é copiado para dentro do objeto, como em TCPSocket::accept().
+            sockaddr_storage peer = result.value().get_peer();
+            std::shared_ptr<TCPSocket> client = std::make_shared<TCPSocket>(
+                result.value().release(), peer, address_length(peer));
+            client->set_nonblocking(true);
+            state->on_accept(client);
+            continue;
+        }
+
+        if (result.error() == Errc::would_block || result.error() == Errc::timed_out) return;
+
+        // Erros que afetam só a conexão sendo aceita, inclusive falhas ao
+        // aplicar as opções herdadas: as demais continuam na fila e, como o
+        // epoll é edge-triggered, precisam ser aceitas agora.
+        if (result.error() == Errc::option_failed || result.error() == Errc::interrupted ||
+            is_transient_accept_error(result.get_errno())) {
+            continue;
+        }
+
+        // Outros erros indicam um listener inutilizável, como um descritor
+        // fechado, e repetir o accept só giraria em falso.
+        if (result.error() != Errc::no_resources) return;
+
+        // Sem descritores ou memória a conexão continua na fila, mas o epoll
+        // não voltará a notificar até um novo cliente chegar. Tenta de novo
+        // mais tarde, enquanto o listener continuar registrado.
+        if (!state->retry_pending) {
+            state->retry_pending = true;
+
+            EventLoop* self = this;
+            int fd = state->socket->get_fd();
+            run_after(ACCEPT_RETRY_MS, [self, state, fd]() {
+                state->retry_pending = false;
+                auto it = self->entries.find(fd);
+                if (it != self->entries.end() && it->second->generation == state->generation) {
+                    self->accept_pending(state);
+                }
+            });
+        }
+        return;
+    }
+}
+
+void EventLoop::remove(BaseSocket& socket) {
+    remove(socket.get_fd());
+}
+
+void EventLoop::remove(TCPConnection& connection) {
+    remove(connection.get_fd());
+}
+
+void EventLoop::remove(int fd) {
+
+    if (entries.erase(fd) == 0) return;
+
+    // Falha caso o descritor já tenha sido fechado, o que também o remove do epoll.
+    ::epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int EventLoop::run_once(int timeout_ms) {
+
+    int total = ::epoll_wait(epollfd, events.data(), events.size(), next_timeout(timeout_ms));
+    if (total == -1) {
+        if (errno != EINTR) {
+            throw SocketException("Error while waiting for events. Error: "
+                + std::string(strerror(errno)));
+        }
+        total = 0;
+    }
+
+    for (int i = 0; i < total; i++) {
+
+        uint64_t key = events[i].data.u64;
+        uint32_t flags = events[i].events;
+
+        if (key == WAKEUP_KEY) {
+            uint64_t value;
+            while (::read(wakefd, &value, sizeof(value)) > 0);
+            continue;
+        }
+
+        int fd = (int) (key & 0xffffffff);
+        uint32_t generation = (uint32_t) (key >> 32);
+
+        // O descritor pode ter sido removido (e até reutilizado) por um
+        // callback anterior deste mesmo lote.
+        auto it = entries.find(fd);
+        if (it == entries.end() || it->second->generation != generation) continue;
+
+        // Mantém o registro vivo mesmo que um callback o remova.
+        std::shared_ptr<Entry> entry = it->second;
+
+        // EPOLLRDHUP indica que o outro lado só parou de enviar: a leitura
+        // recebe o fim da conexão e ainda é possível responder.
+        if ((flags & (EPOLLIN | EPOLLPRI | EPOLLRDHUP)) && entry->handlers.on_readable) {
+            entry->handlers.on_readable();
+        }
+
+        it = entries.find(fd);
+        bool registered = it != entries.end() && it->second == entry;
+
+        if (registered && (flags & EPOLLOUT) && entry->handlers.on_writable) {
+            entry->handlers.on_writable();
+            it = entries.find(fd);
+            registered = it != entries.end() && it->second == entry;
+        }
+
+        if (registered && (flags & EPOLLERR) && entry->handlers.on_error) {
+            entry->handlers.on_error();
+            it = entries.find(fd);
+            registered = it != entries.end() && it->second == entry;
+        }
+
+        // Com on_error definido, EPOLLERR indica apenas mensagens na fila de
+        // erros; a conexão só é fechada por EPOLLHUP.
+        uint32_t closing = EPOLLHUP;
+        if (!entry->handlers.on_error) closing |= EPOLLERR;
+
+        if (registered && (flags & closing)) {
+            remove(fd);
+            if (entry->handlers.on_closed) entry->handlers.on_closed();
+        }
+    }
+
+    return total + run_timers() + run_posted();
+}
+
+EventLoop::TimerId EventLoop::run_after(uint32_t milliseconds, Callback callback) {
+
+    Timer timer;
+    timer.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    timer.id = next_timer++;
+
+    timers.push(timer);
+    timer_callbacks[timer.id] = std::move(callback);
+
+    return timer.id;
+}
+
+void EventLoop::cancel_timer(TimerId timer) {
+    timer_callbacks.erase(timer);
+}
+
+void EventLoop::post(Callback callback) {
+
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        was_empty = posted.empty();
+        posted.push_back(std::move(callback));
+    }
+
+    // Se a fila já tinha callbacks, o laço já foi acordado e ainda não os executou.
+    if (was_empty) wakeup();
+}
+
+int EventLoop::run_posted() {
+
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        if (posted.empty()) return 0;
+        running_posted.swap(posted);
+    }
+
+    // Executados fora do lock, assim os callbacks podem chamar post().
+    int executed = (int) running_posted.size();
+    for (size_t i = 0; i < running_posted.size(); i++) {
+        try {
+            running_posted[i]();
+        }
+        catch (...) {
+            // Os callbacks seguintes voltam para a fila, na mesma ordem,
+            // para a próxima iteração.
+            std::lock_guard<std::mutex> lock(posted_mutex);
+            posted.insert(posted.begin(), std::make_move_iterator(running_posted.begin() + i + 1),
+                std::make_move_iterator(running_posted.end()));
+            running_posted.clear();
+            if (!posted.empty()) wakeup();
+            throw;
+        }
+    }
+    running_posted.clear();
+
+    return executed;
+}
+
+int EventLoop::next_timeout(int timeout_ms) {
+
+    // Descarta os timers cancelados que estão no topo do heap.
+    while (!timers.empty() && !timer_callbacks.count(timers.top().id)) {
+        timers.pop();
+    }
+
+    if (timers.empty()) return timeout_ms;
+
+    auto remaining = timers.top().deadline - std::chrono::steady_clock::now();
+    if (remaining <= std::chrono::steady_clock::duration::zero()) return 0;
+
+    // Arredonda para cima, para não acordar antes do prazo e girar em falso.
+    int64_t milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+        remaining + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1)).count();
+    if (milliseconds > INT_MAX) milliseconds = INT_MAX;
+
+    if (timeout_ms < 0 || milliseconds < timeout_ms) return (int) milliseconds;
+    return timeout_ms;
+}
+
+int EventLoop::run_timers() {
+
+    int executed = 0;
+    auto now = std::chrono::steady_clock::now();
+
+    // Timers criados pelos callbacks com prazo 0 ficam para a próxima
+    // iteração, já que o prazo deles é posterior a now.
+    while (!timers.empty() && timers.top().deadline <= now) {
+
+        Timer timer = timers.top();
+        timers.pop();
+
+        auto it = timer_callbacks.find(timer.id);
+        if (it == timer_callbacks.end()) continue;
+
+        Callback callback = std::move(it->second);
+        timer_callbacks.erase(it);
+
+        callback();
+        executed++;
+    }
+
+    return executed;
+}
+
+void EventLoop::run() {
+
+    while (!stop_requested) {
+        run_once(-1);
+    }
+    stop_requested = false;
+}
+
+void EventLoop::stop() {
+    stop_requested = true;
+    wakeup();
+}
+
+void EventLoop::wakeup() {
+    uint64_t value = 1;
+    ssize_t result = ::write(wakefd, &value, sizeof(value));
+    (void) result;
+}
@@ -0,0 +1,268 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "sockets.hpp"
+
+#include <sys/epoll.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace Socket {
+
+/** Laço de eventos baseado em epoll edge-triggered.
+ *
+ *      Permite que uma única thread atenda milhares de sockets. Registre o
+ *  TCPSocket que está ouvindo com add_listener() e as sockets aceitas (ou
+ *  qualquer outra socket) com add(). As sockets registradas são colocadas
+ *  em modo não bloqueante e os callbacks são chamados quando há dados para
+ *  ler, espaço para escrever ou quando a conexão foi fechada.
+ *      Como o epoll é edge-triggered, os callbacks de leitura e escrita
+ *  devem consumir os dados até a socket lançar WouldBlock, caso contrário
+ *  não serão notificados novamente.
+ *      Também executa timers com run_after(), cujo prazo define o tempo
+ *  máximo de espera do epoll_wait().
+ *      Apenas stop() e post() podem ser chamadas de outra thread.
+ */
+class EventLoop {
+    public:
+
+        typedef std::function<void()> Callback;
+        typedef std::function<void(std::shared_ptr<TCPSocket>)> AcceptCallback;
+
+        /// Identificador de um timer criado com run_after().
+        typedef uint64_t TimerId;
+
+        /// Espera, em milissegundos, antes de tentar aceitar de novo quando
+        /// faltam descritores ou memória.
+        static const uint32_t ACCEPT_RETRY_MS = 100;
+
+        /// Callbacks de uma socket registrada. Callbacks vazios são ignorados.
+        struct Handlers {
+            /// Chamado quando há dados disponíveis para leitura.
+            Callback on_readable;
+
+            /// Chamado quando é possível escrever na socket.
+            Callback on_writable;
+
+            /// Chamado quando a conexão foi fechada nos dois sentidos (EPOLLHUP)
+            /// ou ocorreu um erro. A socket já foi removida do laço quando é
+            /// chamado. Quando o outro lado apenas encerra o envio, on_readable
+            /// é chamado e a leitura retorna o fim da conexão.
+            Callback on_closed;
+
+            /// Chamado quando há mensagens na fila de erros da socket (EPOLLERR),
+            /// como as confirmações de um ZeroCopySender. Quando definido, um
+            /// EPOLLERR sozinho não fecha a socket; cabe ao callback ler a fila
+            /// e verificar SO_ERROR.
+            Callback on_error;
+        };
+
+        /// Cria o laço de eventos.
+        /// @param max_events Número máximo de eventos tratados por iteração.
+        EventLoop(int max_events = 1024);
+
+        /// Destrutor. Encerra os descritores do epoll, sem fechar as sockets registradas.
+        ~EventLoop();
+
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        /// Registra uma socket, colocando-a em modo não bloqueante.
+        /// A socket deve continuar viva até ser removida com remove().
+        /// @param socket   Socket a ser registrada.
+        /// @param handlers Callbacks a serem chamados nos eventos da socket.
+        void add(BaseSocket& socket, const Handlers& handlers);
+
+        /// Registra uma conexão, colocando-a em modo não bloqueante.
+        /// A conexão deve continuar viva até ser removida com remove().
+        /// @param connection Conexão a ser registrada.
+        /// @param handlers   Callbacks a serem chamados nos eventos da conexão.
+        void add(TCPConnection& connection, const Handlers& handlers);
+
+        /// Registra um descritor de arquivo já em modo não bloqueante. Se um
+        /// descritor com o mesmo número foi fechado sem remove(), seu registro
+        /// é substituído.
+        /// @param fd       Descritor a ser registrado.
+        /// @param handlers Callbacks a serem chamados nos eventos do descritor.
+        void add(int fd, const Handlers& handlers);
+
+        /// Altera os eventos pedidos para um descritor registrado, sem
+        /// recriar o registro. Como o epoll é edge-triggered, o kernel também
+        /// reavalia o estado atual do descritor e notifica o que já estiver
+        /// pronto. EPOLLHUP e EPOLLERR são sempre notificados.
+        /// @param fd       Descritor registrado.
+        /// @param readable Se on_readable deve ser notificado.
+        /// @param writable Se on_writable deve ser notificado.
+        /// @return False se o descritor não está registrado ou foi fechado
+        ///         sem remove(); nesse caso o registro antigo é descartado.
+        bool modify(int fd, bool readable, bool writable);
+
+        /// Registra um TCPSocket que já está ouvindo conexões. Sempre que
+        /// houver conexões pendentes, todas são aceitas, colocadas em modo
+        /// não bloqueante e entregues a on_accept. Se faltarem descritores
+        /// (EMFILE, ENFILE) ou memória, o accept é repetido periodicamente
+        /// enquanto o listener estiver registrado.
+        /// @param listener  Socket que está ouvindo conexões.
+        /// @param on_accept Callback chamado com cada conexão aceita.
+        void add_listener(TCPSocket& listener, AcceptCallback on_accept);
+
+        /// Remove uma socket do laço. Deve ser chamada antes de fechar a socket.
+        /// @param socket Socket a ser removida.
+        void remove(BaseSocket& socket);
+
+        /// Remove uma conexão do laço. Deve ser chamada antes de fechar a conexão.
+        /// @param connection Conexão a ser removida.
+        void remove(TCPConnection& connection);
+
+        /// Remove um descritor de arquivo do laço.
+        /// @param fd Descritor a ser removido.
+        void remove(int fd);
+
+        /// Número de descritores registrados.
+        size_t size() const {
+            return this->entries.size();
+        }
+
+        /// Agenda um callback para ser executado uma vez pelo laço.
+        /// @param milliseconds Tempo de espera, 0 para a próxima iteração.
+        /// @param callback     Callback a ser executado.
+        /// @return Identificador do timer, usado por cancel_timer().
+        TimerId run_after(uint32_t milliseconds, Callback callback);
+
+        /// Cancela um timer que ainda não foi executado. Ignora timers já
+        /// executados ou cancelados.
+        /// @param timer Identificador retornado por run_after().
+        void cancel_timer(TimerId timer);
+
+        /// Número de timers agendados.
+        size_t timers_pending() const {
+            return this->timer_callbacks.size();
+        }
+
+        /// Agenda um callback para ser executado pela thread do laço, depois
+        /// dos eventos da iteração atual, acordando o laço se ele estiver
+        /// esperando. Pode ser chamada de qualquer thread; é a forma de outra
+        /// thread entregar trabalho às sockets registradas neste laço.
+        /// Callbacks ainda não executados são descartados na destruição.
+        /// @param callback Callback a ser executado.
+        void post(Callback callback);
+
+        /// Espera por eventos e executa os callbacks correspondentes.
+        /// @param timeout_ms Tempo máximo de espera em milissegundos, -1 para sem limite.
+        /// @return Número de eventos e timers tratados.
+        int run_once(int timeout_ms = -1);
+
+        /// Executa o laço até stop() ser chamada.
+        void run();
+
+        /// Interrompe run(). Pode ser chamada de qualquer thread, inclusive
+        /// antes de run() começar.
+        void stop();
+
+    private:
+
+        /// Estado de um listener registrado com add_listener().
+        struct Listener {
+            TCPSocket* socket;
+            AcceptCallback on_accept;
+
+            /// Geração do registro do listener, para o timer de nova
+            /// tentativa não usar um descritor removido ou reutilizado.
+            uint32_t generation = 0;
+
+            /// Se já há um timer agendado para tentar aceitar de novo.
+            bool retry_pending = false;
+        };
+
+        /// Registro de um descritor no laço.
+        struct Entry {
+            int fd;
+            uint32_t generation;
+            Handlers handlers;
+        };
+
+        /// Timer agendado, ordenado pelo prazo e, em caso de empate, pela
+        /// ordem de criação.
+        struct Timer {
+            std::chrono::steady_clock::time_point deadline;
+            TimerId id;
+
+            bool operator>(const Timer& other) const {
+                return deadline > other.deadline || (deadline == other.deadline && id > other.id);
+            }
+        };
+
+        /// Aceita as conexões pendentes de um listener.
+        void accept_pending(const std::shared_ptr<Listener>& state);
+
+        /// Acorda epoll_wait() quando stop() ou post() é chamada.
+        void wakeup();
+
+        /// Tempo de espera do epoll_wait(), limitado pelo próximo timer.
+        /// @param timeout_ms Tempo máximo pedido em run_once().
+        int next_timeout(int timeout_ms);
+
+        /// Executa os timers cujo prazo já passou.
+        /// @return Número de timers executados.
+        int run_timers();
+
+        /// Executa os callbacks entregues por post().
+        /// @return Número de callbacks executados.
+        int run_posted();
+
+        /// Descritor do epoll.
+        int epollfd = -1;
+
+        /// eventfd usado para acordar o laço.
+        int wakefd = -1;
+
+        /// Se run() deve retornar.
+        std::atomic<bool> stop_requested;
+
+        /// Contador usado para diferenciar descritores reutilizados pelo kernel
+        /// dentro de um mesmo lote de eventos.
+        uint32_t next_generation = 1;
+
+        /// Lote de eventos retornado pelo epoll_wait().
+        std::vector<epoll_event> events;
+
+        /// Descritores registrados.
+        std::unordered_map<int, std::shared_ptr<Entry>> entries;
+
+        /// Heap de timers. Timers cancelados são descartados ao chegar ao topo.
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+        /// Callbacks dos timers ainda não executados nem cancelados.
+        std::unordered_map<TimerId, Callback> timer_callbacks;
+
+        /// Identificador do próximo timer.
+        TimerId next_timer = 1;
+
+        /// Protege posted.
+        std::mutex posted_mutex;
+
+        /// Callbacks entregues por post() ainda não executados.
+        std::vector<Callback> posted;
+
+        /// Lote de posted sendo executado, reaproveitado entre iterações.
+        std::vector<Callback> running_posted;
+};
+
+} // End namespace Socket
+
+#endif
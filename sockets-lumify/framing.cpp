@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "framing.hpp"
+
+using namespace Socket;
+
+const size_t FramedStream::HEADER_SIZE;
+
+/// Lê o tamanho do payload de um cabeçalho big-endian.
+static uint32_t read_header(const uint8_t* header) {
+    return ((uint32_t) header[0] << 24) | ((uint32_t) header[1] << 16)
+         | ((uint32_t) header[2] << 8)  |  (uint32_t) header[3];
+}
+
+FramedStream::FramedStream(TCPSocket& socket, size_t buffer_size, size_t max_frame) :
+    socket(socket), buffer(buffer_size > HEADER_SIZE ? buffer_size : HEADER_SIZE),
+    max_frame(max_frame) {}
+
+/// Preenche os buffers de um frame, pulando os offset primeiros bytes.
+/// @return Número de buffers preenchidos.
+static int frame_buffers(iovec* buffers, uint8_t* header, const uint8_t* payload, size_t length,
+    size_t offset) {
+
+    header[0] = (uint8_t) (length >> 24);
+    header[1] = (uint8_t) (length >> 16);
+    header[2] = (uint8_t) (length >> 8);
+    header[3] = (uint8_t) length;
+
+    int count = 0;
+    if (offset < FramedStream::HEADER_SIZE) {
+        buffers[count].iov_base = header + offset;
+        buffers[count].iov_len = FramedStream::HEADER_SIZE - offset;
+        count++;
+        offset = 0;
+    }
+    else {
+        offset -= FramedStream::HEADER_SIZE;
+    }
+
+    buffers[count].iov_base = const_cast<uint8_t*>(payload) + offset;
+    buffers[count].iov_len = length - offset;
+    count++;
+
+    return count;
+}
+
+void FramedStream::send_frame(const uint8_t* payload, size_t length, int flags) {
+
+    if (length > max_frame || length > UINT32_MAX) {
+        throw SocketException("Frame of " + std::to_string(length)
+            + " bytes exceeds the maximum of " + std::to_string(max_frame));
+    }
+    if (socket.is_nonblocking()) {
+        throw SocketException("send_frame() can't be used on a non-blocking socket, use try_send_frame()");
+    }
+
+    uint8_t header[HEADER_SIZE];
+    iovec buffers[2];
+    int count = frame_buffers(buffers, header, payload, length, 0);
+
+    socket.sendv(buffers, count, flags);
+}
+
+Result<size_t> FramedStream::try_send_frame(const uint8_t* payload, size_t length, size_t offset,
+    int flags) noexcept {
+
+    if (length > max_frame || length > UINT32_MAX) return Result<size_t>(Errc::message_size);
+    if (offset >= HEADER_SIZE + length) return (size_t) 0;
+
+    uint8_t header[HEADER_SIZE];
+    iovec buffers[2];
+    int count = frame_buffers(buffers, header, payload, length, offset);
+
+    return socket.try_sendv(buffers, count, flags);
+}
+
+void FramedStream::send_frame(const std::string& payload, int flags) {
+    send_frame((const uint8_t *) payload.data(), payload.length(), flags);
+}
+
+FrameView FramedStream::recv_frame() {
+
+    FrameView frame;
+    while (!next_frame(frame)) {
+        fill();
+    }
+
+    return frame;
+}
+
+bool FramedStream::next_frame(FrameView& frame) {
+
+    if (buffered() < HEADER_SIZE) return false;
+
+    size_t length = read_header(&buffer[head]);
+    if (length > max_frame) {
+        throw ConnectionException("Received frame of " + std::to_string(length)
+            + " bytes, which exceeds the maximum of " + std::to_string(max_frame));
+    }
+
+    if (buffered() < HEADER_SIZE + length) return false;
+
+    frame.data = &buffer[head + HEADER_SIZE];
+    frame.size = length;
+
+    // Os bytes continuam no buffer até o próximo fill(), mantendo a visão válida.
+    head += HEADER_SIZE + length;
+    return true;
+}
+
+size_t FramedStream::fill() {
+
+    // Tamanho do frame incompleto no início do buffer, se o cabeçalho já chegou.
+    size_t needed = HEADER_SIZE;
+    if (buffered() >= HEADER_SIZE) {
+        needed = HEADER_SIZE + read_header(&buffer[head]);
+    }
+
+    if (needed > HEADER_SIZE + max_frame) {
+        throw ConnectionException("Received frame of " + std::to_string(needed - HEADER_SIZE)
+            + " bytes, which exceeds the maximum of " + std::to_string(max_frame));
+    }
+
+    // O buffer é compactado em vez de circular, assim todo frame fica
+    // contíguo e pode ser entregue como visão. Normalmente só resta o
+    // início de um frame, então a cópia é pequena.
+    if (head > 0) {
+        memmove(buffer.data(), &buffer[head], tail - head);
+        tail -= head;
+        head = 0;
+    }
+
+    // Frames maiores que o buffer fazem com que ele cresça.
+    if (buffer.size() < needed) {
+        buffer.resize(needed);
+    }
+
+    size_t received = socket.recv_into(buffer.data() + tail, buffer.size() - tail);
+    tail += received;
+
+    return received;
+}
@@ -0,0 +1,131 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "sockets.hpp"
+
+namespace Socket {
+
+/** Visão de um frame recebido, apontando para o buffer do FramedStream.
+ *
+ *      Não possui os bytes: é válida apenas até a próxima chamada de
+ *  recv_frame() ou fill() do FramedStream que a criou.
+ */
+struct FrameView {
+
+    /// Endereço inicial do payload.
+    const uint8_t* data;
+
+    /// Número de bytes do payload.
+    size_t size;
+
+    /// Cópia do payload como std::string.
+    std::string to_string() const {
+        return std::string((const char *) data, size);
+    }
+};
+
+
+/** Troca de mensagens com prefixo de tamanho sobre um TCPSocket.
+ *
+ *      Cada frame é enviado como um cabeçalho de 4 bytes (tamanho do payload,
+ *  big-endian) seguido do payload. No recebimento, os bytes são lidos em
+ *  blocos grandes para um buffer interno, de modo que vários frames pequenos
+ *  chegam com uma única chamada de recv(), e os frames são entregues como
+ *  visões para dentro do buffer, sem cópias.
+ *      Funciona também com sockets não bloqueantes: recv_frame() e fill()
+ *  lançam WouldBlock sem perder os bytes já recebidos, next_frame() entrega
+ *  os frames já completos sem nenhuma chamada de sistema e try_send_frame()
+ *  retoma um envio parcial a partir do offset já enviado.
+ */
+class FramedStream {
+    public:
+
+        /// Tamanho do cabeçalho de cada frame.
+        static const size_t HEADER_SIZE = 4;
+
+        /// Cria o stream sobre uma socket conectada, que deve continuar viva
+        /// enquanto o stream for usado.
+        /// @param socket      Socket conectada.
+        /// @param buffer_size Tamanho inicial do buffer de recebimento.
+        /// @param max_frame   Tamanho máximo aceito para o payload de um frame.
+        FramedStream(TCPSocket& socket, size_t buffer_size = 64 * 1024,
+            size_t max_frame = 16 * 1024 * 1024);
+
+        /// Envia um frame inteiro, sem copiar o payload. Cabeçalho e payload
+        /// vão na mesma chamada de sendmsg(), que é repetida em caso de envio
+        /// parcial. Lança SocketException se a socket for não bloqueante,
+        /// já que um WouldBlock no meio do frame corromperia o stream; nesse
+        /// caso use try_send_frame().
+        /// @param payload Endereço inicial do payload.
+        /// @param length  Número de bytes do payload.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void send_frame(const uint8_t* payload, size_t length, int flags = 0);
+
+        /// Envia um frame, ou o que faltar dele, sem lançar exceções. Em uma
+        /// socket não bloqueante pode enviar só parte do frame: chame de novo,
+        /// com o mesmo payload e offset somado ao valor retornado, quando a
+        /// socket aceitar mais bytes, até completar HEADER_SIZE + length.
+        /// @param payload Endereço inicial do payload.
+        /// @param length  Número de bytes do payload.
+        /// @param offset  Bytes do frame (cabeçalho e payload) já enviados.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        /// @return Número de bytes do frame enviados nesta chamada, ou o erro
+        ///         (Errc::message_size se o payload exceder o máximo).
+        Result<size_t> try_send_frame(const uint8_t* payload, size_t length, size_t offset = 0,
+            int flags = 0) noexcept;
+
+        /// Envia uma string como um frame.
+        /// @param payload Payload do frame.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void send_frame(const std::string& payload, int flags = 0);
+
+        /// Recebe o próximo frame, chamando fill() até que ele esteja completo.
+        /// @return Visão do frame, válida até a próxima chamada de recv_frame() ou fill().
+        FrameView recv_frame();
+
+        /// Extrai o próximo frame já completo no buffer, sem chamadas de sistema.
+        /// @param frame Visão preenchida com o frame, caso exista.
+        /// @return True se um frame completo foi extraído.
+        bool next_frame(FrameView& frame);
+
+        /// Recebe o máximo de bytes que couber no buffer com uma chamada de recv().
+        /// Invalida as visões entregues anteriormente.
+        /// @return Número de bytes recebidos.
+        size_t fill();
+
+        /// Número de bytes recebidos que ainda não foram entregues como frames.
+        size_t buffered() const {
+            return this->tail - this->head;
+        }
+
+    private:
+
+        /// Socket conectada.
+        TCPSocket& socket;
+
+        /// Buffer de recebimento. Os bytes válidos ficam em [head, tail).
+        std::vector<uint8_t> buffer;
+
+        /// Início dos bytes ainda não entregues.
+        size_t head = 0;
+
+        /// Fim dos bytes recebidos.
+        size_t tail = 0;
+
+        /// Tamanho máximo aceito para o payload de um frame.
+        size_t max_frame;
+};
+
+} // End namespace Socket
+
+#endif
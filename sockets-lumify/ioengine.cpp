@@ -0,0 +1,918 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "ioengine.hpp"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <deque>
+
+using namespace Socket;
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  IOENGINE
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+IoEngine::IoEngine() {}
+
+IoEngine::~IoEngine() {}
+
+IoEngine::Operation& IoEngine::enqueue(Operation::Type type, int fd, Completion on_complete) {
+
+    std::unique_ptr<Operation> operation(new Operation());
+    operation->id = next_id++;
+    operation->type = type;
+    operation->fd = fd;
+    operation->on_complete = std::move(on_complete);
+
+    Operation& queued = *operation;
+    operations[queued.id] = std::move(operation);
+
+    return queued;
+}
+
+void IoEngine::recv(int fd, uint8_t* buffer, size_t length, Completion on_complete, int flags) {
+
+    Operation& operation = enqueue(Operation::RECV, fd, std::move(on_complete));
+    operation.buffer = buffer;
+    operation.length = length;
+    operation.flags = flags;
+
+    start(operation);
+}
+
+void IoEngine::send(int fd, const uint8_t* message, size_t length, Completion on_complete, int flags) {
+
+    Operation& operation = enqueue(Operation::SEND, fd, std::move(on_complete));
+    operation.buffer = const_cast<uint8_t*>(message);
+    operation.length = length;
+    operation.flags = flags | MSG_NOSIGNAL;
+
+    start(operation);
+}
+
+void IoEngine::recvmsg(int fd, msghdr* message, Completion on_complete, int flags) {
+
+    Operation& operation = enqueue(Operation::RECVMSG, fd, std::move(on_complete));
+    operation.message = message;
+    operation.flags = flags;
+
+    start(operation);
+}
+
+void IoEngine::sendmsg(int fd, const msghdr* message, Completion on_complete, int flags) {
+
+    Operation& operation = enqueue(Operation::SENDMSG, fd, std::move(on_complete));
+    operation.message = const_cast<msghdr*>(message);
+    operation.flags = flags | MSG_NOSIGNAL;
+
+    start(operation);
+}
+
+void IoEngine::recvfrom(int fd, Datagram& datagram, Completion on_complete) {
+
+    Operation& operation = enqueue(Operation::RECVMSG, fd, std::move(on_complete));
+    operation.datagram = &datagram;
+
+    // Com MSG_TRUNC o resultado é o tamanho real do datagrama, o que indica
+    // se ele foi truncado.
+    operation.flags = MSG_TRUNC;
+
+    operation.vector.iov_base = datagram.buffer.data();
+    operation.vector.iov_len = datagram.buffer.size();
+
+    memset(&operation.header, 0, sizeof(operation.header));
+    operation.header.msg_name = &datagram.peer;
+    operation.header.msg_namelen = sizeof(datagram.peer);
+    operation.header.msg_iov = &operation.vector;
+    operation.header.msg_iovlen = 1;
+    operation.message = &operation.header;
+
+    start(operation);
+}
+
+void IoEngine::sendto(int fd, const Datagram& datagram, Completion on_complete) {
+
+    Operation& operation = enqueue(Operation::SENDMSG, fd, std::move(on_complete));
+    operation.flags = MSG_NOSIGNAL;
+
+    operation.vector.iov_base = const_cast<uint8_t*>(datagram.buffer.data());
+    operation.vector.iov_len = datagram.length;
+
+    memset(&operation.header, 0, sizeof(operation.header));
+    operation.header.msg_name = const_cast<sockaddr_storage*>(&datagram.peer);
+    operation.header.msg_namelen = address_length(datagram.peer);
+    operation.header.msg_iov = &operation.vector;
+    operation.header.msg_iovlen = 1;
+    operation.message = &operation.header;
+
+    start(operation);
+}
+
+void IoEngine::accept(int fd, Completion on_complete, sockaddr_storage* peer, socklen_t* peer_length) {
+
+    Operation& operation = enqueue(Operation::ACCEPT, fd, std::move(on_complete));
+    operation.peer = peer;
+    operation.peer_length = peer_length;
+    operation.address_length = sizeof(operation.address);
+
+    start(operation);
+}
+
+void IoEngine::connect(int fd, const sockaddr_storage& address, socklen_t length, Completion on_complete) {
+
+    if (length > sizeof(sockaddr_storage)) {
+        throw SocketException("Address length is larger than sockaddr_storage");
+    }
+
+    Operation& operation = enqueue(Operation::CONNECT, fd, std::move(on_complete));
+    memcpy(&operation.address, &address, length);
+    operation.address_length = length;
+
+    start(operation);
+}
+
+void IoEngine::read_fixed(int fd, uint8_t* buffer, size_t length, unsigned buffer_index,
+    Completion on_complete) {
+
+    check_fixed(buffer, length, buffer_index);
+
+    Operation& operation = enqueue(Operation::READ_FIXED, fd, std::move(on_complete));
+    operation.buffer = buffer;
+    operation.length = length;
+    operation.buffer_index = buffer_index;
+
+    start(operation);
+}
+
+void IoEngine::write_fixed(int fd, const uint8_t* message, size_t length, unsigned buffer_index,
+    Completion on_complete) {
+
+    check_fixed(message, length, buffer_index);
+
+    Operation& operation = enqueue(Operation::WRITE_FIXED, fd, std::move(on_complete));
+    operation.buffer = const_cast<uint8_t*>(message);
+    operation.length = length;
+    operation.buffer_index = buffer_index;
+
+    start(operation);
+}
+
+void IoEngine::register_buffers(const iovec* buffers, unsigned count) {
+
+    if (!fixed_buffers.empty()) {
+        throw SocketException("Buffers are already registered");
+    }
+
+    register_buffers_backend(buffers, count);
+    fixed_buffers.assign(buffers, buffers + count);
+}
+
+void IoEngine::register_files(const int* fds, unsigned count) {
+
+    if (!fixed_files.empty()) {
+        throw SocketException("Files are already registered");
+    }
+
+    register_files_backend(fds, count);
+
+    for (unsigned i = 0; i < count; i++) {
+        if (fds[i] < 0) continue;
+        if ((size_t) fds[i] >= fixed_files.size()) fixed_files.resize(fds[i] + 1, -1);
+        fixed_files[fds[i]] = i;
+    }
+}
+
+void IoEngine::cancel(int fd) {
+    cancel_operations(fd);
+}
+
+bool IoEngine::complete(uint64_t id, int result) {
+
+    auto it = operations.find(id);
+    if (it == operations.end()) return false;
+
+    // A operação sai da tabela antes do callback, que pode enfileirar outras.
+    std::unique_ptr<Operation> operation = std::move(it->second);
+    operations.erase(it);
+
+    if (operation->type == Operation::ACCEPT && result >= 0) {
+        if (operation->peer) memcpy(operation->peer, &operation->address, sizeof(operation->address));
+        if (operation->peer_length) *operation->peer_length = operation->address_length;
+    }
+
+    if (operation->datagram && operation->type == Operation::RECVMSG && result >= 0) {
+        Datagram& datagram = *operation->datagram;
+        datagram.truncated = (size_t) result > datagram.buffer.size();
+        datagram.length = datagram.truncated ? datagram.buffer.size() : result;
+        result = datagram.length;
+    }
+
+    if (operation->on_complete) operation->on_complete(result);
+
+    return true;
+}
+
+void IoEngine::check_fixed(const uint8_t* buffer, size_t length, unsigned buffer_index) const {
+
+    if (buffer_index >= fixed_buffers.size()) {
+        throw SocketException("Buffer index " + std::to_string(buffer_index) + " is not registered");
+    }
+
+    const uint8_t* start = (const uint8_t *) fixed_buffers[buffer_index].iov_base;
+    const uint8_t* end = start + fixed_buffers[buffer_index].iov_len;
+
+    if (buffer < start || buffer + length > end) {
+        throw SocketException("Buffer is outside of registered buffer " + std::to_string(buffer_index));
+    }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  URINGENGINE
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+namespace {
+
+/// user_data das operações internas (timeouts e cancelamentos), ignoradas
+/// ao recolher as conclusões.
+const uint64_t INTERNAL_KEY = 0;
+
+/// Backend io_uring, usando as chamadas de sistema diretamente e os anéis
+/// mapeados com mmap(), sem depender da liburing.
+class UringEngine : public IoEngine {
+    public:
+
+        UringEngine(unsigned entries);
+        ~UringEngine();
+
+        IoBackend get_backend() const {
+            return IoBackend::uring;
+        }
+
+        size_t submit();
+        size_t run_once(int timeout_ms);
+
+    protected:
+
+        void start(Operation& operation);
+        void cancel_operations(int fd);
+        void register_buffers_backend(const iovec* buffers, unsigned count);
+        void register_files_backend(const int* fds, unsigned count);
+
+    private:
+
+        /// Verifica se o kernel suporta as operações usadas.
+        void probe();
+
+        /// Próxima entrada livre da fila de submissão, já zerada. Envia as
+        /// entradas enfileiradas caso a fila esteja cheia.
+        io_uring_sqe* next_sqe();
+
+        /// Chama io_uring_enter() com as entradas ainda não enviadas.
+        /// @return Número de entradas enviadas, ou -errno.
+        int enter(unsigned min_complete, unsigned flags);
+
+        /// Chama os callbacks das conclusões disponíveis.
+        size_t reap();
+
+        /// Descritor do io_uring.
+        int ringfd = -1;
+
+        /// Regiões mapeadas dos anéis e das entradas de submissão.
+        void* sq_ring = MAP_FAILED;
+        void* cq_ring = MAP_FAILED;
+        size_t sq_ring_size = 0;
+        size_t cq_ring_size = 0;
+        io_uring_sqe* sqes = (io_uring_sqe *) MAP_FAILED;
+        size_t sqes_size = 0;
+
+        /// Campos do anel de submissão, compartilhados com o kernel.
+        unsigned* sq_head;
+        unsigned* sq_tail;
+        unsigned* sq_array;
+        unsigned sq_mask;
+        unsigned sq_entries;
+
+        /// Campos do anel de conclusão, compartilhados com o kernel.
+        unsigned* cq_head;
+        unsigned* cq_tail;
+        io_uring_cqe* cqes;
+        unsigned cq_mask;
+
+        /// Final local da fila de submissão, publicado no kernel por enter().
+        unsigned sqe_tail = 0;
+
+        /// Prazo do timeout usado por run_once(), lido pelo kernel na submissão.
+        __kernel_timespec timeout;
+};
+
+UringEngine::UringEngine(unsigned entries) {
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringfd = (int) ::syscall(__NR_io_uring_setup, entries, &params);
+    if (ringfd == -1) {
+        throw SocketException("Could not create io_uring. Error: " + std::string(strerror(errno)));
+    }
+
+    try {
+        probe();
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        // Desde o Linux 5.4 os dois anéis ficam na mesma região.
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap && cq_ring_size > sq_ring_size) sq_ring_size = cq_ring_size;
+
+        sq_ring = ::mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ringfd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) {
+            throw SocketException("Could not map io_uring. Error: " + std::string(strerror(errno)));
+        }
+
+        if (single_mmap) {
+            cq_ring = sq_ring;
+        }
+        else {
+            cq_ring = ::mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ringfd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED) {
+                throw SocketException("Could not map io_uring. Error: " + std::string(strerror(errno)));
+            }
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe *) ::mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            throw SocketException("Could not map io_uring. Error: " + std::string(strerror(errno)));
+        }
+    }
+    catch (...) {
+        if (sq_ring != MAP_FAILED) ::munmap(sq_ring, sq_ring_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) ::munmap(cq_ring, cq_ring_size);
+        ::close(ringfd);
+        throw;
+    }
+
+    uint8_t* sq = (uint8_t *) sq_ring;
+    sq_head = (unsigned *) (sq + params.sq_off.head);
+    sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    sq_array = (unsigned *) (sq + params.sq_off.array);
+    sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    sq_entries = *(unsigned *) (sq + params.sq_off.ring_entries);
+
+    uint8_t* cq = (uint8_t *) cq_ring;
+    cq_head = (unsigned *) (cq + params.cq_off.head);
+    cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+    cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+
+    sqe_tail = *sq_tail;
+}
+
+UringEngine::~UringEngine() {
+    ::munmap(sqes, sqes_size);
+    if (cq_ring != sq_ring) ::munmap(cq_ring, cq_ring_size);
+    ::munmap(sq_ring, sq_ring_size);
+    ::close(ringfd);
+}
+
+void UringEngine::probe() {
+
+    // io_uring_probe termina em um vetor flexível com uma entrada por operação.
+    const unsigned count = 256;
+    std::vector<uint8_t> storage(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = (io_uring_probe *) storage.data();
+
+    // IORING_REGISTER_PROBE chegou no Linux 5.6, junto com IORING_OP_SEND e
+    // IORING_OP_RECV; kernels sem ela também não têm essas operações.
+    if (::syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_PROBE, probe, count) == -1) {
+        throw SocketException("io_uring does not support socket operations. Error: "
+            + std::string(strerror(errno)));
+    }
+
+    const int required[] = {
+        IORING_OP_RECV, IORING_OP_SEND, IORING_OP_RECVMSG, IORING_OP_SENDMSG,
+        IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED,
+        IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL
+    };
+
+    for (size_t i = 0; i < sizeof(required) / sizeof(required[0]); i++) {
+        int op = required[i];
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            throw SocketException("io_uring does not support operation " + std::to_string(op));
+        }
+    }
+}
+
+io_uring_sqe* UringEngine::next_sqe() {
+
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+    if (sqe_tail - head >= sq_entries) {
+        // Sem SQPOLL, o kernel consome todas as entradas dentro de enter().
+        int result = enter(0, 0);
+        if (result < 0) {
+            throw SocketException("Could not submit to io_uring. Error: " + std::string(strerror(-result)));
+        }
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sqe_tail - head >= sq_entries) {
+            throw SocketException("io_uring submission queue is full");
+        }
+    }
+
+    unsigned index = sqe_tail & sq_mask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sqe_tail++;
+
+    return sqe;
+}
+
+int UringEngine::enter(unsigned min_complete, unsigned flags) {
+
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+    if (to_submit == 0 && min_complete == 0) return 0;
+
+    for (;;) {
+        int result = (int) ::syscall(__NR_io_uring_enter, ringfd, to_submit, min_complete,
+            flags, NULL, 0);
+        if (result >= 0) return result;
+        if (errno != EINTR) return -errno;
+
+        // Interrompido antes de esperar: as entradas podem já ter sido consumidas.
+        to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    }
+}
+
+void UringEngine::start(Operation& operation) {
+
+    io_uring_sqe* sqe = next_sqe();
+    sqe->user_data = operation.id;
+    sqe->fd = operation.fd;
+
+    int fixed = fixed_file(operation.fd);
+    if (fixed >= 0) {
+        sqe->fd = fixed;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    switch (operation.type) {
+        case Operation::RECV:
+        case Operation::SEND:
+            sqe->opcode = operation.type == Operation::RECV ? IORING_OP_RECV : IORING_OP_SEND;
+            sqe->addr = (uint64_t) (uintptr_t) operation.buffer;
+            sqe->len = operation.length;
+            sqe->msg_flags = operation.flags;
+            break;
+
+        case Operation::RECVMSG:
+        case Operation::SENDMSG:
+            sqe->opcode = operation.type == Operation::RECVMSG ? IORING_OP_RECVMSG : IORING_OP_SENDMSG;
+            sqe->addr = (uint64_t) (uintptr_t) operation.message;
+            sqe->len = 1;
+            sqe->msg_flags = operation.flags;
+            break;
+
+        case Operation::ACCEPT:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->addr = (uint64_t) (uintptr_t) &operation.address;
+            sqe->addr2 = (uint64_t) (uintptr_t) &operation.address_length;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            break;
+
+        case Operation::CONNECT:
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->addr = (uint64_t) (uintptr_t) &operation.address;
+            sqe->off = operation.address_length;
+            break;
+
+        case Operation::READ_FIXED:
+        case Operation::WRITE_FIXED:
+            sqe->opcode = operation.type == Operation::READ_FIXED ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->addr = (uint64_t) (uintptr_t) operation.buffer;
+            sqe->len = operation.length;
+            sqe->buf_index = operation.buffer_index;
+            break;
+    }
+}
+
+void UringEngine::cancel_operations(int fd) {
+
+    for (auto it = operations.begin(); it != operations.end(); ++it) {
+
+        if (it->second->fd != fd) continue;
+
+        io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = it->first;
+        sqe->user_data = INTERNAL_KEY;
+    }
+
+    // Envia os cancelamentos agora, já que o descritor será fechado em seguida.
+    submit();
+}
+
+void UringEngine::register_buffers_backend(const iovec* buffers, unsigned count) {
+
+    if (::syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_BUFFERS, buffers, count) == -1) {
+        throw SocketException("Could not register buffers. Error: " + std::string(strerror(errno)));
+    }
+}
+
+void UringEngine::register_files_backend(const int* fds, unsigned count) {
+
+    if (::syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_FILES, fds, count) == -1) {
+        throw SocketException("Could not register files. Error: " + std::string(strerror(errno)));
+    }
+}
+
+size_t UringEngine::submit() {
+
+    int result = enter(0, 0);
+    if (result < 0) {
+        throw SocketException("Could not submit to io_uring. Error: " + std::string(strerror(-result)));
+    }
+
+    return result;
+}
+
+size_t UringEngine::run_once(int timeout_ms) {
+
+    // Conclusões que já estão no anel dispensam a espera.
+    bool ready = *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    unsigned min_complete = 0;
+
+    if (!ready && timeout_ms != 0 && !operations.empty()) {
+        min_complete = 1;
+
+        // O timeout termina após uma conclusão qualquer (off = 1) ou ao fim
+        // do prazo, e sua própria conclusão acorda a espera.
+        if (timeout_ms > 0) {
+            timeout.tv_sec = timeout_ms / 1000;
+            timeout.tv_nsec = (long long) (timeout_ms % 1000) * 1000000;
+
+            io_uring_sqe* sqe = next_sqe();
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->addr = (uint64_t) (uintptr_t) &timeout;
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = INTERNAL_KEY;
+        }
+    }
+
+    int result = enter(min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+
+    // EBUSY e EAGAIN indicam que o anel de conclusão está cheio; as
+    // conclusões abaixo liberam espaço para a próxima chamada.
+    if (result < 0 && result != -EBUSY && result != -EAGAIN) {
+        throw SocketException("Error while waiting for io_uring. Error: " + std::string(strerror(-result)));
+    }
+
+    return reap();
+}
+
+size_t UringEngine::reap() {
+
+    size_t handled = 0;
+    unsigned head = *cq_head;
+
+    for (;;) {
+
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) break;
+
+        io_uring_cqe* cqe = &cqes[head & cq_mask];
+        uint64_t id = cqe->user_data;
+        int result = cqe->res;
+
+        // Libera a entrada antes do callback, que pode chamar run_once().
+        head++;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        if (id != INTERNAL_KEY && complete(id, result)) handled++;
+        head = *cq_head;
+    }
+
+    return handled;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  EPOLLENGINE
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/// Backend epoll: cada operação é tentada sem bloquear e, se a socket não
+/// estiver pronta, espera a notificação do epoll para ser tentada de novo.
+class EpollEngine : public IoEngine {
+    public:
+
+        EpollEngine();
+        ~EpollEngine();
+
+        IoBackend get_backend() const {
+            return IoBackend::epoll;
+        }
+
+        size_t submit();
+        size_t run_once(int timeout_ms);
+
+    protected:
+
+        void start(Operation& operation);
+        void cancel_operations(int fd);
+        void register_buffers_backend(const iovec*, unsigned) {}
+        void register_files_backend(const int*, unsigned) {}
+
+    private:
+
+        /// Operações de um descritor esperando o epoll.
+        struct Waiting {
+            std::deque<uint64_t> readers;
+            std::deque<uint64_t> writers;
+            bool registered = false;
+        };
+
+        /// Tenta as operações prontas.
+        /// @return Número de callbacks chamados.
+        size_t attempt_ready();
+
+        /// Executa a chamada de sistema de uma operação sem bloquear.
+        /// @return Resultado da chamada, -errno, ou -EAGAIN se a socket não
+        ///         estiver pronta.
+        int attempt(Operation& operation);
+
+        /// Coloca uma operação na espera do seu descritor.
+        void park(Operation& operation);
+
+        /// Descritor do epoll.
+        int epollfd = -1;
+
+        /// Operações a serem tentadas na próxima chamada de run_once().
+        std::deque<uint64_t> ready;
+
+        /// Operações canceladas, concluídas com -ECANCELED por run_once().
+        std::deque<uint64_t> canceled;
+
+        /// Operações esperando cada descritor.
+        std::unordered_map<int, Waiting> waiting;
+
+        /// Lote de eventos retornado pelo epoll_wait().
+        std::vector<epoll_event> events;
+};
+
+EpollEngine::EpollEngine() : events(256) {
+
+    epollfd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1) {
+        throw SocketException("Could not create epoll. Error: " + std::string(strerror(errno)));
+    }
+}
+
+EpollEngine::~EpollEngine() {
+    ::close(epollfd);
+}
+
+void EpollEngine::start(Operation& operation) {
+
+    // accept4() e connect() não têm uma flag equivalente a MSG_DONTWAIT.
+    if (operation.type == Operation::ACCEPT || operation.type == Operation::CONNECT) {
+        int flags = ::fcntl(operation.fd, F_GETFL);
+        if (flags != -1 && !(flags & O_NONBLOCK)) ::fcntl(operation.fd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    ready.push_back(operation.id);
+}
+
+int EpollEngine::attempt(Operation& operation) {
+
+    ssize_t result = -1;
+
+    switch (operation.type) {
+        case Operation::RECV:
+        case Operation::READ_FIXED:
+            result = ::recv(operation.fd, operation.buffer, operation.length, operation.flags | MSG_DONTWAIT);
+            break;
+
+        case Operation::SEND:
+        case Operation::WRITE_FIXED:
+            result = ::send(operation.fd, operation.buffer, operation.length,
+                operation.flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+            break;
+
+        case Operation::RECVMSG:
+            result = ::recvmsg(operation.fd, operation.message, operation.flags | MSG_DONTWAIT);
+            break;
+
+        case Operation::SENDMSG:
+            result = ::sendmsg(operation.fd, operation.message, operation.flags | MSG_DONTWAIT);
+            break;
+
+        case Operation::ACCEPT:
+            operation.address_length = sizeof(operation.address);
+            result = ::accept4(operation.fd, (sockaddr *) &operation.address,
+                &operation.address_length, SOCK_CLOEXEC);
+            break;
+
+        case Operation::CONNECT:
+            if (!operation.started) {
+                operation.started = true;
+                result = ::connect(operation.fd, (const sockaddr *) &operation.address,
+                    operation.address_length);
+                if (result == -1 && errno == EINPROGRESS) return -EAGAIN;
+            }
+            else {
+                // A conexão em andamento terminou quando a socket fica gravável.
+                int error = 0;
+                socklen_t error_length = sizeof(error);
+                if (::getsockopt(operation.fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == -1) {
+                    error = errno;
+                }
+                if (error != 0) return -error;
+
+                sockaddr_storage peer;
+                socklen_t peer_length = sizeof(peer);
+                if (::getpeername(operation.fd, (sockaddr *) &peer, &peer_length) == -1) {
+                    return errno == ENOTCONN ? -EAGAIN : -errno;
+                }
+                result = 0;
+            }
+            break;
+    }
+
+    if (result == -1) return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+    return (int) result;
+}
+
+void EpollEngine::park(Operation& operation) {
+
+    Waiting& fd_waiting = waiting[operation.fd];
+
+    bool writes = operation.type == Operation::SEND || operation.type == Operation::SENDMSG ||
+                  operation.type == Operation::WRITE_FIXED || operation.type == Operation::CONNECT;
+
+    if (writes) fd_waiting.writers.push_back(operation.id);
+    else fd_waiting.readers.push_back(operation.id);
+
+    if (fd_waiting.registered) return;
+
+    // Ao ser registrado, o descritor já é notificado se estiver pronto, então
+    // nada que aconteceu depois da tentativa é perdido.
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.fd = operation.fd;
+
+    if (::epoll_ctl(epollfd, EPOLL_CTL_ADD, operation.fd, &event) == -1 && errno != EEXIST) {
+        throw SocketException("Could not add socket to epoll. Error: " + std::string(strerror(errno)));
+    }
+
+    fd_waiting.registered = true;
+}
+
+size_t EpollEngine::attempt_ready() {
+
+    size_t handled = 0;
+
+    while (!canceled.empty()) {
+        uint64_t id = canceled.front();
+        canceled.pop_front();
+        if (complete(id, -ECANCELED)) handled++;
+    }
+
+    // Apenas as operações que já estavam prontas; as enfileiradas pelos
+    // callbacks ficam para a próxima chamada.
+    size_t count = ready.size();
+
+    for (size_t i = 0; i < count && !ready.empty(); i++) {
+
+        uint64_t id = ready.front();
+        ready.pop_front();
+
+        auto it = operations.find(id);
+        if (it == operations.end()) continue;
+
+        Operation& operation = *it->second;
+
+        int result;
+        do {
+            result = attempt(operation);
+        } while (result == -EINTR);
+
+        if (result == -EAGAIN) {
+            park(operation);
+            continue;
+        }
+
+        if (complete(id, result)) handled++;
+    }
+
+    return handled;
+}
+
+void EpollEngine::cancel_operations(int fd) {
+
+    auto it = waiting.find(fd);
+    if (it != waiting.end()) {
+        canceled.insert(canceled.end(), it->second.readers.begin(), it->second.readers.end());
+        canceled.insert(canceled.end(), it->second.writers.begin(), it->second.writers.end());
+        if (it->second.registered) ::epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+        waiting.erase(it);
+    }
+
+    for (auto ready_it = ready.begin(); ready_it != ready.end();) {
+        auto operation = operations.find(*ready_it);
+        if (operation != operations.end() && operation->second->fd == fd) {
+            canceled.push_back(*ready_it);
+            ready_it = ready.erase(ready_it);
+        }
+        else {
+            ++ready_it;
+        }
+    }
+}
+
+size_t EpollEngine::submit() {
+
+    // Não há fila no kernel: as operações são tentadas por run_once().
+    return ready.size();
+}
+
+size_t EpollEngine::run_once(int timeout_ms) {
+
+    size_t handled = attempt_ready();
+
+    if (waiting.empty() && ready.empty()) return handled;
+
+    // Depois de chamar callbacks, apenas recolhe eventos já disponíveis.
+    if (handled > 0 || !ready.empty()) timeout_ms = 0;
+
+    int total = ::epoll_wait(epollfd, events.data(), events.size(), timeout_ms);
+    if (total == -1) {
+        if (errno != EINTR) {
+            throw SocketException("Error while waiting for events. Error: " + std::string(strerror(errno)));
+        }
+        total = 0;
+    }
+
+    for (int i = 0; i < total; i++) {
+
+        auto it = waiting.find(events[i].data.fd);
+        if (it == waiting.end()) continue;
+
+        uint32_t flags = events[i].events;
+        bool failed = flags & (EPOLLERR | EPOLLHUP);
+        Waiting& fd_waiting = it->second;
+
+        if ((flags & EPOLLIN) || failed) {
+            ready.insert(ready.end(), fd_waiting.readers.begin(), fd_waiting.readers.end());
+            fd_waiting.readers.clear();
+        }
+        if ((flags & EPOLLOUT) || failed) {
+            ready.insert(ready.end(), fd_waiting.writers.begin(), fd_waiting.writers.end());
+            fd_waiting.writers.clear();
+        }
+
+        // Sem operações esperando, o descritor sai do epoll: se for fechado,
+        // o kernel o remove sozinho, e um novo descritor com o mesmo número
+        // precisa ser registrado de novo por park().
+        if (fd_waiting.readers.empty() && fd_waiting.writers.empty()) {
+            ::epoll_ctl(epollfd, EPOLL_CTL_DEL, it->first, NULL);
+            waiting.erase(it);
+        }
+    }
+
+    return handled + attempt_ready();
+}
+
+} // End namespace
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  SELEÇÃO DO BACKEND
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+std::unique_ptr<IoEngine> IoEngine::create(IoBackend backend, unsigned entries) {
+
+    if (backend != IoBackend::epoll) {
+        try {
+            return std::unique_ptr<IoEngine>(new UringEngine(entries));
+        }
+        catch (const SocketException& e) {
+            // Kernel antigo, io_uring desativado ou bloqueado por seccomp.
+            if (backend == IoBackend::uring) throw;
+        }
+    }
+
+    return std::unique_ptr<IoEngine>(new EpollEngine());
+}
@@ -0,0 +1,273 @@
+#ifndef IOENGINE_H
+#define IOENGINE_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "sockets.hpp"
+
+#include <functional>
+
+namespace Socket {
+
+/// Implementação usada por um IoEngine.
+enum class IoBackend {
+    /// io_uring quando o kernel suporta, epoll caso contrário.
+    automatic,
+
+    /// io_uring (Linux 5.6 ou mais recente).
+    uring,
+
+    /// Chamadas não bloqueantes refeitas quando o epoll indica que a
+    /// socket está pronta.
+    epoll
+};
+
+/** Motor de I/O baseado em conclusões, sobre io_uring ou epoll.
+ *
+ *      Em vez de uma chamada de sistema por operação, as operações são
+ *  enfileiradas com recv(), send(), accept(), connect() e as demais, e
+ *  enviadas ao kernel de uma só vez por submit() ou run_once(). Quando cada
+ *  operação termina, run_once() chama seu callback com o resultado da
+ *  chamada de sistema correspondente: bytes transferidos, o descritor
+ *  aceito ou 0 em connect(), ou -errno em caso de erro.
+ *      Com io_uring, um único io_uring_enter() envia todas as operações
+ *  pendentes e recolhe as conclusões. Sem io_uring (kernels antigos,
+ *  io_uring desativado), o backend epoll oferece a mesma interface tentando
+ *  cada operação sem bloquear e repetindo-a quando a socket fica pronta;
+ *  esse backend coloca em modo não bloqueante as sockets usadas em
+ *  accept() e connect().
+ *      Os buffers e endereços passados às operações devem continuar válidos
+ *  até o callback ser chamado. Os callbacks são chamados apenas por
+ *  run_once() e podem enfileirar novas operações. Deve ser usado por uma
+ *  única thread.
+ */
+class IoEngine {
+    public:
+
+        /// Recebe o resultado da operação: um valor não negativo em caso de
+        /// sucesso ou -errno.
+        typedef std::function<void(int result)> Completion;
+
+        /// Cria um motor de I/O.
+        /// @param backend Implementação desejada. Com IoBackend::automatic,
+        ///                usa epoll caso io_uring não esteja disponível.
+        /// @param entries Tamanho da fila de submissão do io_uring.
+        /// @return Motor criado.
+        static std::unique_ptr<IoEngine> create(IoBackend backend = IoBackend::automatic,
+            unsigned entries = 256);
+
+        virtual ~IoEngine();
+
+        IoEngine(const IoEngine&) = delete;
+        IoEngine& operator=(const IoEngine&) = delete;
+
+        /// Implementação em uso.
+        virtual IoBackend get_backend() const = 0;
+
+        /// Recebe até length bytes de uma socket.
+        /// @param fd          Descritor da socket.
+        /// @param buffer      Buffer que receberá os bytes.
+        /// @param length      Número máximo de bytes.
+        /// @param on_complete Recebe o número de bytes lidos, 0 se a conexão
+        ///                    foi fechada.
+        /// @param flags       Flags opcionais de recv().
+        void recv(int fd, uint8_t* buffer, size_t length, Completion on_complete, int flags = 0);
+
+        /// Envia até length bytes por uma socket. Como em ::send(), o envio
+        /// pode ser parcial.
+        /// @param fd          Descritor da socket.
+        /// @param message     Bytes a serem enviados.
+        /// @param length      Número de bytes.
+        /// @param on_complete Recebe o número de bytes enviados.
+        /// @param flags       Flags opcionais de send().
+        void send(int fd, const uint8_t* message, size_t length, Completion on_complete, int flags = 0);
+
+        /// Recebe uma mensagem com recvmsg().
+        /// @param fd          Descritor da socket.
+        /// @param message     Cabeçalho da mensagem, com buffers e endereço.
+        /// @param on_complete Recebe o número de bytes lidos.
+        /// @param flags       Flags opcionais de recvmsg().
+        void recvmsg(int fd, msghdr* message, Completion on_complete, int flags = 0);
+
+        /// Envia uma mensagem com sendmsg().
+        /// @param fd          Descritor da socket.
+        /// @param message     Cabeçalho da mensagem, com buffers e endereço.
+        /// @param on_complete Recebe o número de bytes enviados.
+        /// @param flags       Flags opcionais de sendmsg().
+        void sendmsg(int fd, const msghdr* message, Completion on_complete, int flags = 0);
+
+        /// Recebe um datagrama UDP, preenchendo o payload e o transmissor.
+        /// @param fd          Descritor da UDPSocket.
+        /// @param datagram    Datagrama que receberá a mensagem.
+        /// @param on_complete Recebe o número de bytes lidos.
+        void recvfrom(int fd, Datagram& datagram, Completion on_complete);
+
+        /// Envia um datagrama UDP ao destino definido por Datagram::set_peer().
+        /// @param fd          Descritor da UDPSocket.
+        /// @param datagram    Datagrama a ser enviado.
+        /// @param on_complete Recebe o número de bytes enviados.
+        void sendto(int fd, const Datagram& datagram, Completion on_complete);
+
+        /// Aceita uma conexão. A socket aceita é criada com FD_CLOEXEC e
+        /// pertence ao chamador.
+        /// @param fd          Descritor da socket que está ouvindo conexões.
+        /// @param on_complete Recebe o descritor da conexão aceita.
+        /// @param peer        Preenchido com o endereço do cliente. Pode ser NULL.
+        /// @param peer_length Preenchido com o tamanho do endereço. Pode ser NULL.
+        void accept(int fd, Completion on_complete, sockaddr_storage* peer = NULL,
+            socklen_t* peer_length = NULL);
+
+        /// Conecta uma socket. O endereço é copiado.
+        /// @param fd          Descritor da socket.
+        /// @param address     Endereço de destino.
+        /// @param length      Tamanho do endereço.
+        /// @param on_complete Recebe 0 quando a conexão é estabelecida.
+        void connect(int fd, const sockaddr_storage& address, socklen_t length, Completion on_complete);
+
+        /// Recebe bytes em um buffer registrado com register_buffers(), que o
+        /// kernel não precisa mapear a cada operação.
+        /// @param fd           Descritor da socket.
+        /// @param buffer       Endereço dentro do buffer registrado.
+        /// @param length       Número máximo de bytes.
+        /// @param buffer_index Índice do buffer registrado que contém buffer.
+        /// @param on_complete  Recebe o número de bytes lidos.
+        void read_fixed(int fd, uint8_t* buffer, size_t length, unsigned buffer_index,
+            Completion on_complete);
+
+        /// Envia bytes de um buffer registrado com register_buffers().
+        /// @param fd           Descritor da socket.
+        /// @param message      Endereço dentro do buffer registrado.
+        /// @param length       Número de bytes.
+        /// @param buffer_index Índice do buffer registrado que contém message.
+        /// @param on_complete  Recebe o número de bytes enviados.
+        void write_fixed(int fd, const uint8_t* message, size_t length, unsigned buffer_index,
+            Completion on_complete);
+
+        /// Registra buffers usados por read_fixed() e write_fixed(). Pode ser
+        /// chamada uma única vez; os buffers devem viver tanto quanto o motor.
+        /// @param buffers Buffers a serem registrados, na ordem dos índices.
+        /// @param count   Número de buffers.
+        void register_buffers(const iovec* buffers, unsigned count);
+
+        /// Registra descritores como arquivos fixos, evitando a busca do
+        /// descritor a cada operação. As operações sobre esses descritores
+        /// passam a usá-los automaticamente. Pode ser chamada uma única vez;
+        /// os descritores não devem ser fechados enquanto o motor existir.
+        /// @param fds   Descritores a serem registrados.
+        /// @param count Número de descritores.
+        void register_files(const int* fds, unsigned count);
+
+        /// Cancela as operações pendentes de um descritor, que terminam com
+        /// -ECANCELED (ou com o resultado normal, se já tiverem terminado).
+        /// Deve ser chamada antes de fechar uma socket com operações pendentes.
+        /// @param fd Descritor cujas operações serão canceladas.
+        void cancel(int fd);
+
+        /// Envia ao kernel as operações enfileiradas, sem esperar conclusões.
+        /// @return Número de operações enviadas.
+        virtual size_t submit() = 0;
+
+        /// Envia as operações enfileiradas, espera ao menos uma conclusão e
+        /// chama os callbacks das operações concluídas.
+        /// @param timeout_ms Tempo máximo de espera, -1 para sem limite.
+        /// @return Número de callbacks chamados.
+        virtual size_t run_once(int timeout_ms = -1) = 0;
+
+        /// Número de operações que ainda não terminaram.
+        size_t pending() const {
+            return this->operations.size();
+        }
+
+    protected:
+
+        /// Operação enfileirada, mantida até o callback ser chamado.
+        struct Operation {
+            enum Type { RECV, SEND, RECVMSG, SENDMSG, ACCEPT, CONNECT, READ_FIXED, WRITE_FIXED };
+
+            uint64_t id;
+            Type type;
+            int fd;
+            uint8_t* buffer = NULL;
+            size_t length = 0;
+            int flags = 0;
+            unsigned buffer_index = 0;
+
+            /// Mensagem de RECVMSG e SENDMSG.
+            msghdr* message = NULL;
+
+            /// Endereço de ACCEPT e CONNECT.
+            sockaddr_storage address;
+            socklen_t address_length = 0;
+
+            /// Destinos do endereço aceito, fornecidos pelo chamador.
+            sockaddr_storage* peer = NULL;
+            socklen_t* peer_length = NULL;
+
+            /// Cabeçalho usado por recvfrom() e sendto().
+            msghdr header;
+            iovec vector;
+            Datagram* datagram = NULL;
+
+            /// Se a primeira tentativa de CONNECT já foi feita (backend epoll).
+            bool started = false;
+
+            Completion on_complete;
+        };
+
+        IoEngine();
+
+        /// Entrega uma operação ao backend.
+        virtual void start(Operation& operation) = 0;
+
+        /// Cancela as operações de um descritor no backend.
+        virtual void cancel_operations(int fd) = 0;
+
+        /// Registra os buffers no backend.
+        virtual void register_buffers_backend(const iovec* buffers, unsigned count) = 0;
+
+        /// Registra os descritores no backend.
+        virtual void register_files_backend(const int* fds, unsigned count) = 0;
+
+        /// Conclui uma operação, chamando seu callback.
+        /// @param id     Identificador da operação.
+        /// @param result Resultado da chamada de sistema ou -errno.
+        /// @return True se a operação existia.
+        bool complete(uint64_t id, int result);
+
+        /// Índice de um descritor entre os arquivos fixos, -1 se não for fixo.
+        int fixed_file(int fd) const {
+            return fd >= 0 && (size_t) fd < this->fixed_files.size() ? this->fixed_files[fd] : -1;
+        }
+
+        /// Operações que ainda não terminaram, pelo identificador.
+        std::unordered_map<uint64_t, std::unique_ptr<Operation>> operations;
+
+    private:
+
+        /// Cria uma operação e a entrega ao backend.
+        Operation& enqueue(Operation::Type type, int fd, Completion on_complete);
+
+        /// Verifica se [buffer, buffer + length) está dentro de um buffer registrado.
+        void check_fixed(const uint8_t* buffer, size_t length, unsigned buffer_index) const;
+
+        /// Identificador da próxima operação. 0 é reservado para operações internas.
+        uint64_t next_id = 1;
+
+        /// Buffers registrados.
+        std::vector<iovec> fixed_buffers;
+
+        /// Índice de cada descritor entre os arquivos fixos, -1 se não for fixo.
+        std::vector<int> fixed_files;
+};
+
+} // End namespace Socket
+
+#endif
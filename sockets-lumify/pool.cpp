@@ -0,0 +1,201 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "pool.hpp"
+#include "connector.hpp"
+
+using namespace Socket;
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  POOLEDCONNECTION
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+PooledConnection::PooledConnection() : pool(NULL), reused(false), reusable(false) {}
+
+PooledConnection::PooledConnection(ConnectionPool* pool, const std::string& key,
+    std::unique_ptr<TCPSocket> socket, bool reused) :
+    pool(pool), key(key), socket(std::move(socket)), reused(reused), reusable(true) {}
+
+PooledConnection::PooledConnection(PooledConnection&& other) noexcept :
+    pool(other.pool), key(std::move(other.key)), socket(std::move(other.socket)),
+    reused(other.reused), reusable(other.reusable) {
+    other.pool = NULL;
+}
+
+PooledConnection& PooledConnection::operator=(PooledConnection&& other) noexcept {
+
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        key = std::move(other.key);
+        socket = std::move(other.socket);
+        reused = other.reused;
+        reusable = other.reusable;
+        other.pool = NULL;
+    }
+
+    return *this;
+}
+
+PooledConnection::~PooledConnection() {
+    release();
+}
+
+void PooledConnection::release() {
+
+    if (!pool || !socket) return;
+
+    ConnectionPool* origin = pool;
+    pool = NULL;
+    origin->give_back(key, std::move(socket), reusable);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  CONNECTIONPOOL
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+ConnectionPool::ConnectionPool(const PoolConfig& config) : config(config), hits(0), misses(0) {}
+
+ConnectionPool::~ConnectionPool() {
+    clear();
+}
+
+PooledConnection ConnectionPool::acquire(const std::string& address, uint32_t port) {
+
+    std::string key = address + ":" + std::to_string(port);
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + std::chrono::milliseconds(config.wait_timeout_ms);
+
+    // Conexões descartadas são fechadas fora do lock.
+    std::vector<std::unique_ptr<TCPSocket>> discarded;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    Host& host = hosts[key];
+
+    for (;;) {
+
+        // A mais recente é a que tem menos chance de ter expirado.
+        while (!host.idle.empty()) {
+
+            IdleConnection connection = std::move(host.idle.back());
+            host.idle.pop_back();
+
+            bool expired = config.idle_timeout_ms > 0 &&
+                now - connection.since > std::chrono::milliseconds(config.idle_timeout_ms);
+
+            if (!expired && is_alive(*connection.socket)) {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return PooledConnection(this, key, std::move(connection.socket), true);
+            }
+
+            host.total--;
+            discarded.push_back(std::move(connection.socket));
+        }
+
+        if (host.total < config.max_total) break;
+
+        if (config.wait_timeout_ms == 0 ||
+            (host.available.wait_until(lock, deadline) == std::cv_status::timeout &&
+             host.idle.empty() && host.total >= config.max_total)) {
+            throw ConnectionException("Connection pool for " + key + " is exhausted");
+        }
+
+        now = std::chrono::steady_clock::now();
+    }
+
+    // Reserva a vaga antes de conectar, para que max_total valha também
+    // para conexões que ainda estão sendo abertas.
+    host.total++;
+    misses.fetch_add(1, std::memory_order_relaxed);
+    lock.unlock();
+    discarded.clear();
+
+    std::unique_ptr<TCPSocket> socket;
+    try {
+        TCPConnection connection = Connector::connect_blocking(address, port, config.connect_timeout_ms);
+
+        sockaddr_storage peer = connection.get_peer();
+        socket.reset(new TCPSocket(connection.release(), peer, address_length(peer)));
+        socket->set_nonblocking(false);
+    }
+    catch (...) {
+        lock.lock();
+        host.total--;
+        lock.unlock();
+        host.available.notify_one();
+        throw;
+    }
+
+    return PooledConnection(this, key, std::move(socket), false);
+}
+
+void ConnectionPool::give_back(const std::string& key, std::unique_ptr<TCPSocket> socket, bool reusable) {
+
+    // A verificação faz uma chamada de sistema, então acontece fora do lock.
+    bool alive = reusable && socket->get_fd() != -1 && is_alive(*socket);
+
+    Host* host;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        host = &hosts[key];
+
+        if (alive && host->idle.size() < config.max_idle) {
+            IdleConnection connection;
+            connection.socket = std::move(socket);
+            connection.since = std::chrono::steady_clock::now();
+            host->idle.push_back(std::move(connection));
+        }
+        else {
+            host->total--;
+        }
+    }
+
+    host->available.notify_one();
+
+    // Se não voltou para o pool, a socket é fechada aqui, fora do lock.
+    socket.reset();
+}
+
+void ConnectionPool::clear() {
+
+    std::vector<std::unique_ptr<TCPSocket>> discarded;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = hosts.begin(); it != hosts.end(); ++it) {
+            Host& host = it->second;
+            for (size_t i = 0; i < host.idle.size(); i++) {
+                discarded.push_back(std::move(host.idle[i].socket));
+            }
+            host.total -= host.idle.size();
+            host.idle.clear();
+            host.available.notify_all();
+        }
+    }
+}
+
+size_t ConnectionPool::idle() const {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t total = 0;
+    for (auto it = hosts.begin(); it != hosts.end(); ++it) {
+        total += it->second.idle.size();
+    }
+
+    return total;
+}
+
+bool ConnectionPool::is_alive(const TCPSocket& socket) {
+
+    uint8_t byte;
+    ssize_t result = ::recv(socket.get_fd(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    // 0 indica que o outro lado fechou a conexão e bytes pendentes indicam
+    // uma resposta que não foi consumida; apenas EAGAIN indica uma conexão
+    // ociosa e saudável.
+    return result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
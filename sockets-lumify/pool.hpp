@@ -0,0 +1,212 @@
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "sockets.hpp"
+
+#include <atomic>
+#include <condition_variable>
+
+namespace Socket {
+
+class ConnectionPool;
+
+/// Limites de um ConnectionPool. Tempos iguais a zero significam sem limite.
+struct PoolConfig {
+
+    /// Conexões ociosas mantidas por destino.
+    size_t max_idle = 8;
+
+    /// Conexões por destino, somando ociosas e em uso.
+    size_t max_total = 64;
+
+    /// Prazo para estabelecer uma nova conexão.
+    uint32_t connect_timeout_ms = 5000;
+
+    /// Tempo que acquire() espera por uma conexão quando max_total foi
+    /// atingido. Ao contrário dos outros tempos, 0 não espera: acquire()
+    /// falha imediatamente.
+    uint32_t wait_timeout_ms = 5000;
+
+    /// Tempo após o qual uma conexão ociosa é descartada em vez de reutilizada.
+    uint32_t idle_timeout_ms = 60000;
+};
+
+
+/** Conexão emprestada por um ConnectionPool.
+ *
+ *      Devolve a conexão ao pool quando é destruída. Pode ser movida mas não
+ *  copiada. Se a conexão ficar em um estado inconsistente para o protocolo
+ *  da aplicação (uma resposta lida pela metade, por exemplo), chame
+ *  discard() para que ela seja fechada em vez de reutilizada.
+ */
+class PooledConnection {
+    public:
+
+        /// Cria um empréstimo vazio.
+        PooledConnection();
+
+        PooledConnection(PooledConnection&& other) noexcept;
+        PooledConnection& operator=(PooledConnection&& other) noexcept;
+
+        PooledConnection(const PooledConnection&) = delete;
+        PooledConnection& operator=(const PooledConnection&) = delete;
+
+        /// Destrutor. Devolve a conexão ao pool.
+        ~PooledConnection();
+
+        TCPSocket& operator*() const {
+            return *this->socket;
+        }
+
+        TCPSocket* operator->() const {
+            return this->socket.get();
+        }
+
+        /// Socket conectada, NULL se o empréstimo estiver vazio.
+        TCPSocket* get() const {
+            return this->socket.get();
+        }
+
+        /// Indica se a conexão veio da lista de ociosas do pool.
+        bool is_reused() const {
+            return this->reused;
+        }
+
+        /// Marca a conexão para ser fechada em vez de devolvida ao pool.
+        void discard() {
+            this->reusable = false;
+        }
+
+        /// Devolve a conexão ao pool antes da destruição.
+        void release();
+
+    private:
+
+        friend class ConnectionPool;
+
+        PooledConnection(ConnectionPool* pool, const std::string& key,
+            std::unique_ptr<TCPSocket> socket, bool reused);
+
+        /// Pool de origem.
+        ConnectionPool* pool;
+
+        /// Destino da conexão, no formato "endereço:porta".
+        std::string key;
+
+        /// Socket conectada.
+        std::unique_ptr<TCPSocket> socket;
+
+        /// Se veio da lista de ociosas.
+        bool reused;
+
+        /// Se pode voltar para a lista de ociosas.
+        bool reusable;
+};
+
+
+/** Pool de conexões TCP de cliente, indexado por endereço e porta.
+ *
+ *      acquire() entrega uma conexão ociosa ao mesmo destino quando houver,
+ *  evitando o handshake e a resolução do nome, ou abre uma nova com o
+ *  Connector. Conexões fechadas pelo outro lado, com dados inesperados
+ *  pendentes ou ociosas há mais de idle_timeout_ms são descartadas tanto
+ *  na devolução quanto na retirada.
+ *      Pode ser usado por várias threads ao mesmo tempo. O pool deve
+ *  continuar vivo até que todos os PooledConnection sejam destruídos.
+ */
+class ConnectionPool {
+    public:
+
+        /// Cria o pool, sem abrir conexões.
+        /// @param config Limites do pool.
+        ConnectionPool(const PoolConfig& config = PoolConfig());
+
+        /// Destrutor. Fecha as conexões ociosas.
+        ~ConnectionPool();
+
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+        /// Retira uma conexão com um destino, abrindo uma nova se necessário.
+        /// Bloqueia até wait_timeout_ms caso max_total tenha sido atingido,
+        /// lançando ConnectionException se nenhuma conexão for liberada no
+        /// prazo (ou imediatamente, se wait_timeout_ms for 0).
+        /// @param address Endereço IP ou domínio de destino.
+        /// @param port    Porta de destino.
+        /// @return Conexão bloqueante, devolvida ao pool quando destruída.
+        PooledConnection acquire(const std::string& address, uint32_t port);
+
+        /// Fecha todas as conexões ociosas.
+        void clear();
+
+        /// Número de conexões ociosas, somando todos os destinos.
+        size_t idle() const;
+
+        /// Retiradas atendidas por uma conexão ociosa.
+        uint64_t get_hits() const {
+            return this->hits.load(std::memory_order_relaxed);
+        }
+
+        /// Retiradas que precisaram abrir uma nova conexão.
+        uint64_t get_misses() const {
+            return this->misses.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        friend class PooledConnection;
+
+        /// Conexão ociosa e o instante em que foi devolvida.
+        struct IdleConnection {
+            std::unique_ptr<TCPSocket> socket;
+            std::chrono::steady_clock::time_point since;
+        };
+
+        /// Conexões de um destino.
+        struct Host {
+            /// Ociosas, a mais recente no fim.
+            std::deque<IdleConnection> idle;
+
+            /// Ociosas mais as que estão emprestadas ou sendo abertas.
+            size_t total = 0;
+
+            /// Sinalizada quando uma conexão deste destino é devolvida ou
+            /// fechada. Uma por destino, para que a vaga liberada acorde
+            /// quem espera pelo mesmo destino.
+            std::condition_variable available;
+        };
+
+        /// Recebe uma conexão devolvida por um PooledConnection.
+        void give_back(const std::string& key, std::unique_ptr<TCPSocket> socket, bool reusable);
+
+        /// Verifica, sem bloquear, se a conexão continua aberta e sem dados
+        /// pendentes de uma resposta anterior.
+        static bool is_alive(const TCPSocket& socket);
+
+        /// Limites do pool.
+        PoolConfig config;
+
+        /// Protege hosts.
+        mutable std::mutex mutex;
+
+        /// Conexões por destino. Os destinos nunca são removidos, assim as
+        /// referências continuam válidas fora do lock.
+        std::unordered_map<std::string, Host> hosts;
+
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+};
+
+} // End namespace Socket
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "relay.hpp"
+
+#include <fcntl.h>
+
+using namespace Socket;
+
+SpliceRelay::SpliceRelay(size_t pipe_size) {
+
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+        throw SocketException("Could not create pipe. Error: " + std::string(strerror(errno)));
+    }
+
+    pipe_read = fds[0];
+    pipe_write = fds[1];
+
+    // O pedido pode ser recusado (limite de /proc/sys/fs/pipe-max-size), e
+    // nesse caso o pipe continua com a capacidade padrão.
+    if (pipe_size > 0) ::fcntl(pipe_write, F_SETPIPE_SZ, (int) pipe_size);
+
+    int size = ::fcntl(pipe_write, F_GETPIPE_SZ);
+    this->pipe_size = size > 0 ? size : 65536;
+}
+
+SpliceRelay::~SpliceRelay() {
+    ::close(pipe_read);
+    ::close(pipe_write);
+}
+
+uint64_t SpliceRelay::transfer(int from, int to, uint64_t count, bool more) {
+
+    uint64_t delivered = 0;
+    int error = 0;
+
+    while (delivered < count) {
+
+        // Lê da origem apenas com o pipe vazio, para que o destino receba
+        // os bytes na ordem e o pipe nunca fique cheio durante a leitura.
+        if (buffered == 0) {
+
+            if (eof) break;
+
+            uint64_t chunk = count - delivered;
+            if (chunk > pipe_size) chunk = pipe_size;
+
+            ssize_t result = ::splice(from, NULL, pipe_write, NULL, chunk,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if (result == -1 && errno == EINTR) continue;
+            if (result == -1) {
+                error = errno;
+                break;
+            }
+            if (result == 0) {
+                eof = true;
+                break;
+            }
+
+            buffered = result;
+        }
+
+        // Bytes pendentes de uma chamada anterior podem passar de count: o
+        // excedente fica no pipe para a próxima.
+        uint64_t limit = count - delivered;
+
+        // Enquanto houver mais a ler, o destino pode agrupar os segmentos.
+        bool last = !more && buffered >= limit;
+        uint64_t drained = drain(to, limit, !last, error);
+        delivered += drained;
+
+        if (error != 0) break;
+    }
+
+    if (delivered > 0 || error == 0) return delivered;
+
+    if (error == EAGAIN || error == EWOULDBLOCK) {
+        throw WouldBlock("Relay can not make progress without blocking.");
+    }
+
+    throw ConnectionException("Could not relay bytes. Error: " + std::string(strerror(error)));
+}
+
+uint64_t SpliceRelay::drain(int to, uint64_t limit, bool more, int& error) {
+
+    uint64_t drained = 0;
+    error = 0;
+
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    if (more) flags |= SPLICE_F_MORE;
+
+    while (buffered > 0 && drained < limit) {
+
+        size_t chunk = buffered;
+        if (chunk > limit - drained) chunk = limit - drained;
+
+        ssize_t result = ::splice(pipe_read, NULL, to, NULL, chunk, flags);
+
+        if (result == -1 && errno == EINTR) continue;
+        if (result == -1) {
+            error = errno;
+            break;
+        }
+
+        buffered -= result;
+        drained += result;
+    }
+
+    return drained;
+}
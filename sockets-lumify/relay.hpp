@@ -0,0 +1,94 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "sockets.hpp"
+
+namespace Socket {
+
+/** Repasse de bytes entre descritores sem passar pela memória do processo.
+ *
+ *      Move bytes de uma socket para outra socket, um arquivo ou um pipe
+ *  usando splice() através de um pipe interno, de modo que os dados nunca
+ *  são copiados para o espaço do usuário. Útil em proxies e para gravar
+ *  uploads direto em disco.
+ *      Funciona com descritores bloqueantes e não bloqueantes. Quando o
+ *  destino não aceita mais bytes, os que já foram lidos da origem ficam no
+ *  pipe (pending()) e são entregues primeiro na próxima chamada, então o
+ *  mesmo relay deve ser usado até o fim de cada fluxo.
+ */
+class SpliceRelay {
+    public:
+
+        /// Cria o pipe interno.
+        /// @param pipe_size Capacidade pedida para o pipe (F_SETPIPE_SZ),
+        ///                  0 mantém o padrão do sistema.
+        SpliceRelay(size_t pipe_size = 0);
+
+        /// Destrutor. Fecha o pipe, descartando bytes pendentes.
+        ~SpliceRelay();
+
+        SpliceRelay(const SpliceRelay&) = delete;
+        SpliceRelay& operator=(const SpliceRelay&) = delete;
+
+        /// Repassa até count bytes de from para to. Arquivos são lidos e
+        /// escritos na posição atual dos descritores.
+        /// @param from  Descritor de origem, uma socket ou um pipe.
+        /// @param to    Descritor de destino: socket, arquivo ou pipe.
+        /// @param count Número máximo de bytes a serem entregues a to,
+        ///              incluindo os pendentes de uma chamada anterior.
+        /// @param more  Indica que mais dados serão enviados em seguida
+        ///              (SPLICE_F_MORE), como MSG_MORE.
+        /// @return Número de bytes entregues a to. Menor que count se a
+        ///         origem terminar ou um dos lados bloquear; 0 apenas quando
+        ///         a origem terminou e não há bytes pendentes.
+        uint64_t transfer(int from, int to, uint64_t count, bool more = false);
+
+        /// Bytes já lidos da origem que ainda não foram entregues ao destino.
+        size_t pending() const {
+            return this->buffered;
+        }
+
+        /// Indica se a origem chegou ao fim (leitura de 0 bytes).
+        bool is_eof() const {
+            return this->eof;
+        }
+
+        /// Capacidade do pipe interno em bytes.
+        size_t get_pipe_size() const {
+            return this->pipe_size;
+        }
+
+    private:
+
+        /// Entrega bytes pendentes do pipe ao destino.
+        /// @param limit Número máximo de bytes entregues.
+        /// @return Número de bytes entregues.
+        uint64_t drain(int to, uint64_t limit, bool more, int& error);
+
+        /// Descritores de leitura e escrita do pipe interno.
+        int pipe_read = -1;
+        int pipe_write = -1;
+
+        /// Capacidade do pipe interno.
+        size_t pipe_size = 0;
+
+        /// Bytes no pipe que ainda não foram entregues.
+        size_t buffered = 0;
+
+        /// Se a origem chegou ao fim.
+        bool eof = false;
+};
+
+} // End namespace Socket
+
+#endif
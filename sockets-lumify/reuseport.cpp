@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "reuseport.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+using namespace Socket;
+
+ReusePortServer::ReusePortServer(uint32_t port, unsigned workers, bool pin_threads, uint32_t backlog) :
+    port(port), total_workers(workers), pin_threads(pin_threads) {
+
+    config.backlog = backlog;
+    config.reuse_port = true;
+
+    if (total_workers == 0) total_workers = std::thread::hardware_concurrency();
+    if (total_workers == 0) total_workers = 1;
+}
+
+ReusePortServer::ReusePortServer(uint32_t port, const ListenerConfig& config, unsigned workers, bool pin_threads) :
+    port(port), total_workers(workers), pin_threads(pin_threads), config(config) {
+
+    this->config.reuse_port = true;
+
+    if (total_workers == 0) total_workers = std::thread::hardware_concurrency();
+    if (total_workers == 0) total_workers = 1;
+}
+
+ReusePortServer::~ReusePortServer() {
+    stop();
+    join();
+}
+
+void ReusePortServer::start(AcceptCallback on_accept) {
+
+    {
+        std::lock_guard<std::mutex> lock(workers_mutex);
+        if (!workers.empty()) {
+            throw SocketException("Server is already running on port " + std::to_string(port));
+        }
+    }
+
+    // Todos os listeners são criados antes de qualquer thread, em um vetor
+    // local: se um deles falhar, os anteriores são fechados ao sair daqui e
+    // nenhum worker fica ouvindo na porta.
+    std::vector<std::unique_ptr<Worker>> created;
+    for (unsigned i = 0; i < total_workers; i++) {
+
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->listener.reset(new TCPSocket(0, config.family));
+        worker->listener->listen(port, config);
+
+        worker->loop.reset(new EventLoop());
+        EventLoop* loop = worker->loop.get();
+        worker->loop->add_listener(*worker->listener, [loop, on_accept](std::shared_ptr<TCPSocket> client) {
+            on_accept(*loop, client);
+        });
+
+        created.push_back(std::move(worker));
+    }
+
+    unsigned cpus = std::thread::hardware_concurrency();
+    try {
+        for (unsigned i = 0; i < total_workers; i++) {
+            Worker* worker = created[i].get();
+            bool pin = pin_threads && cpus > 0;
+            worker->thread = std::thread([worker, pin, i, cpus]() {
+                if (pin) pin_current_thread(i % cpus);
+                worker->loop->run();
+            });
+        }
+    }
+    catch (...) {
+        // Threads que já iniciaram são encerradas antes de os workers serem destruídos.
+        for (size_t i = 0; i < created.size(); i++) {
+            created[i]->loop->stop();
+            if (created[i]->thread.joinable()) created[i]->thread.join();
+        }
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(workers_mutex);
+    workers = std::move(created);
+}
+
+void ReusePortServer::stop() {
+
+    // O lock impede que join() destrua os laços durante a iteração.
+    std::lock_guard<std::mutex> lock(workers_mutex);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->loop->stop();
+    }
+}
+
+void ReusePortServer::join() {
+
+    std::vector<Worker*> running;
+    {
+        std::lock_guard<std::mutex> lock(workers_mutex);
+        for (size_t i = 0; i < workers.size(); i++) running.push_back(workers[i].get());
+    }
+
+    // As threads são aguardadas sem o lock, para que stop() ainda possa
+    // interrompê-las; os workers só são destruídos depois.
+    for (size_t i = 0; i < running.size(); i++) {
+        if (running[i]->thread.joinable()) running[i]->thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(workers_mutex);
+    workers.clear();
+}
+
+void ReusePortServer::pin_current_thread(unsigned cpu) {
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+
+    // Falhar em fixar a thread não impede o funcionamento do servidor.
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
@@ -0,0 +1,116 @@
+#ifndef REUSEPORT_H
+#define REUSEPORT_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "eventloop.hpp"
+
+#include <mutex>
+#include <thread>
+
+namespace Socket {
+
+/** Servidor TCP com vários listeners na mesma porta (SO_REUSEPORT).
+ *
+ *      Cada worker possui seu próprio TCPSocket ouvindo na porta, seu próprio
+ *  EventLoop e sua própria thread, opcionalmente fixada em um núcleo. O
+ *  kernel distribui as novas conexões entre os listeners, de modo que não há
+ *  uma fila de accept() única compartilhada entre as threads.
+ *      As conexões aceitas são entregues ao callback na thread do worker que
+ *  as aceitou, junto com o EventLoop daquele worker, onde devem ser registradas.
+ */
+class ReusePortServer {
+    public:
+
+        typedef std::function<void(EventLoop&, std::shared_ptr<TCPSocket>)> AcceptCallback;
+
+        /// Cria o servidor, sem abrir nenhuma socket.
+        /// @param port        Porta na qual os listeners serão vinculados.
+        /// @param workers     Número de workers, 0 para um por núcleo.
+        /// @param pin_threads Fixa cada worker em um núcleo distinto.
+        /// @param backlog     Número máximo de conexões pendentes por listener.
+        ReusePortServer(uint32_t port, unsigned workers = 0, bool pin_threads = true,
+            uint32_t backlog = SOMAXCONN);
+
+        /// Cria o servidor com uma configuração de listener, sem abrir nenhuma
+        /// socket. SO_REUSEPORT é sempre ativado.
+        /// @param port        Porta na qual os listeners serão vinculados.
+        /// @param config      Endereço, backlog e opções de cada listener.
+        /// @param workers     Número de workers, 0 para um por núcleo.
+        /// @param pin_threads Fixa cada worker em um núcleo distinto.
+        ReusePortServer(uint32_t port, const ListenerConfig& config, unsigned workers = 0,
+            bool pin_threads = true);
+
+        /// Destrutor. Interrompe e aguarda os workers.
+        ~ReusePortServer();
+
+        ReusePortServer(const ReusePortServer&) = delete;
+        ReusePortServer& operator=(const ReusePortServer&) = delete;
+
+        /// Abre os listeners e inicia as threads dos workers.
+        /// Erros de bind() e listen() são lançados na thread que chamou start().
+        /// @param on_accept Callback chamado na thread do worker para cada conexão aceita.
+        void start(AcceptCallback on_accept);
+
+        /// Interrompe todos os workers. Pode ser chamada de qualquer thread.
+        void stop();
+
+        /// Aguarda o término das threads dos workers e os destrói. Deve ser
+        /// chamada pela mesma thread que chamou start().
+        void join();
+
+        /// Número de workers.
+        unsigned get_workers() const {
+            return this->total_workers;
+        }
+
+        /// EventLoop de um worker.
+        /// @param worker Índice do worker, menor que get_workers().
+        EventLoop& get_loop(unsigned worker) {
+            return *this->workers.at(worker)->loop;
+        }
+
+    private:
+
+        /// Listener, laço de eventos e thread de um worker.
+        struct Worker {
+            std::unique_ptr<TCPSocket> listener;
+            std::unique_ptr<EventLoop> loop;
+            std::thread thread;
+        };
+
+        /// Fixa a thread atual em um núcleo.
+        /// @param cpu Índice do núcleo.
+        static void pin_current_thread(unsigned cpu);
+
+        /// Porta dos listeners.
+        uint32_t port;
+
+        /// Número de workers.
+        unsigned total_workers;
+
+        /// Se os workers devem ser fixados em núcleos.
+        bool pin_threads;
+
+        /// Configuração de cada listener.
+        ListenerConfig config;
+
+        /// Protege workers entre stop(), chamada de qualquer thread, e
+        /// start() e join().
+        std::mutex workers_mutex;
+
+        /// Workers em execução.
+        std::vector<std::unique_ptr<Worker>> workers;
+};
+
+} // End namespace Socket
+
+#endif
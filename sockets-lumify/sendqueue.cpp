@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "sendqueue.hpp"
+
+#include <thread>
+
+using namespace Socket;
+
+const int SendQueue::MAX_BATCH;
+
+SendQueue::SendQueue(std::shared_ptr<TCPSocket> socket, EventLoop& loop) :
+    socket(socket), loop(loop), head(&stub), tail(&stub), scheduled(false), closed(false), queued(0) {}
+
+SendQueue::~SendQueue() {
+
+    discard_batch();
+
+    // Sem produtores, a lista pode ser percorrida diretamente.
+    Node* node = tail;
+    while (node) {
+        Node* next = node->next.load(std::memory_order_relaxed);
+        if (node != &stub) delete node;
+        node = next;
+    }
+}
+
+bool SendQueue::push(std::string message) {
+
+    Node* node = new Node();
+    node->text = std::move(message);
+    node->data = (const uint8_t *) node->text.data();
+    node->length = node->text.size();
+
+    return enqueue(node);
+}
+
+bool SendQueue::push(const uint8_t* message, size_t length) {
+    return push(std::string((const char *) message, length));
+}
+
+bool SendQueue::push(BufferHandle buffer) {
+
+    Node* node = new Node();
+    node->data = buffer.data();
+    node->length = buffer.size();
+    node->buffer = std::move(buffer);
+
+    return enqueue(node);
+}
+
+bool SendQueue::enqueue(Node* node) {
+
+    if (is_closed()) {
+        delete node;
+        return false;
+    }
+
+    queued.fetch_add(1, std::memory_order_relaxed);
+    link(node);
+
+    // Só o produtor que tira a fila do repouso agenda o envio; drain() limpa
+    // a marca antes de esvaziar a lista, então nenhuma mensagem fica parada.
+    if (!scheduled.exchange(true)) {
+        std::shared_ptr<SendQueue> self = shared_from_this();
+        loop.post([self]() {
+            try {
+                self->drain();
+            }
+            catch (const ConnectionException& e) {
+                // A fila já foi fechada por drain().
+            }
+        });
+    }
+
+    return true;
+}
+
+void SendQueue::link(Node* node) {
+
+    node->next.store(NULL, std::memory_order_relaxed);
+
+    // Depois da troca o nó já é o último, mas só fica visível para o
+    // consumidor quando o anterior apontar para ele.
+    Node* previous = head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+}
+
+SendQueue::PopResult SendQueue::pop(Node*& node) {
+
+    Node* first = tail;
+    Node* next = first->next.load(std::memory_order_acquire);
+
+    // O sentinela não é uma mensagem: pula para o nó seguinte.
+    if (first == &stub) {
+        if (!next) {
+            return head.load(std::memory_order_acquire) == &stub ? EMPTY : IN_PROGRESS;
+        }
+        tail = next;
+        first = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        tail = next;
+        node = first;
+        return POPPED;
+    }
+
+    // first parece ser o último, mas um produtor pode ter acabado de trocar head.
+    if (first != head.load(std::memory_order_acquire)) return IN_PROGRESS;
+
+    // Recoloca o sentinela no fim para poder retirar first sem deixar a lista vazia.
+    link(&stub);
+
+    next = first->next.load(std::memory_order_acquire);
+    if (next) {
+        tail = next;
+        node = first;
+        return POPPED;
+    }
+
+    return IN_PROGRESS;
+}
+
+size_t SendQueue::drain() {
+
+    // Limpa a marca antes de ler a lista: um push() que chegar depois da
+    // última leitura agenda outro drain(). A troca sincroniza com a do
+    // último produtor, cujo nó já está ligado.
+    scheduled.exchange(false);
+
+    size_t total = 0;
+
+    while (!is_closed()) {
+
+        // Completa o lote com as mensagens novas.
+        while ((int) batch.size() < MAX_BATCH) {
+
+            Node* node = NULL;
+            PopResult result = pop(node);
+
+            if (result == POPPED) {
+                batch.push_back(node);
+            }
+            else if (result == EMPTY || !batch.empty()) {
+                break;
+            }
+            else {
+                // Um produtor está entre as duas instruções de link(); com o
+                // lote vazio, espera por ele em vez de deixar a mensagem parada.
+                std::this_thread::yield();
+            }
+        }
+
+        if (batch.empty()) break;
+
+        iovec buffers[MAX_BATCH];
+        int count = 0;
+        for (size_t i = 0; i < batch.size() && count < MAX_BATCH; i++) {
+            buffers[count].iov_base = const_cast<uint8_t*>(batch[i]->data);
+            buffers[count].iov_len = batch[i]->length;
+            count++;
+        }
+        buffers[0].iov_base = (uint8_t *) buffers[0].iov_base + sent;
+        buffers[0].iov_len -= sent;
+
+        Result<size_t> result = socket->try_sendv(buffers, count);
+
+        if (!result.ok()) {
+            if (result.error() == Errc::interrupted) continue;
+            if (result.error() == Errc::would_block || result.error() == Errc::timed_out) break;
+
+            close();
+            throw ConnectionException("Could not send queued messages. Error: "
+                + std::string(result.message()));
+        }
+
+        total += result.value();
+
+        // Libera as mensagens enviadas por inteiro e guarda o progresso na parcial.
+        size_t advance = sent + result.value();
+        while (!batch.empty() && advance >= batch.front()->length) {
+            advance -= batch.front()->length;
+            delete batch.front();
+            batch.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+        }
+        sent = advance;
+
+        // Envio parcial: o kernel não aceita mais bytes agora.
+        if (!batch.empty()) break;
+    }
+
+    return total;
+}
+
+void SendQueue::close() {
+
+    closed.store(true, std::memory_order_release);
+    discard_batch();
+
+    Node* node = NULL;
+    while (pop(node) == POPPED) {
+        delete node;
+        queued.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void SendQueue::discard_batch() {
+
+    for (size_t i = 0; i < batch.size(); i++) delete batch[i];
+    queued.fetch_sub(batch.size(), std::memory_order_relaxed);
+
+    batch.clear();
+    sent = 0;
+}
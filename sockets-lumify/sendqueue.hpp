@@ -0,0 +1,155 @@
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "eventloop.hpp"
+
+namespace Socket {
+
+/** Fila de envio de uma conexão com vários produtores e um consumidor.
+ *
+ *      Qualquer thread pode enfileirar uma mensagem inteira com push(), sem
+ *  locks e sem esperar pela rede: as mensagens nunca se misturam no stream,
+ *  e um produtor não fica preso atrás de outro que esteja esperando um
+ *  cliente lento. A fila é uma lista ligada intrusiva de Vyukov, em que
+ *  enfileirar custa uma troca atômica.
+ *      O envio é feito apenas pela thread do EventLoop dono da socket, que
+ *  junta até MAX_BATCH mensagens em uma chamada de sendmsg() (writev). Quando
+ *  a fila sai do repouso, push() agenda um drain() nesse laço com
+ *  EventLoop::post(); quando o kernel não aceita mais bytes, o envio
+ *  continua na próxima chamada de drain(), que deve ser feita pelo callback
+ *  on_writable da socket.
+ *      Deve ser criada com std::make_shared, já que os envios agendados
+ *  mantêm a fila viva. Um erro de envio fecha a fila (is_closed()): as
+ *  mensagens pendentes são descartadas e push() passa a retornar false.
+ */
+class SendQueue : public std::enable_shared_from_this<SendQueue> {
+    public:
+
+        /// Número máximo de mensagens enviadas em uma chamada de sistema.
+        static const int MAX_BATCH = 64;
+
+        /// Cria a fila sobre uma socket conectada, registrada no laço.
+        /// @param socket Socket conectada, compartilhada pelos produtores.
+        /// @param loop   Laço cuja thread envia as mensagens.
+        SendQueue(std::shared_ptr<TCPSocket> socket, EventLoop& loop);
+
+        /// Destrutor. Descarta as mensagens que ainda não foram enviadas.
+        ~SendQueue();
+
+        SendQueue(const SendQueue&) = delete;
+        SendQueue& operator=(const SendQueue&) = delete;
+
+        /// Enfileira uma mensagem. Pode ser chamada de qualquer thread.
+        /// @param message Mensagem a ser enviada por inteiro.
+        /// @return False se a fila já foi fechada.
+        bool push(std::string message);
+
+        /// Enfileira uma cópia de bytes. Pode ser chamada de qualquer thread.
+        /// @param message Endereço inicial da mensagem.
+        /// @param length  Número de bytes.
+        /// @return False se a fila já foi fechada.
+        bool push(const uint8_t* message, size_t length);
+
+        /// Enfileira um buffer de um BufferPool sem copiá-lo, mantendo uma
+        /// referência até o envio. Pode ser chamada de qualquer thread.
+        /// @param buffer Buffer cujos bytes válidos serão enviados.
+        /// @return False se a fila já foi fechada.
+        bool push(BufferHandle buffer);
+
+        /// Envia as mensagens enfileiradas até a fila esvaziar ou o kernel não
+        /// aceitar mais bytes. Apenas na thread do laço. Lança
+        /// ConnectionException, e fecha a fila, em caso de erro de envio.
+        /// @return Número de bytes enviados.
+        size_t drain();
+
+        /// Fecha a fila, descartando as mensagens pendentes. Apenas na thread
+        /// do laço.
+        void close();
+
+        /// Indica se a fila foi fechada.
+        bool is_closed() const {
+            return this->closed.load(std::memory_order_acquire);
+        }
+
+        /// Número aproximado de mensagens enfileiradas e ainda não enviadas
+        /// por inteiro.
+        size_t pending() const {
+            return this->queued.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        /// Mensagem enfileirada.
+        struct Node {
+            std::atomic<Node*> next;
+
+            /// Bytes da mensagem, que pertencem a text ou a buffer.
+            const uint8_t* data = NULL;
+            size_t length = 0;
+
+            std::string text;
+            BufferHandle buffer;
+
+            Node() : next(NULL) {}
+        };
+
+        /// Resultado de pop().
+        enum PopResult { POPPED, EMPTY, IN_PROGRESS };
+
+        /// Enfileira um nó e agenda o envio, se necessário.
+        bool enqueue(Node* node);
+
+        /// Retira o nó mais antigo da lista de Vyukov. Apenas o consumidor.
+        /// @param node Preenchido com o nó retirado.
+        /// @return IN_PROGRESS se um produtor ainda está ligando o próximo nó.
+        PopResult pop(Node*& node);
+
+        /// Acrescenta um nó ao fim da lista de Vyukov.
+        void link(Node* node);
+
+        /// Libera as mensagens retiradas e ainda não enviadas.
+        void discard_batch();
+
+        /// Socket conectada.
+        std::shared_ptr<TCPSocket> socket;
+
+        /// Laço cuja thread envia as mensagens.
+        EventLoop& loop;
+
+        /// Último nó enfileirado, disputado pelos produtores.
+        std::atomic<Node*> head;
+
+        /// Nó sentinela da lista, usado por pop() quando ela fica vazia.
+        Node stub;
+
+        /// Nó mais antigo da lista, usado apenas pelo consumidor.
+        Node* tail;
+
+        /// Mensagens retiradas da lista e ainda não enviadas por inteiro, a
+        /// partir de sent bytes da primeira.
+        std::deque<Node*> batch;
+        size_t sent = 0;
+
+        /// Se há um drain() agendado no laço.
+        std::atomic<bool> scheduled;
+
+        /// Se a fila foi fechada.
+        std::atomic<bool> closed;
+
+        /// Mensagens ainda não enviadas por inteiro.
+        std::atomic<size_t> queued;
+};
+
+} // End namespace Socket
+
+#endif
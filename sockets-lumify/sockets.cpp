@@ -6,55 +6,205 @@
  
 #include "sockets.hpp"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <iostream>
 
 using namespace Socket;
 
-BaseSocket::BaseSocket(int type, int flags) {
+std::string Socket::format_address(const sockaddr_storage& address) {
 
-    // Inicializa socket_info
-    socket_info = (addrinfo *) calloc(1, sizeof(addrinfo));
+    char text[INET6_ADDRSTRLEN];
+    const char* result = NULL;
 
-    // Prenche a estrutura de endereço do socket, sempre IPv4
-    socket_info->ai_family = AF_INET;
-    socket_info->ai_socktype = type;
-    socket_info->ai_flags = flags;
+    if (address.ss_family == AF_INET) {
+        result = ::inet_ntop(AF_INET, &((const sockaddr_in *) &address)->sin_addr, text, sizeof(text));
+    }
+    else if (address.ss_family == AF_INET6) {
+        const in6_addr& ipv6 = ((const sockaddr_in6 *) &address)->sin6_addr;
+
+        // Os últimos 4 bytes de um endereço mapeado são o endereço IPv4.
+        if (IN6_IS_ADDR_V4MAPPED(&ipv6)) result = ::inet_ntop(AF_INET, &ipv6.s6_addr[12], text, sizeof(text));
+        else result = ::inet_ntop(AF_INET6, &ipv6, text, sizeof(text));
+    }
+
+    return result ? std::string(result) : std::string();
+}
+
+uint32_t Socket::address_port(const sockaddr_storage& address) {
+
+    if (address.ss_family == AF_INET) {
+        return ntohs(((const sockaddr_in *) &address)->sin_port);
+    }
+    if (address.ss_family == AF_INET6) {
+        return ntohs(((const sockaddr_in6 *) &address)->sin6_port);
+    }
+
+    return 0;
+}
+
+socklen_t Socket::address_length(const sockaddr_storage& address) {
+    return address.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+}
+
+/// Nome de uma família de endereços, para mensagens de erro.
+static std::string family_name(int family) {
+    return family == AF_INET6 ? "IPv6" : "IPv4";
+}
+
+Errc Socket::errc_from_errno(int error, bool nonblocking) noexcept {
+
+    // EAGAIN em uma socket bloqueante significa que o tempo limite de
+    // SO_RCVTIMEO/SO_SNDTIMEO foi atingido.
+    if (error == EAGAIN || error == EWOULDBLOCK) {
+        return nonblocking ? Errc::would_block : Errc::timed_out;
+    }
+
+    switch (error) {
+        case ETIMEDOUT:     return Errc::timed_out;
+        case EINTR:         return Errc::interrupted;
+        case ENOTCONN:      return Errc::not_connected;
+        case EPIPE:
+        case ECONNRESET:    return Errc::connection_reset;
+        case ECONNREFUSED:  return Errc::connection_refused;
+        case EMSGSIZE:      return Errc::message_size;
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:        return Errc::no_resources;
+        default:            return Errc::system;
+    }
+}
+
+bool Socket::is_transient_accept_error(int error) noexcept {
+
+    switch (error) {
+        case EINTR:
+        case ECONNABORTED:
+        case EPROTO:
+        case EPERM:
+        case ENETDOWN:
+        case ENOPROTOOPT:
+        case EHOSTDOWN:
+        case ENONET:
+        case EHOSTUNREACH:
+        case EOPNOTSUPP:
+        case ENETUNREACH:   return true;
+        default:            return false;
+    }
+}
+
+const char* Socket::error_message(Errc code, int sys_errno) noexcept {
+
+    switch (code) {
+        case Errc::none:                return "Success";
+        case Errc::would_block:         return "Operation would block";
+        case Errc::closed:              return "Connection closed by peer";
+        case Errc::timed_out:           return "Operation timed out";
+        case Errc::interrupted:         return "Interrupted by a signal";
+        case Errc::not_connected:       return "Socket is not connected";
+        case Errc::connection_reset:    return "Connection reset by peer";
+        case Errc::connection_refused:  return "Connection refused";
+        case Errc::message_size:        return "Message too long";
+        case Errc::no_resources:        return "Out of descriptors or buffer space";
+        case Errc::not_found:           return "Could not resolve address";
+        case Errc::option_failed:       return "Could not set inherited option on accepted connection";
+        case Errc::system:              break;
+    }
+
+    // strerror() não aloca memória para os códigos conhecidos pela glibc.
+    return sys_errno != 0 ? strerror(sys_errno) : "Unknown error";
+}
+
+BaseSocket::BaseSocket(int type, int flags, int family) {
+
+    if (family != AF_INET && family != AF_INET6 && family != AF_UNIX) {
+        throw SocketException("Socket family must be AF_INET, AF_INET6 or AF_UNIX");
+    }
+
+    // Prenche a estrutura de endereço do socket
+    memset(&hints, 0, sizeof(addrinfo));
+    hints.ai_family = family;
+    hints.ai_socktype = type;
+    hints.ai_flags = flags;
 
-    // Mesma família (IPv4) e tipo de socket da socket_info
-    socketfd = socket(AF_INET, type, 0);
+    // Mesma família e tipo de socket de hints
+    socketfd = socket(family, type, 0);
     if (socketfd == -1) {
         throw SocketException("Could not create socket. Error: " + std::string(strerror(errno)));
     }
 
     // Permite reuso de endereço (evita "Address already in use")
     int optval = 1;
-    setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (family != AF_UNIX) setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    // Sockets IPv6 são dual-stack, independente de net.ipv6.bindv6only.
+    if (family == AF_INET6) {
+        try {
+            set_v6_only(false);
+        }
+        catch (...) {
+            ::close(socketfd);
+            throw;
+        }
+    }
 }
 
 BaseSocket::BaseSocket(int socket, int type, addrinfo sInfo, const std::string& client_ip, uint32_t port, bool is_bound) :
     socketfd(socket), ip_address_str(client_ip), port_used(port), is_bound(is_bound) {
 
-    // Verifica que o endereço é IPv4 e do mesmo tipo definido pelo parâmetro
-    if (sInfo.ai_family != AF_INET || sInfo.ai_socktype != type) {
-        throw SocketException("sInfo passed is not defined as the defined type and protocol IPv4");
+    // Verifica que o endereço é IPv4 ou IPv6 e do mesmo tipo definido pelo parâmetro
+    if ((sInfo.ai_family != AF_INET && sInfo.ai_family != AF_INET6) || sInfo.ai_socktype != type) {
+        throw SocketException("sInfo passed is not defined as the defined type and protocol IPv4 or IPv6");
     }
 
-    // Copia as inforamações do sInfo (sockaddr).
-    socket_info = (addrinfo *) malloc(sizeof(addrinfo));
-    memcpy(socket_info, &sInfo, sizeof(addrinfo));
+    // Guarda apenas a família e o tipo; o endereço é copiado para dentro do
+    // objeto, pois sInfo.ai_addr normalmente aponta para uma variável local.
+    memset(&hints, 0, sizeof(addrinfo));
+    hints.ai_family = sInfo.ai_family;
+    hints.ai_socktype = sInfo.ai_socktype;
+
+    if (sInfo.ai_addr && sInfo.ai_addrlen <= sizeof(sockaddr_storage)) {
+        memcpy(&peer_address, sInfo.ai_addr, sInfo.ai_addrlen);
+        peer_length = sInfo.ai_addrlen;
+    }
 
     // Permite reuso de endereço (evita "Address already in use")
     int optval = 1;
     setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
 }
 
+BaseSocket::BaseSocket(int socket, int type, const sockaddr_storage& peer, socklen_t peer_length) :
+    peer_address(peer), peer_length(peer_length), socketfd(socket) {
+
+    memset(&hints, 0, sizeof(addrinfo));
+    hints.ai_family = peer.ss_family;
+    hints.ai_socktype = type;
+}
+
 BaseSocket::~BaseSocket() {
     // Libera memória e encerra o socket
     if (socket_info) freeaddrinfo(socket_info);
     close();
 }
 
+std::string BaseSocket::get_ip_address() {
+
+    // O endereço só é formatado na primeira vez que é pedido.
+    if (ip_address_str.empty() && peer_length > 0) {
+        ip_address_str = format_address(peer_address);
+    }
+
+    return ip_address_str;
+}
+
 void BaseSocket::bind(uint32_t port) {
+    bind("", port);
+}
+
+void BaseSocket::bind(const std::string& address, uint32_t port) {
 
     // Não é possivel vincular um socket que já está vinculado
     // Logo se a porta desejada for a mesma que já está vinculada, nada acontece.
@@ -74,21 +224,21 @@ void BaseSocket::bind(uint32_t port) {
     // argument is the null pointer, then the IP address portion
     // of the socket address structure will be set to INADDR_ANY 
     // for an IPv4 address
-    socket_info->ai_flags |= AI_PASSIVE;
-    getAddrInfo("NULL", port);
+    hints.ai_flags |= AI_PASSIVE;
+    getAddrInfo(address, port);
 
 
     int result;
-    int total_ipv4_addrs = 0; // Conta quandos endereços IPv4 foram encontrados
+    int total_addrs = 0; // Conta quantos endereços da família da socket foram encontrados
     addrinfo * new_addrinfo;
 
     for (new_addrinfo = socket_info; new_addrinfo; new_addrinfo = new_addrinfo->ai_next) {
 
-        // Ignora qualquer endereço não IPv4
-        if (new_addrinfo->ai_family == AF_INET) total_ipv4_addrs++;
+        // Ignora endereços de outra família
+        if (new_addrinfo->ai_family == hints.ai_family) total_addrs++;
         else continue;
 
-        // Tenta vincular a qualquer endereço IPv4 encontrado.
+        // Tenta vincular a qualquer endereço encontrado.
         result = ::bind(socketfd, new_addrinfo->ai_addr, new_addrinfo->ai_addrlen);
         if (result == -1) continue;
 
@@ -98,22 +248,220 @@ void BaseSocket::bind(uint32_t port) {
         return;
     }
 
-    // Se nenhum endereço IPv4 é lançado, lança exceção
-    if (total_ipv4_addrs == 0) {
-        throw ConnectionException("Could not find IPv4 addresses to bind on port " 
-            + std::to_string(port) + ".");
+    // Se nenhum endereço da família é encontrado, lança exceção
+    if (total_addrs == 0) {
+        throw ConnectionException("Could not find " + family_name(hints.ai_family) 
+            + " addresses to bind on port " + std::to_string(port) + ".");
     }
 
-    // Lança exceção caso não seja possível vincular a nenhum IPv4 encontrado.
+    // Lança exceção caso não seja possível vincular a nenhum endereço encontrado.
     throw ConnectionException("Could not bind to port " + std::to_string(port) 
             + ". Error: " + std::string(strerror(errno)));
 }
 
+void BaseSocket::bind_to_interface(const std::string& name) {
+
+    // Não é registrada: sockets aceitas já chegam pela interface do listener,
+    // e repetir a opção exigiria CAP_NET_RAW em cada accept().
+    apply_option(SOL_SOCKET, SO_BINDTODEVICE, name.c_str(), name.length() + 1, false);
+}
+
+void BaseSocket::set_reuse_port(bool enable) {
+
+    if (is_bound) {
+        throw SocketException("SO_REUSEPORT must be set before binding the socket");
+    }
+
+    int optval = enable ? 1 : 0;
+    if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+        throw SocketException("Could not set SO_REUSEPORT. Error: " + 
+            std::string(strerror(errno)));
+    }
+}
+
 void BaseSocket::set_timeout(uint16_t seconds) {
-    struct timeval tv;
-    tv.tv_sec = seconds; 
-    tv.tv_usec = 0;  // Not init'ing this can cause strange errors
-    setsockopt(this->socketfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv,sizeof(struct timeval));
+    set_receive_timeout_ms(seconds * 1000);
+}
+
+void BaseSocket::apply_option(int level, int name, const void* value, socklen_t length, bool record) {
+
+    if (setsockopt(socketfd, level, name, value, length) == -1) {
+        throw SocketException("Could not set socket option " + std::to_string(name) 
+            + ". Error: " + std::string(strerror(errno)));
+    }
+
+    if (!record) return;
+
+    std::string bytes((const char *) value, length);
+    for (size_t i = 0; i < options.size(); i++) {
+        if (options[i].level == level && options[i].name == name) {
+            options[i].value = bytes;
+            return;
+        }
+    }
+
+    SocketOption option;
+    option.level = level;
+    option.name = name;
+    option.value = bytes;
+    options.push_back(option);
+}
+
+void BaseSocket::read_option(int level, int name, void* value, socklen_t length) const {
+
+    if (getsockopt(socketfd, level, name, value, &length) == -1) {
+        throw SocketException("Could not get socket option " + std::to_string(name) 
+            + ". Error: " + std::string(strerror(errno)));
+    }
+}
+
+void BaseSocket::set_option(int level, int name, int value) {
+    apply_option(level, name, &value, sizeof(value));
+}
+
+int BaseSocket::get_option(int level, int name) const {
+    int value = 0;
+    read_option(level, name, &value, sizeof(value));
+    return value;
+}
+
+void BaseSocket::set_no_delay(bool enable) {
+    set_option(IPPROTO_TCP, TCP_NODELAY, enable ? 1 : 0);
+}
+
+bool BaseSocket::get_no_delay() const {
+    return get_option(IPPROTO_TCP, TCP_NODELAY) != 0;
+}
+
+void BaseSocket::set_v6_only(bool enable) {
+
+    if (hints.ai_family != AF_INET6) {
+        throw SocketException("IPV6_V6ONLY can only be set on IPv6 sockets");
+    }
+    if (is_bound) {
+        throw SocketException("IPV6_V6ONLY must be set before binding the socket");
+    }
+
+    // Não é registrada: o kernel recusa a opção em sockets já conectadas.
+    int optval = enable ? 1 : 0;
+    apply_option(IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(optval), false);
+
+    // Em modo dual-stack, destinos apenas IPv4 são resolvidos como
+    // endereços mapeados para que connect() e bind() os encontrem.
+    if (enable) hints.ai_flags &= ~(AI_V4MAPPED | AI_ALL);
+    else hints.ai_flags |= AI_V4MAPPED | AI_ALL;
+}
+
+bool BaseSocket::get_v6_only() const {
+    return hints.ai_family == AF_INET6 && get_option(IPPROTO_IPV6, IPV6_V6ONLY) != 0;
+}
+
+void BaseSocket::set_quick_ack(bool enable) {
+    set_option(IPPROTO_TCP, TCP_QUICKACK, enable ? 1 : 0);
+}
+
+bool BaseSocket::get_quick_ack() const {
+    return get_option(IPPROTO_TCP, TCP_QUICKACK) != 0;
+}
+
+void BaseSocket::set_send_buffer_size(int bytes) {
+    set_option(SOL_SOCKET, SO_SNDBUF, bytes);
+}
+
+int BaseSocket::get_send_buffer_size() const {
+    return get_option(SOL_SOCKET, SO_SNDBUF);
+}
+
+void BaseSocket::set_receive_buffer_size(int bytes) {
+    set_option(SOL_SOCKET, SO_RCVBUF, bytes);
+}
+
+int BaseSocket::get_receive_buffer_size() const {
+    return get_option(SOL_SOCKET, SO_RCVBUF);
+}
+
+void BaseSocket::set_keepalive(bool enable, int idle, int interval, int count) {
+
+    set_option(SOL_SOCKET, SO_KEEPALIVE, enable ? 1 : 0);
+    if (!enable) return;
+
+    if (idle > 0)     set_option(IPPROTO_TCP, TCP_KEEPIDLE, idle);
+    if (interval > 0) set_option(IPPROTO_TCP, TCP_KEEPINTVL, interval);
+    if (count > 0)    set_option(IPPROTO_TCP, TCP_KEEPCNT, count);
+}
+
+bool BaseSocket::get_keepalive() const {
+    return get_option(SOL_SOCKET, SO_KEEPALIVE) != 0;
+}
+
+void BaseSocket::set_busy_poll(int microseconds) {
+    set_option(SOL_SOCKET, SO_BUSY_POLL, microseconds);
+}
+
+int BaseSocket::get_busy_poll() const {
+    return get_option(SOL_SOCKET, SO_BUSY_POLL);
+}
+
+void BaseSocket::set_user_timeout(unsigned int milliseconds) {
+    apply_option(IPPROTO_TCP, TCP_USER_TIMEOUT, &milliseconds, sizeof(milliseconds));
+}
+
+unsigned int BaseSocket::get_user_timeout() const {
+    unsigned int milliseconds = 0;
+    read_option(IPPROTO_TCP, TCP_USER_TIMEOUT, &milliseconds, sizeof(milliseconds));
+    return milliseconds;
+}
+
+/// Converte milissegundos para timeval.
+static timeval to_timeval(uint32_t milliseconds) {
+    timeval tv;
+    tv.tv_sec = milliseconds / 1000;
+    tv.tv_usec = (milliseconds % 1000) * 1000;  // Not init'ing this can cause strange errors
+    return tv;
+}
+
+/// Converte timeval para milissegundos.
+static uint32_t to_milliseconds(const timeval& tv) {
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void BaseSocket::set_send_timeout_ms(uint32_t milliseconds) {
+    timeval tv = to_timeval(milliseconds);
+    apply_option(SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+uint32_t BaseSocket::get_send_timeout_ms() const {
+    timeval tv;
+    read_option(SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return to_milliseconds(tv);
+}
+
+void BaseSocket::set_receive_timeout_ms(uint32_t milliseconds) {
+    timeval tv = to_timeval(milliseconds);
+    apply_option(SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+uint32_t BaseSocket::get_receive_timeout_ms() const {
+    timeval tv;
+    read_option(SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return to_milliseconds(tv);
+}
+
+void BaseSocket::set_nonblocking(bool enable) {
+
+    int flags = ::fcntl(socketfd, F_GETFL, 0);
+    if (flags == -1) {
+        throw SocketException("Could not get socket flags. Error: " + 
+            std::string(strerror(errno)));
+    }
+
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (::fcntl(socketfd, F_SETFL, flags) == -1) {
+        throw SocketException("Could not set socket flags. Error: " + 
+            std::string(strerror(errno)));
+    }
+
+    nonblocking = enable;
 }
 
 void BaseSocket::close() {
@@ -136,13 +484,12 @@ void BaseSocket::close() {
 
 void BaseSocket::getAddrInfo(const std::string address, uint32_t port) {
 
-    addrinfo   hints = *socket_info;
     addrinfo * new_socket_info;
     const char * c_address;
 
     // c_address = NULL significa que o getaddrinf() buscará por endereços
     // locais da maquina
-    if (address == "NULL") c_address = NULL;
+    if (address.empty() || address == "NULL") c_address = NULL;
     else c_address = address.c_str();
 
     int result = getaddrinfo(c_address, std::to_string(port).c_str(), &hints, &new_socket_info);
@@ -158,21 +505,260 @@ void BaseSocket::getAddrInfo(const std::string address, uint32_t port) {
 }
 
 bool BaseSocket::validateIpAddress(const std::string &ip_address) {
-    sockaddr_in sa;
-    int result = ::inet_pton(AF_INET, ip_address.c_str(), &(sa.sin_addr));
-    return result != 0;
+    in6_addr address;
+    return ::inet_pton(AF_INET, ip_address.c_str(), &address) == 1 ||
+           ::inet_pton(AF_INET6, ip_address.c_str(), &address) == 1;
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
  *                  TCPSOCKET
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-TCPSocket::TCPSocket(int flags) : BaseSocket(SOCK_STREAM, flags) {}
+/// Número máximo de buffers passados a cada ::sendmsg() por raw_sendv(). Os
+/// buffers restantes após um envio parcial são copiados para a pilha, sem
+/// alocar memória.
+static const int SENDV_WINDOW = 64;
+
+/// Envia bytes repetindo ::send() até enviar tudo ou ocorrer um erro.
+/// @param error Preenchido com o errno que interrompeu o envio, 0 se enviou tudo.
+/// @return Número de bytes enviados.
+static size_t raw_send(int fd, const uint8_t* message, size_t length, int flags, int& error) noexcept {
+
+    size_t bytes_sent = 0;
+    error = 0;
+
+    while (bytes_sent < length) {
+
+        ssize_t result = ::send(fd, message + bytes_sent, length - bytes_sent, flags | MSG_NOSIGNAL);
+        if (result == -1) {
+            error = errno;
+            break;
+        }
+
+        bytes_sent += result;
+    }
+
+    return bytes_sent;
+}
+
+/// Envia bytes distribuídos entre buffers repetindo ::sendmsg() até enviar
+/// tudo ou ocorrer um erro.
+/// @param error Preenchido com o errno que interrompeu o envio, 0 se enviou tudo.
+/// @return Número de bytes enviados.
+static size_t raw_sendv(int fd, const iovec* buffers, int count, int flags, int& error) noexcept {
+
+    size_t length = 0;
+    for (int i = 0; i < count; i++) length += buffers[i].iov_len;
+
+    iovec window[SENDV_WINDOW];
+    int first = 0;
+    size_t offset = 0;
+    size_t bytes_sent = 0;
+    error = 0;
+
+    while (bytes_sent < length) {
+
+        // Na primeira chamada os buffers do chamador são usados diretamente;
+        // depois de um envio parcial, apenas uma janela dos que faltam é copiada.
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+
+        if (first == 0 && offset == 0) {
+            message.msg_iov = const_cast<iovec*>(buffers);
+            message.msg_iovlen = count < IOV_MAX ? count : IOV_MAX;
+        }
+        else {
+            int size = 0;
+            for (int i = first; i < count && size < SENDV_WINDOW; i++) window[size++] = buffers[i];
+            window[0].iov_base = (uint8_t *) window[0].iov_base + offset;
+            window[0].iov_len -= offset;
+
+            message.msg_iov = window;
+            message.msg_iovlen = size;
+        }
+
+        ssize_t result = ::sendmsg(fd, &message, flags | MSG_NOSIGNAL);
+        if (result == -1) {
+            error = errno;
+            break;
+        }
+
+        bytes_sent += result;
+
+        // Descarta os buffers enviados por inteiro e avança no parcial.
+        size_t advance = offset + result;
+        while (first < count && advance >= buffers[first].iov_len) {
+            advance -= buffers[first].iov_len;
+            first++;
+        }
+        offset = advance;
+    }
+
+    return bytes_sent;
+}
+
+/// Maior número de bytes que o Linux transfere em uma chamada de sendfile().
+static const uint64_t SENDFILE_CHUNK = 0x7ffff000;
+
+/// Envia bytes de um arquivo repetindo ::sendfile() até enviar tudo, o
+/// arquivo terminar ou ocorrer um erro.
+/// @param error Preenchido com o errno que interrompeu o envio, 0 caso contrário.
+/// @return Número de bytes enviados.
+static uint64_t raw_sendfile(int fd, int file, off_t offset, uint64_t count, int& error) noexcept {
+
+    uint64_t bytes_sent = 0;
+    error = 0;
+
+    while (bytes_sent < count) {
+
+        uint64_t chunk = count - bytes_sent;
+        if (chunk > SENDFILE_CHUNK) chunk = SENDFILE_CHUNK;
+
+        // sendfile() avança offset e mantém a posição do descritor.
+        ssize_t result = ::sendfile(fd, file, &offset, chunk);
+        if (result == -1) {
+            error = errno;
+            break;
+        }
+
+        // O arquivo terminou antes de count bytes.
+        if (result == 0) break;
+
+        bytes_sent += result;
+    }
+
+    return bytes_sent;
+}
+
+/// Lança a exceção correspondente a um try_send_file() sem sucesso.
+static uint64_t check_sent_file(const Result<uint64_t>& result) {
+
+    if (result.ok()) return result.value();
+
+    if (result.error() == Errc::would_block || result.error() == Errc::timed_out) {
+        throw WouldBlock("Send buffer is full.");
+    }
+
+    throw ConnectionException("Could not send file. Error: " + std::string(result.message()));
+}
+
+/// Resultado de um envio sem exceções. Bytes já enviados não podem ser
+/// desfeitos, então um envio parcial é retornado como sucesso e o erro
+/// reaparece na próxima chamada.
+static Result<size_t> sent_result(size_t bytes_sent, int error, bool nonblocking) noexcept {
+
+    if (bytes_sent > 0 || error == 0) return bytes_sent;
+    return Result<size_t>(errc_from_errno(error, nonblocking), error);
+}
+
+/// Lança a exceção correspondente a um envio incompleto.
+static void check_sent(size_t bytes_sent, size_t length, int error) {
+
+    if (bytes_sent == length) return;
+
+    if (error == EAGAIN || error == EWOULDBLOCK) {
+        throw WouldBlock("Send buffer is full. Sent " + std::to_string(bytes_sent)
+            + " of " + std::to_string(length) + " bytes.");
+    }
+
+    throw ConnectionException("Could not send message. Error: " 
+        + std::string(strerror(error)));
+}
+
+/// Envia todos os bytes de message, repetindo ::send() até terminar.
+static void send_all(int fd, const uint8_t* message, size_t length, int flags) {
+
+    int error;
+    size_t bytes_sent = raw_send(fd, message, length, flags, error);
+    check_sent(bytes_sent, length, error);
+}
+
+/// Envia todos os bytes de buffers, repetindo ::sendmsg() até terminar.
+static void sendv_all(int fd, const iovec* buffers, int count, int flags) {
+
+    size_t length = 0;
+    for (int i = 0; i < count; i++) length += buffers[i].iov_len;
+
+    int error;
+    size_t bytes_sent = raw_sendv(fd, buffers, count, flags, error);
+    check_sent(bytes_sent, length, error);
+}
+
+/// Resultado de um ::recv() ou ::recvmsg() sem exceções, com o fechamento
+/// da conexão retornado como Errc::closed.
+static Result<size_t> received_result(ssize_t result, bool nonblocking) noexcept {
+
+    if (result == -1) return Result<size_t>(errc_from_errno(errno, nonblocking), errno);
+    if (result == 0) return Result<size_t>(Errc::closed);
+    return (size_t) result;
+}
+
+/// Lança a exceção correspondente a um erro de ::recv() ou ::recvmsg().
+/// @return Número de bytes recebidos, 0 se o outro lado fechou a conexão.
+static size_t check_received(ssize_t result) {
+
+    if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        throw WouldBlock("No data available to receive.");
+    }
+    if (result == -1) {
+        throw ConnectionException("Could not receive message. Error: " 
+            + std::string(strerror(errno)));
+    }
+
+    return result;
+}
+
+/// Recebe até capacity bytes com uma chamada de ::recv().
+/// @return Número de bytes recebidos, 0 se o outro lado fechou a conexão.
+static size_t recv_some(int fd, uint8_t* buffer, size_t capacity, int flags) {
+    return check_received(::recv(fd, buffer, capacity, flags));
+}
+
+/// Recebe bytes distribuídos entre buffers com uma chamada de ::recvmsg().
+/// @return Número de bytes recebidos, 0 se o outro lado fechou a conexão.
+static size_t recvv_some(int fd, const iovec* buffers, int count, int flags) {
+
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = const_cast<iovec*>(buffers);
+    message.msg_iovlen = count;
+
+    return check_received(::recvmsg(fd, &message, flags));
+}
+
+/// Tamanho até o qual recv() recebe em um buffer na pilha e copia só os
+/// bytes recebidos para a string retornada.
+static const size_t RECV_STACK_SIZE = 64 * 1024;
+
+/// Recebe até maxlen bytes em uma string do tamanho exato da mensagem, sem
+/// que ela guarde capacidade para maxlen bytes enquanto o chamador a mantém.
+/// @param receive Função que recebe em (buffer, capacidade) e retorna o número de bytes.
+template<typename Receive>
+static std::string receive_string(uint64_t maxlen, Receive receive) {
+
+    if (maxlen <= RECV_STACK_SIZE) {
+        uint8_t buffer[RECV_STACK_SIZE];
+        size_t received = receive(buffer, (size_t) maxlen);
+        return std::string((const char *) buffer, received);
+    }
+
+    std::string message(maxlen, '\0');
+    message.resize(receive((uint8_t *) &message[0], (size_t) maxlen));
+    if (message.size() < message.capacity() / 2) message.shrink_to_fit();
+
+    return message;
+}
+
+TCPSocket::TCPSocket(int flags, int family) : BaseSocket(SOCK_STREAM, flags, family) {}
 
 TCPSocket::TCPSocket(int socket, addrinfo socket_info, uint32_t port_used, const std::string& client_ip, bool is_bound, bool is_listening, bool is_connected) : 
     BaseSocket(socket, SOCK_STREAM, socket_info, client_ip, port_used, is_bound), is_listening(is_listening), is_connected(is_connected) {
 }
 
+TCPSocket::TCPSocket(int socket, const sockaddr_storage& peer, socklen_t peer_length) :
+    BaseSocket(socket, SOCK_STREAM, peer, peer_length), is_connected(true) {
+}
+
 void TCPSocket::connect(const std::string& address, uint32_t port) {
 
     if (is_listening) {
@@ -186,12 +772,12 @@ void TCPSocket::connect(const std::string& address, uint32_t port) {
     getAddrInfo(address, port);
 
     int result;
-    int total_ipv4_addrs = 0;
+    int total_addrs = 0;
     addrinfo * new_addrinfo;
 
     for (new_addrinfo = socket_info; new_addrinfo; new_addrinfo = new_addrinfo->ai_next) {
 
-        if (new_addrinfo->ai_family == AF_INET) total_ipv4_addrs++;
+        if (new_addrinfo->ai_family == hints.ai_family) total_addrs++;
         else continue;
 
         result = ::connect(socketfd, new_addrinfo->ai_addr, new_addrinfo->ai_addrlen);
@@ -201,8 +787,9 @@ void TCPSocket::connect(const std::string& address, uint32_t port) {
         return;
     }
 
-    if (total_ipv4_addrs == 0) {
-        throw ConnectionException("Could not find IPv4 addresses to connect to " + address + 
+    if (total_addrs == 0) {
+        throw ConnectionException("Could not find " + family_name(hints.ai_family) + 
+                                  " addresses to connect to " + address + 
                                   " on port " + std::to_string(port) + ".");
     }
 
@@ -232,110 +819,339 @@ void TCPSocket::listen(uint32_t backlog) {
 
 }
 
-std::shared_ptr<TCPSocket> TCPSocket::accept() {
+void TCPSocket::listen(uint32_t port, const ListenerConfig& config) {
 
-    if (!is_listening) {
-        throw SocketException("Socket is not listening to incoming connections to accept one");
-    }
+    // Opções que precisam ser definidas antes do bind()
+    if (config.reuse_port) set_reuse_port(true);
+    if (!config.interface_name.empty()) bind_to_interface(config.interface_name);
 
-    sockaddr client_address;
-    socklen_t sin_size = sizeof(sockaddr);
-    int clientfd = ::accept(socketfd, &client_address, &sin_size);
+    bind(config.address, port);
 
-    if (clientfd == -1) {
-        throw ConnectionException("Error while accepting a connection. Error: " 
-            + std::string(strerror(errno)));
+    // Opções que precisam ser definidas antes do listen()
+    // e que não são herdadas pelas conexões aceitas.
+    if (config.defer_accept > 0) {
+        apply_option(IPPROTO_TCP, TCP_DEFER_ACCEPT, &config.defer_accept, sizeof(int), false);
+    }
+    if (config.fast_open > 0) {
+        apply_option(IPPROTO_TCP, TCP_FASTOPEN, &config.fast_open, sizeof(int), false);
     }
 
-    addrinfo client_info;
-    memset(&client_info, 0, sizeof(addrinfo));
+    listen(config.backlog);
 
-    client_info.ai_family = AF_INET;
-    client_info.ai_socktype = SOCK_STREAM;
-    client_info.ai_addr = &client_address;
+}
 
-    sockaddr_in* client_address_in = (sockaddr_in*)&client_address;
-    std::string client_ip = std::string(::inet_ntoa(client_address_in->sin_addr));
+void TCPSocket::set_fast_open_connect(bool enable) {
 
-    return std::make_shared<TCPSocket>(clientfd, client_info, 
-        client_address_in->sin_port, client_ip, false, false, true);
+    if (is_connected) {
+        throw SocketException("TCP Fast Open must be set before connecting the socket");
+    }
+
+    set_option(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, enable ? 1 : 0);
 
 }
-        
-void TCPSocket::send(const std::string& message, int flags) {
-    send((uint8_t *) message.c_str(), message.length(), flags);
-}
-        
-void TCPSocket::send(const uint8_t* message, int length, int flags) {
 
-    if (is_listening || !is_connected) {
-        throw SocketException("Can't send message from a socket that is not connected");
-    }
+std::shared_ptr<TCPSocket> TCPSocket::accept() {
 
-    int bytes_left = length;
-    int bytes_sent = 0;
-    const uint8_t* message_left;
+    TCPConnection connection = accept_connection();
 
-    while (bytes_sent < length) {
+    // O endereço é copiado para dentro do objeto, sem ponteiros para variáveis locais.
+    sockaddr_storage peer = connection.get_peer();
+    return std::make_shared<TCPSocket>(connection.release(), peer, address_length(peer));
+
+}
 
-        message_left = message + bytes_sent;
+TCPConnection TCPSocket::accept_connection() {
 
-        int result = ::send(socketfd, message_left, bytes_left, flags | MSG_NOSIGNAL);
-        if (result == -1) {
-            throw ConnectionException("Could not send message. Error: " 
+    if (!is_listening) {
+        throw SocketException("Socket is not listening to incoming connections to accept one");
+    }
+
+    Result<TCPConnection> result = try_accept();
+
+    if (result.error() == Errc::would_block || result.error() == Errc::timed_out) {
+        throw WouldBlock("No pending connections to accept.");
+    }
+    if (!result.ok()) {
+        throw ConnectionException("Error while accepting a connection. Error: " 
+            + std::string(result.message()));
+    }
+
+    return std::move(result.value());
+
+}
+
+Result<TCPConnection> TCPSocket::try_accept() noexcept {
+
+    if (!is_listening) return Result<TCPConnection>(Errc::not_connected);
+
+    sockaddr_storage client_address;
+    socklen_t client_length = sizeof(client_address);
+    int clientfd = ::accept4(socketfd, (sockaddr *) &client_address, &client_length, SOCK_CLOEXEC);
+
+    if (clientfd == -1) {
+        int error = errno;
+        return Result<TCPConnection>(errc_from_errno(error, nonblocking), error);
+    }
+
+    // A conexão fecha o descritor caso a aplicação das opções falhe.
+    TCPConnection connection(clientfd, client_address, client_length);
+
+    int error = try_apply_inherited_options(clientfd);
+    if (error != 0) return Result<TCPConnection>(Errc::option_failed, error);
+
+    return Result<TCPConnection>(std::move(connection));
+
+}
+
+size_t TCPSocket::accept_batch(std::vector<TCPConnection*>& accepted,
+    ConnectionFreeList& connections, size_t max) {
+
+    if (!is_listening) {
+        throw SocketException("Socket is not listening to incoming connections to accept one");
+    }
+
+    accepted.clear();
+
+    while (accepted.size() < max) {
+
+        // Em modo bloqueante, só chama accept4() de novo se houver outra
+        // conexão pendente, para não bloquear depois da primeira.
+        if (!nonblocking && !accepted.empty()) {
+            pollfd pending;
+            pending.fd = socketfd;
+            pending.events = POLLIN;
+            if (::poll(&pending, 1, 0) <= 0) break;
+        }
+
+        sockaddr_storage client_address;
+        socklen_t client_length = sizeof(client_address);
+        int clientfd = ::accept4(socketfd, (sockaddr *) &client_address, &client_length,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (clientfd == -1) {
+            // Conexão abortada antes de ser aceita, sinal ou erro de rede que
+            // afeta só esta conexão: tenta a próxima.
+            if (is_transient_accept_error(errno)) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            // Erros como falta de descritores são lançados apenas se nenhuma
+            // conexão foi aceita, para não perder as que já foram.
+            if (!accepted.empty()) break;
+            throw ConnectionException("Error while accepting a connection. Error: " 
                 + std::string(strerror(errno)));
         }
 
-        bytes_left -= result;
-        bytes_sent += result;
+        TCPConnection* connection = connections.acquire();
+        *connection = TCPConnection(clientfd, client_address, client_length);
+
+        // Só a conexão cuja opção falhou é fechada, como uma conexão abortada:
+        // as demais pendentes continuam sendo aceitas, para que um retorno
+        // menor que max indique sempre que a fila foi esvaziada.
+        if (try_apply_inherited_options(clientfd) != 0) {
+            connections.release(connection);
+            continue;
+        }
+
+        accepted.push_back(connection);
+    }
 
+    if (accepted.empty() && nonblocking) {
+        throw WouldBlock("No pending connections to accept.");
     }
 
+    return accepted.size();
+
 }
 
-std::string TCPSocket::recv(uint64_t maxlen, int flags) {
+int TCPSocket::try_apply_inherited_options(int clientfd, size_t* failed) noexcept {
+
+    if (!inherit_options) return 0;
+
+    for (size_t i = 0; i < options.size(); i++) {
+        if (setsockopt(clientfd, options[i].level, options[i].name,
+                       options[i].value.data(), options[i].value.size()) == -1) {
+            if (failed) *failed = i;
+            return errno;
+        }
+    }
+
+    return 0;
+}
+        
+void TCPSocket::send(const std::string& message, int flags) {
+    send((uint8_t *) message.c_str(), message.length(), flags);
+}
+        
+void TCPSocket::send(const uint8_t* message, size_t length, int flags) {
+
+    if (is_listening || !is_connected) {
+        throw SocketException("Can't send message from a socket that is not connected");
+    }
+
+    send_all(socketfd, message, length, flags);
+
+}
 
-    uint8_t* message    = recv(&maxlen, flags);
-    uint8_t* message_nt = (uint8_t *) malloc(maxlen+1);
-    memcpy(message_nt, message, maxlen);
-    message_nt[maxlen]  = '\0';
+Result<size_t> TCPSocket::try_send(const uint8_t* message, size_t length, int flags) noexcept {
 
-    std::string string_msg((char *) message_nt);
+    if (is_listening || !is_connected) return Result<size_t>(Errc::not_connected);
 
-    free(message);
-    if (message_nt != message) free(message_nt);
-    return string_msg;
+    int error;
+    size_t bytes_sent = raw_send(socketfd, message, length, flags, error);
+    return sent_result(bytes_sent, error, nonblocking);
 
 }
 
-uint8_t* TCPSocket::recv(uint64_t* length, int flags) {
+Result<size_t> TCPSocket::try_sendv(const iovec* buffers, int count, int flags) noexcept {
+
+    if (is_listening || !is_connected) return Result<size_t>(Errc::not_connected);
+
+    int error;
+    size_t bytes_sent = raw_sendv(socketfd, buffers, count, flags, error);
+    return sent_result(bytes_sent, error, nonblocking);
+
+}
+
+uint64_t TCPSocket::send_file(int fd, off_t offset, uint64_t count) {
 
     if (is_listening || !is_connected) {
-        throw SocketException("Can't receive message in a socket that is not connected");
+        throw SocketException("Can't send file from a socket that is not connected");
     }
 
-    uint64_t maxlen = *length;
+    return check_sent_file(try_send_file(fd, offset, count));
 
-    uint8_t buffer[maxlen];
-    int result = ::recv(socketfd, buffer, maxlen, flags);
+}
 
-    if (result == -1) {
-        throw ConnectionException("Could not receive message. Error: " 
-            + std::string(strerror(errno)));
+Result<uint64_t> TCPSocket::try_send_file(int fd, off_t offset, uint64_t count) noexcept {
+
+    if (is_listening || !is_connected) return Result<uint64_t>(Errc::not_connected);
+
+    int error;
+    uint64_t bytes_sent = raw_sendfile(socketfd, fd, offset, count, error);
+    return sent_result(bytes_sent, error, nonblocking);
+
+}
+
+void TCPSocket::sendv(const iovec* buffers, int count, int flags) {
+
+    if (is_listening || !is_connected) {
+        throw SocketException("Can't send message from a socket that is not connected");
     }
-    if (result ==  0) {
-        is_connected = false;
+
+    sendv_all(socketfd, buffers, count, flags);
+
+}
+
+size_t TCPSocket::recvv(const iovec* buffers, int count, int flags) {
+
+    if (is_listening || !is_connected) {
+        throw SocketException("Can't receive message in a socket that is not connected");
+    }
+
+    size_t capacity = 0;
+    for (int i = 0; i < count; i++) capacity += buffers[i].iov_len;
+    if (capacity == 0) return 0;
+
+    size_t result = recvv_some(socketfd, buffers, count, flags);
+    if (result == 0) {
+        // O outro lado pode ter fechado apenas o envio (shutdown(SHUT_WR)),
+        // então a socket continua conectada para responder.
         throw ClosedConnection("Client closed connection.");
     }
 
-    uint8_t* message = (uint8_t *) malloc(result);
-    memcpy(message, buffer, result);
-    *length = result;
+    return result;
+
+}
+
+std::string TCPSocket::recv(uint64_t maxlen, int flags) {
+
+    return receive_string(maxlen, [this, flags](uint8_t* buffer, size_t capacity) {
+        return recv_into(buffer, capacity, flags);
+    });
+
+}
+
+BufferHandle TCPSocket::recv(BufferPool& pool, int flags) {
+
+    // O buffer volta ao pool se recv_into() lançar uma exceção.
+    BufferHandle buffer = pool.acquire();
+    buffer.resize(recv_into(buffer.data(), buffer.capacity(), flags));
+    return buffer;
+
+}
+
+uint8_t* TCPSocket::recv(uint64_t* length, int flags) {
+
+    uint8_t* message = (uint8_t *) malloc(*length > 0 ? *length : 1);
+    if (!message) {
+        throw SocketException("Could not allocate " + std::to_string(*length) + " bytes.");
+    }
+
+    try {
+        *length = recv_into(message, *length, flags);
+    }
+    catch (...) {
+        free(message);
+        throw;
+    }
 
     return message;
 
 }
 
+size_t TCPSocket::recv_into(std::string& buffer, uint64_t maxlen, int flags) {
+
+    // Em C++11 não há como estender a string sem inicializar os bytes novos;
+    // o custo está documentado no cabeçalho.
+    buffer.resize(maxlen);
+    size_t received = 0;
+
+    try {
+        received = recv_into((uint8_t *) &buffer[0], maxlen, flags);
+    }
+    catch (...) {
+        buffer.clear();
+        throw;
+    }
+
+    buffer.resize(received);
+    return received;
+
+}
+
+size_t TCPSocket::recv_into(std::vector<uint8_t>& buffer, int flags) {
+    return recv_into(buffer.data(), buffer.size(), flags);
+}
+
+size_t TCPSocket::recv_into(uint8_t* buffer, size_t capacity, int flags) {
+
+    if (is_listening || !is_connected) {
+        throw SocketException("Can't receive message in a socket that is not connected");
+    }
+
+    // ::recv() com tamanho zero retornaria 0, que seria confundido com o
+    // fechamento da conexão.
+    if (capacity == 0) return 0;
+
+    size_t result = recv_some(socketfd, buffer, capacity, flags);
+    if (result == 0) {
+        // Como em recvv(), send() continua disponível após um half-close.
+        throw ClosedConnection("Client closed connection.");
+    }
+
+    return result;
+
+}
+
+Result<size_t> TCPSocket::try_recv_into(uint8_t* buffer, size_t capacity, int flags) noexcept {
+
+    if (is_listening || !is_connected) return Result<size_t>(Errc::not_connected);
+    if (capacity == 0) return (size_t) 0;
+
+    return received_result(::recv(socketfd, buffer, capacity, flags), nonblocking);
+
+}
+
 void TCPSocket::close() {
 
     BaseSocket::close();
@@ -346,97 +1162,1211 @@ void TCPSocket::close() {
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
- *                  UDPRECV
+ *                  TCPCONNECTION
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-UDPRecv::UDPRecv(const std::string& name, const std::string& address, const std::string& msg, uint32_t port) :
-                 name(name), address(address), msg(msg), port(port) {
+TCPConnection::TCPConnection() : socketfd(-1), peer_length(0) {
+    memset(&peer, 0, sizeof(peer));
 }
 
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
- *                  UDPSOCKET
- * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+TCPConnection::TCPConnection(int socket, const sockaddr_storage& peer, socklen_t peer_length) :
+    socketfd(socket), peer_length(peer_length), peer(peer) {}
 
-UDPSocket::UDPSocket(int flags) : BaseSocket(SOCK_DGRAM, flags) {
+TCPConnection::TCPConnection(TCPConnection&& other) noexcept :
+    socketfd(other.socketfd), peer_length(other.peer_length), peer(other.peer) {
+    other.socketfd = -1;
+}
 
-int broadcast_enable = 1;
-int ret = setsockopt(socketfd, SOL_SOCKET, SO_BROADCAST, 
-    &broadcast_enable, sizeof(broadcast_enable));
+TCPConnection& TCPConnection::operator=(TCPConnection&& other) noexcept {
+
+    if (this != &other) {
+        if (socketfd != -1) ::close(socketfd);
+        socketfd = other.socketfd;
+        peer_length = other.peer_length;
+        peer = other.peer;
+        other.socketfd = -1;
+    }
+
+    return *this;
 }
 
-void UDPSocket::sendto(const std::string& address, uint32_t port, 
-    const std::string& message, int flags) {
+TCPConnection::~TCPConnection() {
+    if (socketfd != -1) ::close(socketfd);
+}
+
+void TCPConnection::set_nonblocking(bool enable) {
 
-    int msg_length = message.length();
-    int bytes_left = msg_length;
-    int bytes_sent = 0;
-    const char* cMessage = message.c_str();
+    int flags = ::fcntl(socketfd, F_GETFL, 0);
+    if (flags == -1) {
+        throw SocketException("Could not get socket flags. Error: " + 
+            std::string(strerror(errno)));
+    }
 
-    socklen_t server_length;
-    sockaddr_in server_address;
-    hostent *server;
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (::fcntl(socketfd, F_SETFL, flags) == -1) {
+        throw SocketException("Could not set socket flags. Error: " + 
+            std::string(strerror(errno)));
+    }
+}
 
-    /* build the server's Internet address */
-    ::memset(&server_address, 0, sizeof(server_address));
-    server_address.sin_family = AF_INET;
+void TCPConnection::send(const uint8_t* message, size_t length, int flags) {
 
-    if (!validateIpAddress(address)) {
-        server = ::gethostbyname(address.c_str());
-        if (server == NULL) {
-            throw ConnectionException("No such host as " + address);
-        }
-        ::memcpy(server->h_addr, &server_address.sin_addr.s_addr, server->h_length);
+    if (socketfd == -1) {
+        throw SocketException("Can't send message from a connection that is closed");
+    }
 
+    send_all(socketfd, message, length, flags);
+}
+
+void TCPConnection::send(const std::string& message, int flags) {
+    send((const uint8_t *) message.data(), message.length(), flags);
+}
+
+void TCPConnection::sendv(const iovec* buffers, int count, int flags) {
+
+    if (socketfd == -1) {
+        throw SocketException("Can't send message from a connection that is closed");
     }
-    else {
-        ::inet_pton(AF_INET, address.c_str(), &(server_address.sin_addr));
+
+    sendv_all(socketfd, buffers, count, flags);
+}
+
+size_t TCPConnection::recv_into(uint8_t* buffer, size_t capacity, int flags) {
+
+    if (socketfd == -1) {
+        throw SocketException("Can't receive message in a connection that is closed");
     }
+    if (capacity == 0) return 0;
 
-    server_address.sin_port = ::htons(port);
-    server_length = sizeof(server_address);
+    size_t result = recv_some(socketfd, buffer, capacity, flags);
+    if (result == 0) {
+        throw ClosedConnection("Client closed connection.");
+    }
 
-    while (bytes_sent < msg_length) {
+    return result;
+}
 
-        const char* message_left = cMessage + bytes_sent;
+// TCPConnection não sabe se está em modo não bloqueante, então EAGAIN é
+// sempre retornado como Errc::would_block.
 
-        int result = ::sendto(socketfd, message_left, bytes_left, flags | MSG_NOSIGNAL, 
-                             (sockaddr*) &server_address, server_length);
-        if (result == -1) {
-            throw ConnectionException("Could not send message. Error: " 
-                + std::string(strerror(errno)));
-        }
+Result<size_t> TCPConnection::try_send(const uint8_t* message, size_t length, int flags) noexcept {
 
-        bytes_left -= result;
-        bytes_sent += result;
+    if (socketfd == -1) return Result<size_t>(Errc::not_connected);
+
+    int error;
+    size_t bytes_sent = raw_send(socketfd, message, length, flags, error);
+    return sent_result(bytes_sent, error, true);
+}
+
+Result<size_t> TCPConnection::try_sendv(const iovec* buffers, int count, int flags) noexcept {
+
+    if (socketfd == -1) return Result<size_t>(Errc::not_connected);
+
+    int error;
+    size_t bytes_sent = raw_sendv(socketfd, buffers, count, flags, error);
+    return sent_result(bytes_sent, error, true);
+}
 
+Result<size_t> TCPConnection::try_recv_into(uint8_t* buffer, size_t capacity, int flags) noexcept {
+
+    if (socketfd == -1) return Result<size_t>(Errc::not_connected);
+    if (capacity == 0) return (size_t) 0;
+
+    return received_result(::recv(socketfd, buffer, capacity, flags), true);
+}
+
+uint64_t TCPConnection::send_file(int fd, off_t offset, uint64_t count) {
+
+    if (socketfd == -1) {
+        throw SocketException("Can't send file from a connection that is closed");
     }
 
+    return check_sent_file(try_send_file(fd, offset, count));
 }
 
-UDPRecv UDPSocket::recvfrom(uint64_t maxlen, int flags) {
-    
-    sockaddr_in client_address;
-    hostent* client_info;
-    socklen_t clientLength = sizeof(client_address);
+Result<uint64_t> TCPConnection::try_send_file(int fd, off_t offset, uint64_t count) noexcept {
 
-    char buffer[maxlen+1];
-    int result = ::recvfrom(socketfd, buffer, maxlen, flags, (sockaddr *) &client_address, &clientLength);
+    if (socketfd == -1) return Result<uint64_t>(Errc::not_connected);
+
+    int error;
+    uint64_t bytes_sent = raw_sendfile(socketfd, fd, offset, count, error);
+    return sent_result(bytes_sent, error, true);
+}
+
+std::string TCPConnection::recv(uint64_t maxlen, int flags) {
+
+    return receive_string(maxlen, [this, flags](uint8_t* buffer, size_t capacity) {
+        return recv_into(buffer, capacity, flags);
+    });
+}
+
+BufferHandle TCPConnection::recv(BufferPool& pool, int flags) {
+
+    BufferHandle buffer = pool.acquire();
+    buffer.resize(recv_into(buffer.data(), buffer.capacity(), flags));
+    return buffer;
+}
+
+void TCPConnection::close() {
+
+    if (socketfd == -1) return;
+
+    int result = ::close(socketfd);
+    socketfd = -1;
 
     if (result == -1) {
-        throw ConnectionException("Could not receive message. Error: " 
-            + std::string(strerror(errno)));
+        throw SocketException("Could not close socket. Error: " + 
+            std::string(strerror(errno)));
     }
-    buffer[result] = '\0';
+}
+
+int TCPConnection::release() {
+    int socket = socketfd;
+    socketfd = -1;
+    return socket;
+}
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ *                  CONNECTIONFREELIST
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-    std::string host_name("Nao importa mais");
-    std::string host_address(::inet_ntoa(client_address.sin_addr));
-    std::string message(buffer);
+ConnectionFreeList::ConnectionFreeList(size_t preallocate) {
+
+    free_connections.reserve(preallocate);
+    for (size_t i = 0; i < preallocate; i++) {
+        storage.emplace_back();
+        free_connections.push_back(&storage.back());
+    }
+}
+
+TCPConnection* ConnectionFreeList::acquire() {
+
+    if (free_connections.empty()) {
+        storage.emplace_back();
+        return &storage.back();
+    }
+
+    TCPConnection* connection = free_connections.back();
+    free_connections.pop_back();
+    return connection;
+}
 
-    int port = ::ntohs(client_address.sin_port);
+void ConnectionFreeList::release(TCPConnection* connection) {
 
-    return UDPRecv(host_name, host_address, message, port);
+    try {
+        connection->close();
+    }
+    catch (const SocketException& e) {
+        // O descritor é liberado pelo kernel mesmo quando close() falha.
+    }
+
+    free_connections.push_back(connection);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ *                  BUFFERPOOL
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/// Lista central e memória de um BufferPool. É compartilhada apenas para que
+/// as free-lists das threads saibam, por um weak_ptr, se o pool ainda existe
+/// quando a thread termina; ela não prolonga a vida dos slabs, que continuam
+/// apontando para o BufferPool.
+struct Socket::BufferPoolCentral {
+
+    ~BufferPoolCentral() {
+        for (size_t i = 0; i < chunks.size(); i++) free(chunks[i]);
+    }
+
+    /// Protege head, count e chunks.
+    std::mutex mutex;
+
+    /// Slabs livres que não estão em nenhuma free-list de thread.
+    BufferSlab* head = NULL;
+    size_t count = 0;
+
+    /// Blocos de memória alocados, cada um com slabs_per_chunk slabs.
+    std::vector<void*> chunks;
+
+    /// Número de slabs alocados.
+    std::atomic<size_t> allocated;
+
+    /// Tamanho dos dados de cada slab, múltiplo de CACHE_LINE.
+    size_t slab_size;
+
+    /// Distância entre dois slabs consecutivos de um bloco.
+    size_t stride;
 
+    size_t slabs_per_chunk;
+    size_t max_slabs;
+};
 
+/// Identificador do próximo BufferPool criado.
+static std::atomic<uint64_t> next_pool_id(1);
+
+const size_t BufferPool::CACHE_LINE;
+
+BufferHandle& BufferHandle::operator=(const BufferHandle& other) noexcept {
+
+    // Conta a nova referência antes de soltar a atual, caso sejam o mesmo slab.
+    BufferSlab* acquired = other.slab;
+    if (acquired) acquired->references.fetch_add(1, std::memory_order_relaxed);
+    reset();
+    slab = acquired;
+    return *this;
+}
+
+BufferHandle& BufferHandle::operator=(BufferHandle&& other) noexcept {
+
+    if (this != &other) {
+        reset();
+        slab = other.slab;
+        other.slab = NULL;
+    }
+    return *this;
+}
+
+void BufferHandle::resize(size_t length) {
+
+    if (!slab || length > slab->capacity) {
+        throw SocketException("Buffer length " + std::to_string(length)
+            + " exceeds its capacity of " + std::to_string(capacity()));
+    }
+    slab->length = length;
 }
 
+void BufferHandle::reset() noexcept {
+
+    if (!slab) return;
+
+    BufferSlab* released = slab;
+    slab = NULL;
+
+    // acq_rel: as escritas de todas as threads que usaram o buffer ficam
+    // visíveis para a próxima thread que o retirar do pool.
+    if (released->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        released->pool->release(released);
+    }
+}
+
+BufferPool::BufferPool(size_t slab_size, size_t slabs_per_chunk, size_t max_slabs) :
+    id(next_pool_id++), central(std::make_shared<BufferPoolCentral>()) {
+
+    if (slab_size == 0) {
+        throw SocketException("Buffer pool slabs must hold at least one byte");
+    }
+    if (slabs_per_chunk == 0) slabs_per_chunk = 1;
+
+    // Os dados de cada slab começam e terminam em uma fronteira de linha de
+    // cache, e o cabeçalho ocupa a linha anterior.
+    static_assert(sizeof(BufferSlab) <= CACHE_LINE, "BufferSlab must fit in a cache line");
+    this->slab_size = (slab_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+
+    central->allocated = 0;
+    central->slab_size = this->slab_size;
+    central->stride = CACHE_LINE + this->slab_size;
+    central->slabs_per_chunk = slabs_per_chunk;
+    central->max_slabs = max_slabs;
+
+    local_limit = slabs_per_chunk;
+}
+
+BufferPool::~BufferPool() {}
+
+BufferHandle BufferPool::acquire() {
+
+    BufferHandle buffer = try_acquire();
+    if (!buffer) {
+        throw SocketException("Buffer pool exhausted: all " + std::to_string(get_allocated())
+            + " buffers are in use");
+    }
+    return buffer;
+}
+
+BufferHandle BufferPool::try_acquire() {
+
+    LocalList& local = local_list();
+
+    if (!local.head) {
+
+        std::lock_guard<std::mutex> lock(central->mutex);
+
+        if (central->count == 0) {
+
+            size_t count = central->slabs_per_chunk;
+            if (central->max_slabs > 0) {
+                size_t remaining = central->max_slabs - central->allocated;
+                if (remaining < count) count = remaining;
+            }
+
+            if (count > 0) {
+                void* chunk = NULL;
+                if (::posix_memalign(&chunk, CACHE_LINE, central->stride * count) != 0) {
+                    throw std::bad_alloc();
+                }
+                central->chunks.push_back(chunk);
+
+                for (size_t i = 0; i < count; i++) {
+                    uint8_t* start = (uint8_t *) chunk + i * central->stride;
+                    BufferSlab* slab = new (start) BufferSlab();
+                    slab->pool = this;
+                    slab->data = start + CACHE_LINE;
+                    slab->capacity = slab_size;
+                    slab->next = central->head;
+                    central->head = slab;
+                }
+                central->count += count;
+                central->allocated += count;
+            }
+        }
+
+        // Leva metade do limite da thread, para que a próxima devolução não
+        // transborde logo de volta para a lista central.
+        size_t batch = local_limit / 2 > 0 ? local_limit / 2 : 1;
+        while (central->head && local.count < batch) {
+            BufferSlab* slab = central->head;
+            central->head = slab->next;
+            central->count--;
+            slab->next = local.head;
+            local.head = slab;
+            local.count++;
+        }
+
+        if (!local.head) return BufferHandle();
+    }
+
+    BufferSlab* slab = local.head;
+    local.head = slab->next;
+    local.count--;
+
+    slab->next = NULL;
+    slab->length = 0;
+    slab->truncated = false;
+    slab->references.store(1, std::memory_order_relaxed);
+
+    return BufferHandle(slab);
+}
+
+size_t BufferPool::get_allocated() const {
+    return central->allocated;
+}
+
+void BufferPool::release(BufferSlab* slab) noexcept {
+
+    LocalList* local = NULL;
+    try {
+        local = &local_list();
+    }
+    catch (const std::bad_alloc& e) {
+        // Sem memória para a free-list da thread, devolve direto à central.
+        std::lock_guard<std::mutex> lock(central->mutex);
+        slab->next = central->head;
+        central->head = slab;
+        central->count++;
+        return;
+    }
+
+    slab->next = local->head;
+    local->head = slab;
+    local->count++;
+
+    if (local->count <= local_limit) return;
+
+    // Devolve metade à lista central, para que threads que só recebem
+    // encontrem slabs liberados por threads que só consomem.
+    std::lock_guard<std::mutex> lock(central->mutex);
+    while (local->count > local_limit / 2) {
+        BufferSlab* returned = local->head;
+        local->head = returned->next;
+        local->count--;
+        returned->next = central->head;
+        central->head = returned;
+        central->count++;
+    }
+}
+
+BufferPool::LocalList& BufferPool::local_list() {
+
+    static thread_local ThreadLists thread_lists;
+    std::vector<LocalList>& lists = thread_lists.lists;
+
+    for (size_t i = 0; i < lists.size(); i++) {
+        if (lists[i].pool_id == id) return lists[i];
+    }
+
+    // Descarta as listas de pools já destruídos; os slabs delas não existem mais.
+    for (size_t i = 0; i < lists.size();) {
+        if (lists[i].central.expired()) {
+            lists[i] = lists.back();
+            lists.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
+
+    LocalList list;
+    list.pool_id = id;
+    list.central = central;
+    list.head = NULL;
+    list.count = 0;
+    lists.push_back(list);
+
+    return lists.back();
+}
+
+BufferPool::ThreadLists::~ThreadLists() {
+
+    for (size_t i = 0; i < lists.size(); i++) {
+
+        std::shared_ptr<BufferPoolCentral> central = lists[i].central.lock();
+        if (!central) continue;
+
+        std::lock_guard<std::mutex> lock(central->mutex);
+        while (lists[i].head) {
+            BufferSlab* slab = lists[i].head;
+            lists[i].head = slab->next;
+            slab->next = central->head;
+            central->head = slab;
+            central->count++;
+        }
+    }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ *                  ENDPOINT
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+Endpoint::Endpoint() {
+    memset(&address, 0, sizeof(address));
+    address.ss_family = AF_INET;
+}
+
+Endpoint::Endpoint(const sockaddr_in& address) {
+    memset(&this->address, 0, sizeof(this->address));
+    memcpy(&this->address, &address, sizeof(address));
+}
+
+Endpoint::Endpoint(const sockaddr_in6& address) {
+    memset(&this->address, 0, sizeof(this->address));
+    memcpy(&this->address, &address, sizeof(address));
+}
+
+Endpoint Endpoint::resolve(const std::string& address, uint32_t port, int family) {
+
+    sockaddr_storage resolved;
+    memset(&resolved, 0, sizeof(resolved));
+
+    // Endereços IP não precisam de consulta ao DNS.
+    sockaddr_in* ipv4 = (sockaddr_in *) &resolved;
+    if (family != AF_INET6 && ::inet_pton(AF_INET, address.c_str(), &ipv4->sin_addr) == 1) {
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons(port);
+        return Endpoint(resolved);
+    }
+
+    sockaddr_in6* ipv6 = (sockaddr_in6 *) &resolved;
+    if (family != AF_INET && ::inet_pton(AF_INET6, address.c_str(), &ipv6->sin6_addr) == 1) {
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons(port);
+        return Endpoint(resolved);
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    // Ao contrário de gethostbyname(), getaddrinfo() pode ser usada por várias threads.
+    addrinfo* results;
+    int result = getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &results);
+    if (result != 0) {
+        throw ConnectionException("No such host as " + address + ". Error: "
+            + std::string(gai_strerror(result)));
+    }
+
+    memcpy(&resolved, results->ai_addr, results->ai_addrlen);
+    freeaddrinfo(results);
+
+    return Endpoint(resolved);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ *                  RESOLVER
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+Resolver::Resolver(std::chrono::milliseconds ttl, size_t max_entries) :
+    ttl(ttl), max_entries(max_entries > 0 ? max_entries : 1) {}
+
+Endpoint Resolver::resolve(const std::string& address, uint32_t port, int family) {
+
+    std::string key = std::to_string(family) + "/" + address + ":" + std::to_string(port);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.expires > now) return it->second.endpoint;
+    }
+
+    // A consulta ao DNS é feita sem segurar o mutex para não bloquear as
+    // outras threads; duas threads podem resolver o mesmo destino ao mesmo tempo.
+    Entry entry;
+    entry.endpoint = Endpoint::resolve(address, port, family);
+    entry.expires = now + ttl;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (entries.size() >= max_entries && !entries.count(key)) {
+        for (auto it = entries.begin(); it != entries.end(); ) {
+            if (it->second.expires <= now) it = entries.erase(it);
+            else ++it;
+        }
+        if (entries.size() >= max_entries) entries.clear();
+    }
+
+    entries[key] = entry;
+    return entry.endpoint;
+}
+
+void Resolver::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
+
+Resolver& Resolver::shared() {
+    static Resolver resolver;
+    return resolver;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ *                  UDPRECV
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+UDPRecv::UDPRecv(const std::string& name, const std::string& address, const std::string& msg, uint32_t port) :
+                 name(name), address(address), msg(msg), port(port) {
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ *                  DATAGRAM
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+const size_t Datagram::MAX_PAYLOAD;
+
+Datagram::Datagram(size_t capacity) : buffer(capacity) {
+    memset(&peer, 0, sizeof(peer));
+    peer.ss_family = AF_INET;
+}
+
+void Datagram::reserve(size_t capacity) {
+    buffer.resize(capacity);
+    length = 0;
+    truncated = false;
+}
+
+void Datagram::resize(size_t length) {
+
+    if (length > buffer.size()) {
+        throw SocketException("Datagram length " + std::to_string(length) 
+            + " exceeds its capacity of " + std::to_string(buffer.size()) + " bytes");
+    }
+
+    this->length = length;
+    truncated = false;
+}
+
+void Datagram::assign(const uint8_t* message, size_t length) {
+    if (length > buffer.size()) buffer.resize(length);
+    memcpy(buffer.data(), message, length);
+    this->length = length;
+    truncated = false;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ *                  UDPSOCKET
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+UDPSocket::UDPSocket(int flags, int family) : BaseSocket(SOCK_DGRAM, flags, family) {
+
+int broadcast_enable = 1;
+int ret = setsockopt(socketfd, SOL_SOCKET, SO_BROADCAST, 
+    &broadcast_enable, sizeof(broadcast_enable));
+}
+
+void UDPSocket::sendto(const std::string& address, uint32_t port, 
+    const std::string& message, int flags) {
+
+    // Uma socket dual-stack envia a destinos de qualquer família.
+    int family = get_family() == AF_INET6 ? AF_UNSPEC : AF_INET;
+    sendto(Resolver::shared().resolve(address, port, family), message, flags);
+
+}
+
+void UDPSocket::sendto(const Endpoint& endpoint, const std::string& message, int flags) {
+    sendto(endpoint, (const uint8_t *) message.data(), message.length(), flags);
+}
+
+void UDPSocket::sendto(const Endpoint& endpoint, const uint8_t* message, size_t length, int flags) {
+
+    Result<size_t> result = try_sendto(endpoint, message, length, flags);
+
+    if (result.error() == Errc::would_block || result.error() == Errc::timed_out) {
+        throw WouldBlock("Send buffer is full.");
+    }
+    if (!result.ok()) {
+        throw ConnectionException("Could not send message. Error: " 
+            + std::string(result.message()));
+    }
+
+}
+
+Result<size_t> UDPSocket::try_sendto(const Endpoint& endpoint, const uint8_t* message,
+    size_t length, int flags) noexcept {
+
+    // Datagramas são enviados por inteiro ou não são enviados.
+    ssize_t result = ::sendto(socketfd, message, length, flags | MSG_NOSIGNAL,
+                              (const sockaddr *) &endpoint.get_sockaddr(), endpoint.get_length());
+
+    if (result == -1) return Result<size_t>(errc_from_errno(errno, nonblocking), errno);
+    return (size_t) result;
+
+}
+
+UDPRecv UDPSocket::recvfrom(uint64_t maxlen, int flags) {
+
+    Datagram datagram(maxlen);
+    recvfrom(datagram, flags);
+
+    std::string host_name("Nao importa mais");
+    return UDPRecv(host_name, datagram.get_address(), datagram.get_msg(), datagram.get_port());
+
+}
+
+size_t UDPSocket::recvfrom(Datagram& datagram, int flags) {
+
+    Result<size_t> result = try_recvfrom(datagram, flags);
+
+    if (result.error() == Errc::would_block || result.error() == Errc::timed_out) {
+        throw WouldBlock("No datagram available to receive.");
+    }
+    if (!result.ok()) {
+        throw ConnectionException("Could not receive message. Error: " 
+            + std::string(result.message()));
+    }
+
+    return result.value();
+
+}
+
+BufferHandle UDPSocket::recvfrom(BufferPool& pool, Endpoint* sender, int flags) {
+
+    BufferHandle buffer = pool.acquire();
+
+    sockaddr_storage peer;
+    socklen_t peer_length = sizeof(peer);
+
+    // Com MSG_TRUNC o retorno é o tamanho real do datagrama, como em
+    // try_recvfrom(Datagram&).
+    ssize_t result = ::recvfrom(socketfd, buffer.data(), buffer.capacity(), flags | MSG_TRUNC,
+                                (sockaddr *) &peer, &peer_length);
+
+    if (result == -1) {
+        int error = errno;
+        Errc code = errc_from_errno(error, nonblocking);
+        if (code == Errc::would_block || code == Errc::timed_out) {
+            throw WouldBlock("No datagram available to receive.");
+        }
+        throw ConnectionException("Could not receive message. Error: "
+            + std::string(error_message(code, error)));
+    }
+
+    buffer.slab->truncated = (size_t) result > buffer.capacity();
+    buffer.resize(buffer.slab->truncated ? buffer.capacity() : result);
+    if (sender) *sender = Endpoint(peer);
+
+    return buffer;
+
+}
+
+Result<size_t> UDPSocket::try_recvfrom(Datagram& datagram, int flags) noexcept {
+
+    socklen_t peer_length = sizeof(datagram.peer);
+
+    // Com MSG_TRUNC o retorno é o tamanho real do datagrama, mesmo que
+    // maior que o buffer, o que permite detectar truncamento.
+    ssize_t result = ::recvfrom(socketfd, datagram.buffer.data(), datagram.buffer.size(),
+                                flags | MSG_TRUNC, (sockaddr *) &datagram.peer, &peer_length);
+
+    if (result == -1) return Result<size_t>(errc_from_errno(errno, nonblocking), errno);
+
+    datagram.truncated = (size_t) result > datagram.buffer.size();
+    datagram.length = datagram.truncated ? datagram.buffer.size() : result;
+
+    return datagram.length;
+
+}
+
+void UDPSocket::prepare_batch(const std::vector<Datagram>& datagrams, size_t first, size_t count) {
+
+    if (batch_headers.size() < count) {
+        batch_headers.resize(count);
+        batch_iovecs.resize(count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+
+        const Datagram& datagram = datagrams[first + i];
+        mmsghdr& header = batch_headers[i];
+
+        // Os buffers pertencem aos datagramas; const_cast apenas adapta à
+        // interface do kernel, que usa a mesma estrutura para envio e recebimento.
+        batch_iovecs[i].iov_base = const_cast<uint8_t*>(datagram.buffer.data());
+        batch_iovecs[i].iov_len = datagram.buffer.size();
+
+        memset(&header, 0, sizeof(mmsghdr));
+        // O kernel aceita um tamanho maior que o da família no envio e
+        // precisa do tamanho completo no recebimento.
+        header.msg_hdr.msg_name = const_cast<sockaddr_storage*>(&datagram.peer);
+        header.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        header.msg_hdr.msg_iov = &batch_iovecs[i];
+        header.msg_hdr.msg_iovlen = 1;
+    }
+}
+
+size_t UDPSocket::recv_batch(std::vector<Datagram>& datagrams, size_t max, int flags) {
+
+    if (max > datagrams.size()) max = datagrams.size();
+    if (max > UIO_MAXIOV) max = UIO_MAXIOV;
+    if (max == 0) return 0;
+
+    prepare_batch(datagrams, 0, max);
+
+    int result = ::recvmmsg(socketfd, batch_headers.data(), max, flags | MSG_WAITFORONE, NULL);
+
+    if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        throw WouldBlock("No datagram available to receive.");
+    }
+    if (result == -1) {
+        throw ConnectionException("Could not receive messages. Error: " 
+            + std::string(strerror(errno)));
+    }
+
+    for (int i = 0; i < result; i++) {
+        Datagram& datagram = datagrams[i];
+        datagram.length = batch_headers[i].msg_len;
+        datagram.truncated = (batch_headers[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+    }
+
+    return result;
+
+}
+
+size_t UDPSocket::send_batch(const std::vector<Datagram>& datagrams, size_t count, int flags) {
+
+    if (count > datagrams.size()) count = datagrams.size();
+
+    size_t total_sent = 0;
+
+    while (total_sent < count) {
+
+        size_t batch = count - total_sent;
+        if (batch > UIO_MAXIOV) batch = UIO_MAXIOV;
+
+        prepare_batch(datagrams, total_sent, batch);
+
+        // Envia apenas os bytes válidos de cada datagrama.
+        for (size_t i = 0; i < batch; i++) {
+            batch_iovecs[i].iov_len = datagrams[total_sent + i].length;
+        }
+
+        int result = ::sendmmsg(socketfd, batch_headers.data(), batch, flags | MSG_NOSIGNAL);
+
+        if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (total_sent > 0) return total_sent;
+            throw WouldBlock("Send buffer is full.");
+        }
+        if (result == -1) {
+            throw ConnectionException("Could not send messages. Sent " + std::to_string(total_sent)
+                + " of " + std::to_string(count) + ". Error: " + std::string(strerror(errno)));
+        }
+
+        total_sent += result;
+    }
+
+    return total_sent;
+
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ *                  UNIXSOCKET
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/// Endereço de uma UnixSocket sem caminho, usado pelas pontas de socketpair().
+static sockaddr_storage unnamed_unix_address() {
+
+    sockaddr_storage address;
+    memset(&address, 0, sizeof(address));
+    address.ss_family = AF_UNIX;
+
+    return address;
+}
+
+UnixSocket::UnixSocket(int type) : BaseSocket(type, 0, AF_UNIX), type(type) {}
+
+UnixSocket::UnixSocket(int socket, int type) :
+    BaseSocket(socket, type, unnamed_unix_address(), sizeof(sa_family_t)), type(type),
+    is_connected(true) {}
+
+UnixSocket::~UnixSocket() {
+    if (!bound_path.empty()) ::unlink(bound_path.c_str());
+}
+
+std::pair<std::shared_ptr<UnixSocket>, std::shared_ptr<UnixSocket>> UnixSocket::pair(int type) {
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, type | SOCK_CLOEXEC, 0, fds) == -1) {
+        throw SocketException("Could not create socket pair. Error: " + std::string(strerror(errno)));
+    }
+
+    std::shared_ptr<UnixSocket> first, second;
+    try {
+        first = std::make_shared<UnixSocket>(fds[0], type);
+    }
+    catch (...) {
+        ::close(fds[0]);
+        ::close(fds[1]);
+        throw;
+    }
+    try {
+        second = std::make_shared<UnixSocket>(fds[1], type);
+    }
+    catch (...) {
+        ::close(fds[1]);
+        throw;
+    }
+
+    return std::make_pair(first, second);
+
+}
+
+socklen_t UnixSocket::make_address(const std::string& path, sockaddr_un& address) {
+
+    if (path.empty()) {
+        throw SocketException("Unix socket path can not be empty");
+    }
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw SocketException("Unix socket path is too long: " + path);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.data(), path.size());
+
+    // No namespace abstrato o nome começa com um byte nulo e não tem
+    // terminador, então o tamanho do endereço inclui apenas o nome.
+    if (path[0] == '@') address.sun_path[0] = '\0';
+    else return sizeof(address);
+
+    return offsetof(sockaddr_un, sun_path) + path.size();
+
+}
+
+void UnixSocket::bind(const std::string& path, bool remove_existing) {
+
+    if (is_bound) {
+        throw ConnectionException("Socket is already bound to a path");
+    }
+
+    sockaddr_un address;
+    socklen_t length = make_address(path, address);
+    bool abstract = path[0] == '@';
+
+    // Um arquivo deixado por um processo anterior causa "Address already in use".
+    if (remove_existing && !abstract) ::unlink(path.c_str());
+
+    if (::bind(socketfd, (const sockaddr *) &address, length) == -1) {
+        throw ConnectionException("Could not bind to path " + path
+            + ". Error: " + std::string(strerror(errno)));
+    }
+
+    is_bound = true;
+    if (!abstract) bound_path = path;
+
+}
+
+void UnixSocket::listen(uint32_t backlog) {
+
+    if (type != SOCK_STREAM) {
+        throw SocketException("Only SOCK_STREAM unix sockets can listen for connections");
+    }
+    if (!is_bound) {
+        throw SocketException("Can not listen when socket is not bound to any path");
+    }
+    if (is_listening) {
+        throw SocketException("Socket is already listening incoming connections");
+    }
+
+    if (::listen(socketfd, backlog) == -1) {
+        throw ConnectionException("Could not listen on unix socket. Error: "
+            + std::string(strerror(errno)));
+    }
+
+    is_listening = true;
+
+}
+
+std::shared_ptr<UnixSocket> UnixSocket::accept() {
+
+    if (!is_listening) {
+        throw SocketException("Socket is not listening to incoming connections to accept one");
+    }
+
+    int clientfd = ::accept4(socketfd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (clientfd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        throw WouldBlock("No pending connections to accept.");
+    }
+    if (clientfd == -1) {
+        throw ConnectionException("Error while accepting a connection. Error: "
+            + std::string(strerror(errno)));
+    }
+
+    try {
+        return std::make_shared<UnixSocket>(clientfd, type);
+    }
+    catch (...) {
+        ::close(clientfd);
+        throw;
+    }
+
+}
+
+void UnixSocket::connect(const std::string& path) {
+
+    if (is_listening) {
+        throw SocketException("Socket is already listening incoming connections");
+    }
+    if (is_connected) {
+        throw SocketException("Socket is already connected to a path");
+    }
+
+    sockaddr_un address;
+    socklen_t length = make_address(path, address);
+
+    if (::connect(socketfd, (const sockaddr *) &address, length) == -1) {
+        throw ConnectionException("Could not connect to path " + path
+            + ". Error: " + std::string(strerror(errno)));
+    }
+
+    is_connected = true;
+
+}
+
+void UnixSocket::send(const uint8_t* message, size_t length, int flags) {
+
+    if (!is_connected) {
+        throw SocketException("Socket is not connected to any path");
+    }
+
+    // Um datagrama é enviado inteiro ou não é enviado, então não há repetição.
+    if (type == SOCK_STREAM) {
+        send_all(socketfd, message, length, flags);
+        return;
+    }
+
+    ssize_t result = ::send(socketfd, message, length, flags | MSG_NOSIGNAL);
+    check_sent(result == -1 ? 0 : result, length, result == -1 ? errno : 0);
+
+}
+
+void UnixSocket::send(const std::string& message, int flags) {
+    send((const uint8_t *) message.data(), message.size(), flags);
+}
+
+size_t UnixSocket::recv_into(uint8_t* buffer, size_t capacity, int flags) {
+
+    // Uma socket SOCK_DGRAM vinculada recebe mensagens sem estar conectada.
+    if (!is_connected && !(type == SOCK_DGRAM && is_bound)) {
+        throw SocketException("Socket is not connected to any path");
+    }
+
+    size_t bytes_received = recv_some(socketfd, buffer, capacity, flags);
+
+    // Datagramas vazios são válidos; em SOCK_STREAM, 0 indica o fim da conexão.
+    // Como em TCPSocket, a socket continua conectada para responder depois
+    // de um shutdown(SHUT_WR) do outro lado.
+    if (bytes_received == 0 && type == SOCK_STREAM && capacity > 0) {
+        throw ClosedConnection("Client closed connection.");
+    }
+
+    return bytes_received;
+
+}
+
+std::string UnixSocket::recv(uint64_t maxlen, int flags) {
+
+    return receive_string(maxlen, [this, flags](uint8_t* buffer, size_t capacity) {
+        return recv_into(buffer, capacity, flags);
+    });
+
+}
+
+void UnixSocket::sendto(const std::string& path, const uint8_t* message, size_t length, int flags) {
+
+    if (type != SOCK_DGRAM) {
+        throw SocketException("sendto() requires a SOCK_DGRAM unix socket");
+    }
+
+    sockaddr_un address;
+    socklen_t address_length = make_address(path, address);
+
+    ssize_t result = ::sendto(socketfd, message, length, flags | MSG_NOSIGNAL,
+        (const sockaddr *) &address, address_length);
+    check_sent(result == -1 ? 0 : result, length, result == -1 ? errno : 0);
+
+}
+
+void UnixSocket::sendto(const std::string& path, const std::string& message, int flags) {
+    sendto(path, (const uint8_t *) message.data(), message.size(), flags);
+}
+
+size_t UnixSocket::recvfrom(uint8_t* buffer, size_t capacity, std::string* sender, int flags) {
+
+    sockaddr_un address;
+    socklen_t address_length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+
+    ssize_t result = ::recvfrom(socketfd, buffer, capacity, flags,
+        (sockaddr *) &address, &address_length);
+    size_t bytes_received = check_received(result);
+
+    if (sender) {
+        size_t path_length = 0;
+        if (address_length > offsetof(sockaddr_un, sun_path)) {
+            path_length = address_length - offsetof(sockaddr_un, sun_path);
+        }
+
+        // Caminhos comuns são terminados por um byte nulo; nomes abstratos
+        // começam com um e são devolvidos com o prefixo '@'.
+        if (path_length > 0 && address.sun_path[0] == '\0') {
+            *sender = "@" + std::string(address.sun_path + 1, path_length - 1);
+        }
+        else {
+            *sender = std::string(address.sun_path, strnlen(address.sun_path, path_length));
+        }
+    }
+
+    return bytes_received;
+
+}
+
+void UnixSocket::send_fds(const int* fds, size_t count, const uint8_t* message, size_t length, int flags) {
+
+    if (count == 0 || count > MAX_FDS) {
+        throw SocketException("Number of file descriptors must be between 1 and "
+            + std::to_string(MAX_FDS));
+    }
+    if (type == SOCK_STREAM && length == 0) {
+        throw SocketException("At least one byte must be sent with the file descriptors");
+    }
+
+    std::vector<uint8_t> control(CMSG_SPACE(count * sizeof(int)), 0);
+
+    iovec buffer;
+    buffer.iov_base = const_cast<uint8_t*>(message);
+    buffer.iov_len = length;
+
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &buffer;
+    header.msg_iovlen = 1;
+    header.msg_control = control.data();
+    header.msg_controllen = control.size();
+
+    cmsghdr* rights = CMSG_FIRSTHDR(&header);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(rights), fds, count * sizeof(int));
+
+    ssize_t result;
+    do {
+        result = ::sendmsg(socketfd, &header, flags | MSG_NOSIGNAL);
+    } while (result == -1 && errno == EINTR);
+
+    // Os descritores acompanham o primeiro byte; o restante da mensagem é
+    // enviado sem eles.
+    size_t bytes_sent = result == -1 ? 0 : result;
+    if (bytes_sent > 0 && bytes_sent < length && type == SOCK_STREAM) {
+        send_all(socketfd, message + bytes_sent, length - bytes_sent, flags);
+        bytes_sent = length;
+    }
+
+    check_sent(bytes_sent, length, result == -1 ? errno : 0);
+
+}
+
+void UnixSocket::send_fds(const std::vector<int>& fds) {
+    uint8_t byte = 0;
+    send_fds(fds.data(), fds.size(), &byte, 1);
+}
+
+size_t UnixSocket::recv_fds(std::vector<int>& fds, uint8_t* buffer, size_t capacity,
+    size_t max_fds, int flags) {
+
+    if (max_fds == 0 || max_fds > MAX_FDS) max_fds = MAX_FDS;
+
+    fds.clear();
+
+    std::vector<uint8_t> control(CMSG_SPACE(max_fds * sizeof(int)), 0);
+
+    iovec data;
+    data.iov_base = buffer;
+    data.iov_len = capacity;
+
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control.data();
+    header.msg_controllen = control.size();
+
+    size_t bytes_received = check_received(::recvmsg(socketfd, &header, flags | MSG_CMSG_CLOEXEC));
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        size_t first = fds.size();
+        fds.resize(first + count);
+        memcpy(&fds[first], CMSG_DATA(cmsg), count * sizeof(int));
+    }
+
+    // Descritores que não couberam em control foram fechados pelo kernel;
+    // os que chegaram também são fechados para não vazarem.
+    if (header.msg_flags & MSG_CTRUNC) {
+        for (size_t i = 0; i < fds.size(); i++) ::close(fds[i]);
+        fds.clear();
+        throw ConnectionException("Received more than " + std::to_string(max_fds)
+            + " file descriptors; all of them were closed");
+    }
+
+    if (bytes_received == 0 && type == SOCK_STREAM && capacity > 0 && fds.empty()) {
+        throw ClosedConnection("Client closed connection.");
+    }
+
+    return bytes_received;
+
+}
+
+void UnixSocket::close() {
+
+    BaseSocket::close();
+
+    if (!bound_path.empty()) ::unlink(bound_path.c_str());
+    bound_path.clear();
+
+    is_connected = false;
+    is_listening = false;
+
+}
@@ -12,7 +12,10 @@
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -21,6 +24,12 @@
 #include <cstring>
 #include <string>
 #include <memory>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 
 namespace Socket {
  
@@ -39,39 +48,514 @@ class ClosedConnection : public ConnectionException {
         ClosedConnection(const std::string& error) : ConnectionException(error) {}
 };
 
-/** Classe base de um wrapper de um socket padrão IPv4.
+/// Lançada quando uma operação em uma socket não bloqueante não pode ser
+/// completada imediatamente (EAGAIN/EWOULDBLOCK).
+class WouldBlock : public ConnectionException {
+    public:
+        WouldBlock(const std::string& error) : ConnectionException(error) {}
+};
+
+/// Categoria de erro retornada pelas variantes try_ das operações de I/O,
+/// que não lançam exceções nem formatam mensagens.
+enum class Errc {
+    /// Operação concluída com sucesso.
+    none,
+
+    /// Socket não bloqueante sem dados ou sem espaço (EAGAIN/EWOULDBLOCK).
+    would_block,
+
+    /// O outro lado encerrou a conexão.
+    closed,
+
+    /// Tempo limite de set_timeout() esgotado em uma socket bloqueante.
+    timed_out,
+
+    /// Chamada interrompida por um sinal (EINTR).
+    interrupted,
+
+    /// Socket não conectada, não ouvindo ou já fechada.
+    not_connected,
+
+    /// Conexão reiniciada pelo outro lado (ECONNRESET, EPIPE).
+    connection_reset,
+
+    /// Conexão recusada pelo outro lado (ECONNREFUSED).
+    connection_refused,
+
+    /// Mensagem maior que o permitido pelo protocolo (EMSGSIZE).
+    message_size,
+
+    /// Falta de descritores, memória ou buffers no kernel.
+    no_resources,
+
+    /// Endereço não pôde ser resolvido pelo getaddrinfo().
+    not_found,
+
+    /// Uma opção herdada não pôde ser aplicada à conexão aceita, que foi
+    /// fechada. Afeta apenas essa conexão; o errno indica o motivo.
+    option_failed,
+
+    /// Outro erro do sistema, consulte o errno.
+    system
+};
+
+/// Converte o errno de uma operação de I/O em um Errc.
+/// @param error       Valor de errno.
+/// @param nonblocking Se a socket está em modo não bloqueante, para distinguir
+///                    EAGAIN de um tempo limite esgotado.
+Errc errc_from_errno(int error, bool nonblocking = true) noexcept;
+
+/// Indica se um erro de accept() afeta apenas a conexão que estava sendo
+/// aceita, como uma conexão abortada ou os erros de rede que accept(2) manda
+/// tratar como EAGAIN. Nesses casos a próxima conexão pendente pode ser
+/// aceita em seguida.
+/// @param error Valor de errno.
+bool is_transient_accept_error(int error) noexcept;
+
+/// Descrição de um erro, sem alocar memória.
+/// @param code      Categoria do erro.
+/// @param sys_errno Valor de errno, usado quando code é Errc::system.
+const char* error_message(Errc code, int sys_errno = 0) noexcept;
+
+/** Resultado de uma operação que não lança exceções.
+ *
+ *      Contém um valor, em caso de sucesso, ou a categoria do erro e o errno
+ *  original. O tipo do valor deve poder ser construído sem argumentos.
+ */
+template <typename T>
+class Result {
+    public:
+
+        /// Resultado de sucesso.
+        Result(T value) noexcept : result(std::move(value)), code(Errc::none), sys_errno(0) {}
+
+        /// Resultado de erro.
+        /// @param code      Categoria do erro.
+        /// @param sys_errno Valor de errno que originou o erro, se houver.
+        Result(Errc code, int sys_errno = 0) noexcept : result(), code(code), sys_errno(sys_errno) {}
+
+        /// Indica se a operação teve sucesso.
+        bool ok() const noexcept {
+            return this->code == Errc::none;
+        }
+
+        explicit operator bool() const noexcept {
+            return ok();
+        }
+
+        /// Valor da operação, válido apenas se ok().
+        T& value() noexcept {
+            return this->result;
+        }
+
+        const T& value() const noexcept {
+            return this->result;
+        }
+
+        /// Categoria do erro, Errc::none em caso de sucesso.
+        Errc error() const noexcept {
+            return this->code;
+        }
+
+        /// Valor de errno que originou o erro, 0 se não houver.
+        int get_errno() const noexcept {
+            return this->sys_errno;
+        }
+
+        /// Descrição do erro, sem alocar memória.
+        const char* message() const noexcept {
+            return error_message(this->code, this->sys_errno);
+        }
+
+    private:
+
+        /// Valor da operação.
+        T result;
+
+        /// Categoria do erro.
+        Errc code;
+
+        /// Valor de errno que originou o erro.
+        int sys_errno;
+};
+
+/// Formata o endereço IP de um sockaddr como texto. Endereços IPv4
+/// mapeados em IPv6 (::ffff:a.b.c.d), recebidos por sockets dual-stack, são
+/// formatados como IPv4.
+/// @param address Endereço IPv4 ou IPv6.
+/// @return Endereço formatado, ou string vazia se a família não for suportada.
+std::string format_address(const sockaddr_storage& address);
+
+/// Porta de um sockaddr, na ordem de bytes do host.
+/// @param address Endereço IPv4 ou IPv6.
+uint32_t address_port(const sockaddr_storage& address);
+
+/// Tamanho do sockaddr correspondente à família do endereço.
+/// @param address Endereço IPv4 ou IPv6.
+socklen_t address_length(const sockaddr_storage& address);
+
+class BufferPool;
+struct BufferPoolCentral;
+
+/// Cabeçalho de um slab de BufferPool. Ocupa sozinho a linha de cache
+/// anterior aos dados, para que a contagem de referências não divida uma
+/// linha com os bytes de outro buffer.
+struct BufferSlab {
+    /// Pool dono do slab.
+    BufferPool* pool;
+
+    /// Próximo slab da free-list em que este está.
+    BufferSlab* next;
+
+    /// Dados, alinhados a uma linha de cache.
+    uint8_t* data;
+
+    /// Tamanho dos dados.
+    size_t capacity;
+
+    /// Número de bytes válidos.
+    size_t length;
+
+    /// Número de BufferHandle que apontam para o slab.
+    std::atomic<uint32_t> references;
+
+    /// Se o datagrama recebido no slab era maior que ele.
+    bool truncated;
+};
+
+/** Referência contada a um buffer de um BufferPool.
+ *
+ *      Cópias compartilham o mesmo buffer, sem copiar os bytes, de modo que
+ *  uma mensagem recebida pode ser guardada ou repassada a outra thread sem
+ *  cópias. O buffer volta ao pool quando a última referência é destruída.
+ *  O contador é atômico: referências ao mesmo buffer podem ser copiadas e
+ *  destruídas em threads diferentes, mas os bytes não são protegidos.
+ */
+class BufferHandle {
+    public:
+
+        /// Cria uma referência vazia, sem buffer.
+        BufferHandle() {}
+
+        BufferHandle(const BufferHandle& other) noexcept : slab(other.slab) {
+            if (this->slab) this->slab->references.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        BufferHandle& operator=(const BufferHandle& other) noexcept;
+
+        BufferHandle(BufferHandle&& other) noexcept : slab(other.slab) {
+            other.slab = NULL;
+        }
+
+        BufferHandle& operator=(BufferHandle&& other) noexcept;
+
+        /// Destrutor. Devolve o buffer ao pool se esta era a última referência.
+        ~BufferHandle() {
+            reset();
+        }
+
+        /// Endereço inicial do buffer, alinhado a uma linha de cache.
+        uint8_t* data() const {
+            return this->slab ? this->slab->data : NULL;
+        }
+
+        /// Número de bytes válidos no buffer.
+        size_t size() const {
+            return this->slab ? this->slab->length : 0;
+        }
+
+        /// Tamanho máximo do buffer, igual ao tamanho dos slabs do pool.
+        size_t capacity() const {
+            return this->slab ? this->slab->capacity : 0;
+        }
+
+        /// Define quantos bytes do buffer são válidos, após ele ter sido
+        /// escrito diretamente em data(). Compartilhado por todas as cópias.
+        /// @param length Número de bytes válidos, no máximo capacity().
+        void resize(size_t length);
+
+        /// Indica se o buffer não contém bytes válidos.
+        bool empty() const {
+            return size() == 0;
+        }
+
+        /// Indica se o datagrama recebido em UDPSocket::recvfrom(BufferPool&)
+        /// era maior que capacity() e foi truncado.
+        bool is_truncated() const {
+            return this->slab ? this->slab->truncated : false;
+        }
+
+        /// Indica se a referência possui um buffer.
+        explicit operator bool() const {
+            return this->slab != NULL;
+        }
+
+        /// Número de referências ao buffer, 0 se a referência estiver vazia.
+        uint32_t use_count() const {
+            return this->slab ? this->slab->references.load(std::memory_order_relaxed) : 0;
+        }
+
+        /// Cópia dos bytes válidos como std::string.
+        std::string str() const {
+            return std::string((const char *) data(), size());
+        }
+
+        /// Solta o buffer, deixando a referência vazia.
+        void reset() noexcept;
+
+    private:
+
+        friend class BufferPool;
+        friend class UDPSocket;
+
+        /// Assume uma referência já contada.
+        explicit BufferHandle(BufferSlab* slab) : slab(slab) {}
+
+        /// Cabeçalho do slab referenciado, NULL se vazia.
+        BufferSlab* slab = NULL;
+};
+
+
+/** Pool de buffers de tamanho fixo para os caminhos de recebimento.
+ *
+ *      A memória é alocada em blocos de vários slabs, cada um com um
+ *  cabeçalho e os dados alinhados a linhas de cache, de modo que dois
+ *  buffers nunca compartilham uma linha. Os slabs nunca voltam ao sistema
+ *  antes do pool ser destruído: o consumo de memória é limitado pelo pico
+ *  de buffers em uso, e por max_slabs quando definido.
+ *      Cada thread guarda uma pequena free-list própria, acessada sem
+ *  locks. Só quando ela fica vazia ou cheia a thread troca um lote de slabs
+ *  com a lista central, protegida por um mutex, então threads que recebem e
+ *  liberam buffers não disputam o alocador a cada mensagem.
+ *      É usado por TCPSocket::recv(BufferPool&), TCPConnection::recv(BufferPool&)
+ *  e UDPSocket::recvfrom(BufferPool&, ...). O pool deve continuar vivo até
+ *  que todos os seus buffers sejam soltos, inclusive os repassados a outras
+ *  threads: a última referência devolve o slab ao pool.
+ */
+class BufferPool {
+    public:
+
+        /// Tamanho de uma linha de cache, usado no alinhamento dos slabs.
+        static const size_t CACHE_LINE = 64;
+
+        /// Cria o pool.
+        /// @param slab_size       Tamanho de cada buffer, arredondado para um
+        ///                        múltiplo de CACHE_LINE.
+        /// @param slabs_per_chunk Número de slabs alocados de uma só vez.
+        /// @param max_slabs       Número máximo de slabs, 0 para sem limite.
+        BufferPool(size_t slab_size = 64 * 1024, size_t slabs_per_chunk = 32, size_t max_slabs = 0);
+
+        /// Destrutor. Libera a memória de todos os slabs.
+        ~BufferPool();
+
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+
+        /// Retira um buffer vazio do pool. Lança SocketException se max_slabs
+        /// foi atingido.
+        /// @return Referência ao buffer.
+        BufferHandle acquire();
+
+        /// Retira um buffer vazio do pool sem lançar exceções quando
+        /// max_slabs foi atingido.
+        /// @return Referência ao buffer, vazia se o pool estiver esgotado.
+        BufferHandle try_acquire();
+
+        /// Tamanho de cada buffer.
+        size_t get_slab_size() const {
+            return this->slab_size;
+        }
+
+        /// Número de slabs já alocados, livres ou em uso.
+        size_t get_allocated() const;
+
+    private:
+
+        friend class BufferHandle;
+
+        /// Free-list de uma thread para um pool.
+        struct LocalList {
+            uint64_t pool_id;
+            std::weak_ptr<BufferPoolCentral> central;
+            BufferSlab* head;
+            size_t count;
+        };
+
+        /// Free-lists da thread atual, uma por pool usado por ela.
+        struct ThreadLists {
+            std::vector<LocalList> lists;
+
+            /// Devolve os slabs aos pools que ainda existem.
+            ~ThreadLists();
+        };
+
+        /// Free-list da thread atual para este pool, criada no primeiro uso.
+        LocalList& local_list();
+
+        /// Devolve um slab sem referências à free-list da thread atual.
+        void release(BufferSlab* slab) noexcept;
+
+        /// Identificador único do pool, que nunca é reutilizado.
+        uint64_t id;
+
+        /// Tamanho de cada buffer.
+        size_t slab_size;
+
+        /// Número máximo de slabs na free-list de cada thread.
+        size_t local_limit;
+
+        /// Lista central e blocos de memória, compartilhados com as free-lists
+        /// das threads para que elas saibam se o pool ainda existe.
+        std::shared_ptr<BufferPoolCentral> central;
+};
+
+
+/** Classe base de um wrapper de um socket IPv4 ou IPv6.
+ *
+ *      Sockets IPv6 são dual-stack por padrão (IPV6_V6ONLY desativado):
+ *  também se comunicam com endereços IPv4, que aparecem como endereços
+ *  IPv4 mapeados em IPv6.
  */
 class BaseSocket {
     public:
 
-        /// Vincula o socket a alguma porta.
+        /// Vincula o socket a alguma porta, em todos os endereços locais.
         /// @param port Número da porta que o socket será vinculado.
         void bind(uint32_t port);
 
+        /// Vincula o socket a uma porta de um endereço local específico.
+        /// @param address Endereço IP local, ou string vazia para todos os endereços.
+        /// @param port    Número da porta que o socket será vinculado.
+        void bind(const std::string& address, uint32_t port);
+
+        /// Restringe a socket a uma interface de rede (SO_BINDTODEVICE).
+        /// @param name Nome da interface, como "eth0".
+        void bind_to_interface(const std::string& name);
+
+        /// Permite que várias sockets sejam vinculadas à mesma porta (SO_REUSEPORT),
+        /// com o kernel distribuindo as conexões entre elas.
+        /// Deve ser chamada antes de bind().
+        /// @param enable True para permitir o reuso da porta.
+        void set_reuse_port(bool enable = true);
+
         /// Permite configurar tempo limite para funções de input/output
         /// como recv() e send().
         void set_timeout(uint16_t seconds);
+
+        /// Define uma opção inteira da socket com setsockopt().
+        /// @param level Nível da opção (SOL_SOCKET, IPPROTO_TCP, ...).
+        /// @param name  Nome da opção (SO_SNDBUF, TCP_NODELAY, ...).
+        /// @param value Valor da opção.
+        void set_option(int level, int name, int value);
+
+        /// Lê uma opção inteira da socket com getsockopt().
+        /// @param level Nível da opção (SOL_SOCKET, IPPROTO_TCP, ...).
+        /// @param name  Nome da opção (SO_SNDBUF, TCP_NODELAY, ...).
+        /// @return Valor da opção.
+        int get_option(int level, int name) const;
+
+        /// Desativa o algoritmo de Nagle (TCP_NODELAY).
+        void set_no_delay(bool enable = true);
+        bool get_no_delay() const;
+
+        /// Envia ACKs imediatamente em vez de atrasá-los (TCP_QUICKACK).
+        /// O kernel pode voltar ao modo atrasado, então deve ser reaplicada
+        /// quando necessário.
+        void set_quick_ack(bool enable = true);
+        bool get_quick_ack() const;
+
+        /// Tamanho do buffer de envio do kernel (SO_SNDBUF). O kernel dobra o
+        /// valor pedido, e get_send_buffer_size() retorna o valor efetivo.
+        void set_send_buffer_size(int bytes);
+        int get_send_buffer_size() const;
+
+        /// Tamanho do buffer de recebimento do kernel (SO_RCVBUF). O kernel
+        /// dobra o valor pedido, e get_receive_buffer_size() retorna o valor efetivo.
+        void set_receive_buffer_size(int bytes);
+        int get_receive_buffer_size() const;
+
+        /// Ativa o envio de keepalives (SO_KEEPALIVE). Parâmetros iguais a
+        /// zero mantêm o padrão do sistema.
+        /// @param enable   True para ativar keepalives.
+        /// @param idle     Segundos sem tráfego antes do primeiro keepalive (TCP_KEEPIDLE).
+        /// @param interval Segundos entre keepalives (TCP_KEEPINTVL).
+        /// @param count    Keepalives sem resposta até a conexão cair (TCP_KEEPCNT).
+        void set_keepalive(bool enable, int idle = 0, int interval = 0, int count = 0);
+        bool get_keepalive() const;
+
+        /// Microssegundos de busy polling no recebimento (SO_BUSY_POLL).
+        /// Valores acima do padrão do sistema exigem CAP_NET_ADMIN.
+        void set_busy_poll(int microseconds);
+        int get_busy_poll() const;
+
+        /// Milissegundos que dados enviados podem ficar sem confirmação antes
+        /// da conexão ser encerrada (TCP_USER_TIMEOUT). 0 usa o padrão do sistema.
+        void set_user_timeout(unsigned int milliseconds);
+        unsigned int get_user_timeout() const;
+
+        /// Tempo limite em milissegundos para funções de envio (SO_SNDTIMEO).
+        /// 0 desativa o tempo limite.
+        void set_send_timeout_ms(uint32_t milliseconds);
+        uint32_t get_send_timeout_ms() const;
+
+        /// Tempo limite em milissegundos para funções de recebimento (SO_RCVTIMEO).
+        /// 0 desativa o tempo limite.
+        void set_receive_timeout_ms(uint32_t milliseconds);
+        uint32_t get_receive_timeout_ms() const;
         
-        std::string get_ip_address() {
-            return this->ip_address_str;
+        /// Endereço IP do outro lado de uma conexão aceita, formatado como texto.
+        std::string get_ip_address();
+
+        /// Descritor de arquivo da socket, para uso com epoll/poll.
+        int get_fd() const {
+            return this->socketfd;
         }
 
+        /// Ativa ou desativa o modo não bloqueante (O_NONBLOCK) da socket.
+        /// Em modo não bloqueante, operações que bloqueariam lançam WouldBlock.
+        /// @param enable True para ativar o modo não bloqueante.
+        void set_nonblocking(bool enable = true);
+
+        /// Indica se a socket está em modo não bloqueante.
+        bool is_nonblocking() const {
+            return this->nonblocking;
+        }
+
+        /// Família da socket, AF_INET, AF_INET6 ou AF_UNIX.
+        int get_family() const {
+            return this->hints.ai_family;
+        }
+
+        /// Restringe uma socket IPv6 a endereços IPv6 (IPV6_V6ONLY), desativando
+        /// o modo dual-stack. Deve ser chamada antes de bind() ou connect().
+        /// @param enable True para aceitar apenas IPv6.
+        void set_v6_only(bool enable = true);
+        bool get_v6_only() const;
+
     protected:
 
-        /// Cria um socket IPv4 de acordo com o protocolo selecionado.
-        /// @param type Tipo do socket a ser criado, SOCK_STREAM ou SOCK_DGRAM.
-        /// @param flags Flags opcionais para a chamada de getaddrinfo()
-        BaseSocket(int type, int flags = 0);
+        /// Cria um socket de acordo com o protocolo selecionado.
+        /// @param type   Tipo do socket a ser criado, SOCK_STREAM ou SOCK_DGRAM.
+        /// @param flags  Flags opcionais para a chamada de getaddrinfo()
+        /// @param family Família do socket, AF_INET, AF_INET6 (dual-stack) ou AF_UNIX.
+        BaseSocket(int type, int flags = 0, int family = AF_INET);
 
-        /// Cria um novo objeto com informações de uma socket IPv4 já criada.
+        /// Cria um novo objeto com informações de uma socket já criada.
         /// @param socket       Descritor de arquivo da socket já criada.
         /// @param type         Tipo do socket (SOCK_DGRAM ou SOCK_STREAM).
-        /// @param socket_info   Addrinfo TCP/IPv4 que já contêm endereços preenchidos.
+        /// @param socket_info   Addrinfo TCP ou UDP que já contêm endereços preenchidos.
         /// @param port_used    Porta na qual o socket foi vinculado.
         /// @param is_bound     Indica se o socket está vinculado a alguma porta.
         BaseSocket(int socket, int type, addrinfo socket_info, const std::string& client_ip,
             uint32_t port_used, bool is_bound);
 
+        /// Cria um novo objeto a partir de uma socket já conectada.
+        /// @param socket      Descritor de arquivo da socket já criada.
+        /// @param type        Tipo do socket (SOCK_DGRAM ou SOCK_STREAM).
+        /// @param peer        Endereço do outro lado da conexão.
+        /// @param peer_length Tamanho do endereço em peer.
+        BaseSocket(int socket, int type, const sockaddr_storage& peer, socklen_t peer_length);
+
         /// Destrutor. Libera memórias alocadas e encerra o socket.
         ~BaseSocket();
         
@@ -80,18 +564,45 @@ class BaseSocket {
 
         /// Preenche socket_info com endereços possíveis de se realizar chamadas
         /// de bind() ou connect().
-        /// @param address Endereço a ser procurado (IPv4 ou domínio).
+        /// @param address Endereço a ser procurado (IPv4, IPv6 ou domínio).
         /// @param port Porta a ser realizada a busca.
         void getAddrInfo(const std::string address, uint32_t port);
 
+        /// Chama setsockopt() verificando o resultado e registra a opção
+        /// para que possa ser herdada por sockets aceitas.
+        /// @param level  Nível da opção.
+        /// @param name   Nome da opção.
+        /// @param value  Endereço do valor da opção.
+        /// @param length Tamanho do valor da opção.
+        /// @param record False para opções que só fazem sentido no listener.
+        void apply_option(int level, int name, const void* value, socklen_t length,
+            bool record = true);
+
+        /// Chama getsockopt() verificando o resultado.
+        /// @param level  Nível da opção.
+        /// @param name   Nome da opção.
+        /// @param value  Endereço que receberá o valor da opção.
+        /// @param length Tamanho do valor da opção.
+        void read_option(int level, int name, void* value, socklen_t length) const;
+
         /// Verifica se a string é um endereço IP válido.
         /// @param ip_address std::string a ser avaliada
         /// @return True caso ip_address seja um enderçeo IP válido, false caso contrário.
         bool validateIpAddress(const std::string &ip_address);
 
-        /// Contém as informações do socket.
-        /// Socket será sempre TCP/IPv4 ou UDP/IPv4.
-        addrinfo * socket_info;
+        /// Família, tipo e flags usados nas chamadas de getaddrinfo().
+        /// Em sockets IPv6 dual-stack inclui AI_V4MAPPED, para que destinos
+        /// apenas IPv4 sejam retornados como endereços mapeados.
+        addrinfo hints;
+
+        /// Endereços retornados pelo último getaddrinfo(), ou NULL.
+        addrinfo * socket_info = NULL;
+
+        /// Endereço do outro lado de uma conexão aceita.
+        sockaddr_storage peer_address;
+
+        /// Tamanho do endereço em peer_address, 0 se não houver.
+        socklen_t peer_length = 0;
         
         /// Descritor do arquivo da socket
         int socketfd = -1;
@@ -105,12 +616,233 @@ class BaseSocket {
         /// Se a socket foi fechada.
         bool is_closed = false;
 
+        /// Se a socket está em modo não bloqueante.
+        bool nonblocking = false;
+
         std::string ip_address_str;
 
+        /// Opção definida por apply_option(), guardada para ser reaplicada.
+        struct SocketOption {
+            int level;
+            int name;
+            std::string value;
+        };
+
+        /// Opções definidas nesta socket, na ordem em que foram aplicadas.
+        std::vector<SocketOption> options;
+
+};
+
+
+/** Conexão TCP aceita, compacta e sem alocações.
+ *  
+ *      Guarda apenas o descritor e o endereço do cliente, sem alocar memória
+ *  no heap, e formata o endereço como texto apenas quando pedido. Pode ser
+ *  movida mas não copiada; o descritor é fechado pelo destrutor.
+ *      Retornada por valor por TCPSocket::accept_connection(), é indicada
+ *  para servidores com muitas conexões simultâneas.
+ */
+class TCPConnection {
+    public:
+
+        /// Cria uma conexão vazia, sem descritor.
+        TCPConnection();
+
+        /// Assume a posse de um descritor de uma conexão já estabelecida.
+        /// @param socket      Descritor de arquivo da conexão.
+        /// @param peer        Endereço do outro lado da conexão.
+        /// @param peer_length Tamanho do endereço em peer.
+        TCPConnection(int socket, const sockaddr_storage& peer, socklen_t peer_length);
+
+        TCPConnection(TCPConnection&& other) noexcept;
+        TCPConnection& operator=(TCPConnection&& other) noexcept;
+
+        TCPConnection(const TCPConnection&) = delete;
+        TCPConnection& operator=(const TCPConnection&) = delete;
+
+        /// Destrutor. Encerra a conexão, ignorando erros.
+        ~TCPConnection();
+
+        /// Descritor de arquivo da conexão, -1 se estiver fechada.
+        int get_fd() const {
+            return this->socketfd;
+        }
+
+        /// Indica se a conexão possui um descritor aberto.
+        bool is_open() const {
+            return this->socketfd != -1;
+        }
+
+        /// Endereço do outro lado da conexão.
+        const sockaddr_storage& get_peer() const {
+            return this->peer;
+        }
+
+        /// Endereço IP do outro lado da conexão, formatado como texto.
+        std::string get_ip_address() const {
+            return format_address(this->peer);
+        }
+
+        /// Porta do outro lado da conexão.
+        uint32_t get_port() const {
+            return address_port(this->peer);
+        }
+
+        /// Ativa ou desativa o modo não bloqueante (O_NONBLOCK) da conexão.
+        /// @param enable True para ativar o modo não bloqueante.
+        void set_nonblocking(bool enable = true);
+
+        /// Envia uma quantidade específica de bytes, como TCPSocket::send().
+        /// @param message Endereço inicial da mensagem a ser enviada.
+        /// @param length  Indica quantos bytes devem ser enviados.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void send(const uint8_t* message, size_t length, int flags = 0);
+
+        /// Envia uma string, como TCPSocket::send().
+        /// @param message Mensagem a ser enviada.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void send(const std::string& message, int flags = 0);
+
+        /// Envia vários buffers como uma única mensagem, como TCPSocket::sendv().
+        /// @param buffers Vetor de buffers a serem enviados em ordem.
+        /// @param count   Número de buffers.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void sendv(const iovec* buffers, int count, int flags = 0);
+
+        /// Recebe bytes em um buffer do chamador, como TCPSocket::recv_into().
+        /// @param buffer   Endereço inicial do buffer que receberá os bytes.
+        /// @param capacity Número máximo de bytes a serem recebidos.
+        /// @param flags    Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos.
+        size_t recv_into(uint8_t* buffer, size_t capacity, int flags = 0);
+
+        /// Recebe uma string, como TCPSocket::recv().
+        /// @param maxlen Tamanho máximo da mensagem a ser recebida.
+        /// @param flags  Flags opcionais para o recebimento da mensagem.
+        /// @return std::string contendo a mensagem recebida.
+        std::string recv(uint64_t maxlen, int flags = 0);
+
+        /// Recebe bytes em um buffer do pool, como TCPSocket::recv(BufferPool&).
+        /// @param pool  Pool de onde o buffer é retirado.
+        /// @param flags Flags opcionais para o recebimento da mensagem.
+        /// @return Buffer com os bytes recebidos.
+        BufferHandle recv(BufferPool& pool, int flags = 0);
+
+        /// Envia bytes sem lançar exceções, como TCPSocket::try_send().
+        Result<size_t> try_send(const uint8_t* message, size_t length, int flags = 0) noexcept;
+
+        /// Envia vários buffers sem lançar exceções, como TCPSocket::try_sendv().
+        Result<size_t> try_sendv(const iovec* buffers, int count, int flags = 0) noexcept;
+
+        /// Recebe bytes sem lançar exceções, como TCPSocket::try_recv_into().
+        Result<size_t> try_recv_into(uint8_t* buffer, size_t capacity, int flags = 0) noexcept;
+
+        /// Envia bytes de um arquivo com sendfile, como TCPSocket::send_file().
+        uint64_t send_file(int fd, off_t offset, uint64_t count);
+
+        /// Envia bytes de um arquivo sem lançar exceções, como TCPSocket::try_send_file().
+        Result<uint64_t> try_send_file(int fd, off_t offset, uint64_t count) noexcept;
+
+        /// Encerra a conexão.
+        void close();
+
+        /// Abre mão do descritor sem fechá-lo.
+        /// @return Descritor que pertencia à conexão.
+        int release();
+
+    private:
+
+        /// Descritor de arquivo da conexão.
+        int socketfd;
+
+        /// Tamanho do endereço em peer.
+        socklen_t peer_length;
+
+        /// Endereço do outro lado da conexão.
+        sockaddr_storage peer;
 };
 
 
-/** Wrapper de um socket TCP/IPv4.
+/** Free-list de objetos TCPConnection reutilizáveis.
+ *  
+ *      Os objetos ficam em um armazenamento com endereços estáveis e são
+ *  reciclados com release() em vez de serem destruídos, de modo que
+ *  TCPSocket::accept_batch() não aloca memória por conexão aceita depois
+ *  que a free-list atinge o tamanho de trabalho do servidor.
+ *      Não é thread-safe: cada thread deve ter a sua.
+ */
+class ConnectionFreeList {
+    public:
+
+        /// Cria a free-list com alguns objetos já alocados.
+        /// @param preallocate Número de objetos criados de antemão.
+        ConnectionFreeList(size_t preallocate = 0);
+
+        ConnectionFreeList(const ConnectionFreeList&) = delete;
+        ConnectionFreeList& operator=(const ConnectionFreeList&) = delete;
+
+        /// Retira um objeto vazio da free-list, criando um novo se ela estiver vazia.
+        /// @return Objeto vazio, válido até ser devolvido com release().
+        TCPConnection* acquire();
+
+        /// Fecha a conexão, ignorando erros, e devolve o objeto à free-list.
+        /// @param connection Objeto retirado desta free-list com acquire().
+        void release(TCPConnection* connection);
+
+        /// Número de objetos disponíveis na free-list.
+        size_t available() const {
+            return this->free_connections.size();
+        }
+
+        /// Número total de objetos criados pela free-list.
+        size_t capacity() const {
+            return this->storage.size();
+        }
+
+    private:
+
+        /// Armazenamento dos objetos; std::deque não move os elementos ao crescer.
+        std::deque<TCPConnection> storage;
+
+        /// Objetos disponíveis.
+        std::vector<TCPConnection*> free_connections;
+};
+
+
+/** Configuração de um TCPSocket que vai ouvir conexões.
+ *  
+ *      Usada por TCPSocket::listen(port, config), que aplica as opções na
+ *  ordem exigida pelo kernel (antes do bind() ou do listen()).
+ */
+struct ListenerConfig {
+
+    /// Endereço IP local, ou string vazia para todos os endereços.
+    std::string address;
+
+    /// Família dos listeners criados por ReusePortServer. AF_INET6 aceita
+    /// conexões IPv4 e IPv6 (dual-stack).
+    int family = AF_INET;
+
+    /// Interface de rede (SO_BINDTODEVICE), ou string vazia para todas.
+    std::string interface_name;
+
+    /// Número máximo de conexões pendentes. O kernel limita o valor a
+    /// net.core.somaxconn.
+    uint32_t backlog = SOMAXCONN;
+
+    /// Permite vários listeners na mesma porta (SO_REUSEPORT).
+    bool reuse_port = false;
+
+    /// Segundos que o kernel espera por dados antes de acordar o accept()
+    /// (TCP_DEFER_ACCEPT). 0 desativa.
+    int defer_accept = 0;
+
+    /// Tamanho da fila de conexões TCP Fast Open (TCP_FASTOPEN). 0 desativa.
+    int fast_open = 0;
+};
+
+
+/** Wrapper de um socket TCP sobre IPv4 ou IPv6.
  *  
  *      Para usar como um servidor (recebendo conexões) construa o objeto,
  *  faça o bind() e o listen() e aceite diferentes conexões com diferentes
@@ -124,13 +856,14 @@ class BaseSocket {
 class TCPSocket : public BaseSocket {
     public:
 
-        /// Cria um socket TCP/IPv4.
-        /// @param flags Flags opcionais para a chamada de getaddrinfo()
-        TCPSocket(int flags = 0);
+        /// Cria um socket TCP.
+        /// @param flags  Flags opcionais para a chamada de getaddrinfo()
+        /// @param family AF_INET, ou AF_INET6 para uma socket dual-stack.
+        TCPSocket(int flags = 0, int family = AF_INET);
 
-        /// Cria um socket TCP/IPv4 copiando as variaveis definidas nos parametros.
+        /// Cria um socket TCP copiando as variaveis definidas nos parametros.
         /// @param socket       Descritor de arquivo da socket já criada.
-        /// @param socket_info   Addrinfo TCP/IPv4 que já contêm endereços preenchidos.
+        /// @param socket_info   Addrinfo TCP que já contêm endereços preenchidos.
         /// @param port_used    Porta na qual o socket foi vinculado.
         /// @param is_bound      Indica se o socket está vinculado a alguma porta.
         /// @param is_listening  Indica se o socket já está ouvindo em alguma porta.
@@ -138,6 +871,12 @@ class TCPSocket : public BaseSocket {
         TCPSocket(int socket, addrinfo socket_info, uint32_t port_used, const std::string& client_ip,
             bool is_bound, bool is_listening, bool is_connected);
         
+        /// Cria um TCPSocket a partir de uma conexão já estabelecida.
+        /// @param socket      Descritor de arquivo da conexão.
+        /// @param peer        Endereço do outro lado da conexão.
+        /// @param peer_length Tamanho do endereço em peer.
+        TCPSocket(int socket, const sockaddr_storage& peer, socklen_t peer_length);
+
         /// Conecta a socket a algum endereço.
         /// @param address std::string contendo o endereço IP ou domínio a ser conectado.
         /// @param port    Porta a qual se conectar.
@@ -145,17 +884,54 @@ class TCPSocket : public BaseSocket {
         
         /// Recebe conexões na porta definida previamente pela função bind().
         /// @param backlog Número máximo de conexões pendentes.
-        void listen(uint32_t backlog = 5);
+        void listen(uint32_t backlog = SOMAXCONN);
+
+        /// Vincula a socket e recebe conexões de acordo com uma configuração.
+        /// @param port   Número da porta que o socket será vinculado.
+        /// @param config Endereço, backlog e opções do listener.
+        void listen(uint32_t port, const ListenerConfig& config);
+
+        /// Envia os primeiros dados junto com o SYN (TCP_FASTOPEN_CONNECT)
+        /// quando o servidor suportar TCP Fast Open, economizando uma volta
+        /// na rede. Deve ser chamada antes de connect().
+        /// @param enable True para tentar TCP Fast Open.
+        void set_fast_open_connect(bool enable = true);
         
         /// Aceita uma conexão pendente após chamar a função listen().
         /// @return Objeto TCPSocket conectado ao cliente aceito.
         std::shared_ptr<TCPSocket> accept(); 
+
+        /// Aceita uma conexão pendente como um TCPConnection, sem alocações.
+        /// @return Conexão aceita, retornada por valor.
+        TCPConnection accept_connection();
+
+        /// Aceita todas as conexões pendentes, até max, com accept4(). As
+        /// conexões já são criadas em modo não bloqueante e com FD_CLOEXEC,
+        /// sem chamadas de sistema adicionais. Se a socket estiver em modo
+        /// bloqueante, bloqueia apenas até a primeira conexão. Uma conexão em
+        /// que as opções herdadas não puderam ser aplicadas é fechada e as
+        /// seguintes continuam sendo aceitas, como uma conexão abortada.
+        /// @param accepted Vetor reutilizável, esvaziado e preenchido com as
+        ///                 conexões aceitas, que pertencem a connections.
+        /// @param connections Free-list de onde os objetos são retirados.
+        /// @param max      Número máximo de conexões aceitas.
+        /// @return Número de conexões aceitas.
+        size_t accept_batch(std::vector<TCPConnection*>& accepted,
+            ConnectionFreeList& connections, size_t max = 1024);
+
+        /// Faz com que as conexões retornadas por accept(), accept_connection()
+        /// e accept_batch() recebam todas as opções definidas nesta socket (set_no_delay(), set_keepalive(),
+        /// timeouts etc.), inclusive as que o kernel não herda sozinho.
+        /// @param enable True para que as opções sejam herdadas.
+        void set_options_inheritance(bool enable = true) {
+            this->inherit_options = enable;
+        }
         
         /// Envia uma quantidade específica de bytes para o endereço conectado.
         /// @param message Endereço inicial da mensagem a ser enviada.
         /// @param length Indica quantos bytes devem ser enviados
         /// @param flags   Flags opcionais para o envio da mensagem ao socket.
-        void send(const uint8_t* message, int length, int flags = 0);  
+        void send(const uint8_t* message, size_t length, int flags = 0);
         
         /// Recebe uma mensagem do endereço conectado.
         /// @param maxlen Tamanho máximo da mensagem a ser recebida.
@@ -164,6 +940,51 @@ class TCPSocket : public BaseSocket {
         ///         a refletir quantos bytes foram recebidos.
         uint8_t* recv(uint64_t* maxlen, int flags = 0);
         
+        /// Recebe uma mensagem do endereço conectado diretamente em um buffer
+        /// do chamador, sem alocar memória. Lança ClosedConnection quando o
+        /// outro lado encerra o envio; como ele pode ter fechado apenas um
+        /// sentido (shutdown(SHUT_WR)), ainda é possível enviar a resposta.
+        /// @param buffer   Endereço inicial do buffer que receberá os bytes.
+        /// @param capacity Número máximo de bytes a serem recebidos.
+        /// @param flags    Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos.
+        size_t recv_into(uint8_t* buffer, size_t capacity, int flags = 0);
+
+        /// Recebe uma mensagem em um buffer reutilizável. Até buffer.size()
+        /// bytes são recebidos e o tamanho do vetor não é alterado.
+        /// @param buffer Buffer que receberá os bytes.
+        /// @param flags  Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos.
+        size_t recv_into(std::vector<uint8_t>& buffer, int flags = 0);
+
+        /// Recebe uma mensagem em uma string reutilizável, que passa a conter
+        /// exatamente os bytes recebidos. Não aloca memória caso a capacidade
+        /// da string já seja de pelo menos maxlen, mas a cada chamada a string
+        /// é estendida até maxlen, o que preenche com zeros os bytes além da
+        /// mensagem anterior. Com maxlen grande e mensagens pequenas, prefira
+        /// recv_into(uint8_t*, size_t) ou recv_into(std::vector<uint8_t>&),
+        /// que não tocam no buffer além dos bytes recebidos.
+        /// @param buffer String que receberá os bytes.
+        /// @param maxlen Tamanho máximo da mensagem a ser recebida.
+        /// @param flags  Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos.
+        size_t recv_into(std::string& buffer, uint64_t maxlen, int flags = 0);
+        
+        /// Envia vários buffers como uma única mensagem (scatter/gather),
+        /// sem copiá-los para um buffer contíguo. Assim como send(), repete
+        /// a chamada até que todos os bytes sejam enviados.
+        /// @param buffers Vetor de buffers a serem enviados em ordem.
+        /// @param count   Número de buffers.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void sendv(const iovec* buffers, int count, int flags = 0);
+
+        /// Recebe uma mensagem distribuindo os bytes entre vários buffers, na ordem.
+        /// @param buffers Vetor de buffers que receberão os bytes.
+        /// @param count   Número de buffers.
+        /// @param flags   Flags opcionais para o recebimento da mensagem.
+        /// @return Número total de bytes recebidos.
+        size_t recvv(const iovec* buffers, int count, int flags = 0);
+
         /// Envia uma string ao endereço conectado.
         /// @param message Mensagem a ser enviada.
         /// @param flags   Flags opcionais para o envio da mensagem ao socket.
@@ -175,8 +996,60 @@ class TCPSocket : public BaseSocket {
         /// @return std::string contendo a mensagem recebida.
         std::string recv(uint64_t maxlen, int flags = 0);
 
-        
-        
+        /// Recebe bytes em um buffer do pool, que pode ser guardado ou
+        /// repassado sem cópias. Recebe até BufferPool::get_slab_size() bytes.
+        /// @param pool  Pool de onde o buffer é retirado.
+        /// @param flags Flags opcionais para o recebimento da mensagem.
+        /// @return Buffer com os bytes recebidos.
+        BufferHandle recv(BufferPool& pool, int flags = 0);
+
+        /// Envia bytes de um arquivo direto do page cache para a socket
+        /// (sendfile), sem copiá-los para a memória do processo. Repete a
+        /// chamada até enviar count bytes, o arquivo terminar ou, em uma
+        /// socket não bloqueante, o buffer de envio encher.
+        /// @param fd     Descritor do arquivo, aberto para leitura.
+        /// @param offset Posição do arquivo a partir da qual os bytes são lidos.
+        ///               A posição do descritor não é alterada.
+        /// @param count  Número de bytes a serem enviados.
+        /// @return Número de bytes enviados. Se for menor que count, o envio
+        ///         continua chamando send_file() com offset + retorno.
+        uint64_t send_file(int fd, off_t offset, uint64_t count);
+
+        /// Envia bytes de um arquivo sem lançar exceções, como send_file().
+        /// @return Número de bytes enviados, que pode ser menor que count, ou
+        ///         o erro se nenhum byte foi enviado.
+        Result<uint64_t> try_send_file(int fd, off_t offset, uint64_t count) noexcept;
+
+        /// Envia bytes sem lançar exceções. Repete ::send() até enviar tudo ou
+        /// até o kernel não aceitar mais bytes.
+        /// @param message Endereço inicial da mensagem a ser enviada.
+        /// @param length  Indica quantos bytes devem ser enviados.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        /// @return Número de bytes enviados, que pode ser menor que length em
+        ///         uma socket não bloqueante, ou o erro se nenhum byte foi enviado.
+        Result<size_t> try_send(const uint8_t* message, size_t length, int flags = 0) noexcept;
+
+        /// Envia vários buffers sem lançar exceções nem alocar memória.
+        /// @param buffers Vetor de buffers a serem enviados em ordem.
+        /// @param count   Número de buffers.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        /// @return Número de bytes enviados, como em try_send().
+        Result<size_t> try_sendv(const iovec* buffers, int count, int flags = 0) noexcept;
+
+        /// Recebe bytes sem lançar exceções. O fechamento da conexão pelo
+        /// outro lado é retornado como Errc::closed.
+        /// @param buffer   Endereço inicial do buffer que receberá os bytes.
+        /// @param capacity Número máximo de bytes a serem recebidos.
+        /// @param flags    Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos ou o erro.
+        Result<size_t> try_recv_into(uint8_t* buffer, size_t capacity, int flags = 0) noexcept;
+
+        /// Aceita uma conexão pendente sem lançar exceções. As opções herdadas
+        /// são aplicadas e uma falha ao aplicá-las fecha a conexão e é
+        /// retornada como Errc::option_failed, com o errno do setsockopt().
+        /// @return Conexão aceita ou o erro.
+        Result<TCPConnection> try_accept() noexcept;
+
         /// Encerra o socket.
         void close();
 
@@ -188,6 +1061,131 @@ class TCPSocket : public BaseSocket {
         /// Se o socket está ouvindo conexões
         bool is_listening = false;
 
+        /// Se as sockets aceitas devem receber as opções desta socket.
+        bool inherit_options = false;
+
+        /// Aplica as opções desta socket em uma conexão aceita, caso
+        /// set_options_inheritance() tenha sido ativada, sem exceções.
+        /// @param clientfd Descritor da conexão aceita.
+        /// @param failed   Preenchido com o índice da opção que falhou, se não for NULL.
+        /// @return 0 em caso de sucesso, ou o errno de setsockopt().
+        int try_apply_inherited_options(int clientfd, size_t* failed = NULL) noexcept;
+
+};
+
+
+/** Endereço IPv4 ou IPv6 e porta já resolvidos.
+ *  
+ *      Guarda o sockaddr pronto para ser usado em chamadas de sistema, de
+ *  modo que envios repetidos ao mesmo destino não precisem converter texto
+ *  nem consultar o DNS.
+ */
+class Endpoint {
+    public:
+
+        /// Cria um endpoint vazio (0.0.0.0:0).
+        Endpoint();
+
+        /// Cria um endpoint a partir de um endereço já preenchido.
+        /// @param address Endereço IPv4 e porta.
+        Endpoint(const sockaddr_in& address);
+
+        /// Cria um endpoint a partir de um endereço já preenchido.
+        /// @param address Endereço IPv6 e porta.
+        Endpoint(const sockaddr_in6& address);
+
+        /// Cria um endpoint a partir de um endereço já preenchido.
+        /// @param address Endereço IPv4 ou IPv6 e porta.
+        Endpoint(const sockaddr_storage& address) : address(address) {}
+
+        /// Resolve um endereço IP ou domínio, sem usar cache.
+        /// @param address std::string contendo o endereço IP ou domínio.
+        /// @param port    Porta do endpoint.
+        /// @param family  AF_INET, AF_INET6 ou AF_UNSPEC para qualquer família,
+        ///                como em sockets dual-stack.
+        /// @return Endpoint resolvido.
+        static Endpoint resolve(const std::string& address, uint32_t port, int family = AF_INET);
+
+        /// Endereço pronto para chamadas de sistema.
+        const sockaddr_storage& get_sockaddr() const {
+            return this->address;
+        }
+
+        /// Tamanho do endereço em get_sockaddr().
+        socklen_t get_length() const {
+            return address_length(this->address);
+        }
+
+        /// Família do endereço, AF_INET ou AF_INET6.
+        int get_family() const {
+            return this->address.ss_family;
+        }
+
+        /// Endereço IP formatado como texto.
+        std::string get_address() const {
+            return format_address(this->address);
+        }
+
+        /// Porta do endpoint.
+        uint32_t get_port() const {
+            return address_port(this->address);
+        }
+
+    private:
+
+        /// Endereço IPv4 ou IPv6 e porta.
+        sockaddr_storage address;
+};
+
+
+/** Cache de resolução de endereços com tempo de vida limitado.
+ *  
+ *      Evita consultas repetidas ao DNS para o mesmo destino. Cada resultado
+ *  é mantido por no máximo ttl, após o qual é resolvido novamente. Pode ser
+ *  usado por várias threads ao mesmo tempo.
+ */
+class Resolver {
+    public:
+
+        /// Cria um cache vazio.
+        /// @param ttl         Tempo que cada resolução é mantida no cache.
+        /// @param max_entries Número máximo de destinos no cache.
+        Resolver(std::chrono::milliseconds ttl = std::chrono::seconds(60), size_t max_entries = 1024);
+
+        /// Resolve um endereço, consultando o DNS apenas se o resultado não
+        /// estiver no cache ou tiver expirado.
+        /// @param address std::string contendo o endereço IP ou domínio.
+        /// @param port    Porta do endpoint.
+        /// @param family  AF_INET, AF_INET6 ou AF_UNSPEC para qualquer família,
+        ///                como em sockets dual-stack.
+        /// @return Endpoint resolvido.
+        Endpoint resolve(const std::string& address, uint32_t port, int family = AF_INET);
+
+        /// Descarta todos os resultados do cache.
+        void clear();
+
+        /// Cache compartilhado usado por UDPSocket::sendto() com endereços em texto.
+        static Resolver& shared();
+
+    private:
+
+        /// Resultado de uma resolução e o instante em que expira.
+        struct Entry {
+            Endpoint endpoint;
+            std::chrono::steady_clock::time_point expires;
+        };
+
+        /// Tempo que cada resolução é mantida no cache.
+        std::chrono::milliseconds ttl;
+
+        /// Número máximo de destinos no cache.
+        size_t max_entries;
+
+        /// Protege entries.
+        std::mutex mutex;
+
+        /// Resoluções indexadas por "família/endereço:porta".
+        std::unordered_map<std::string, Entry> entries;
 };
 
 
@@ -245,7 +1243,117 @@ class UDPRecv {
 };
 
 
-/** Wrapper de um socket UDP/IPv4 sem possiblidade de connect().
+/** Datagrama reutilizável para recebimento de mensagens UDP sem alocações.
+ *  
+ *      O buffer do payload é alocado apenas na construção (ou em reserve()) e
+ *  reaproveitado a cada chamada de UDPSocket::recvfrom(Datagram&). O endereço
+ *  do transmissor é mantido como sockaddr_storage e só é convertido para texto
+ *  quando get_address() é chamada. O payload pode conter bytes nulos.
+ */
+class Datagram {
+    /// Permite que UDPSocket e IoEngine preencham o datagrama diretamente.
+    friend class UDPSocket;
+    friend class IoEngine;
+
+    public:
+
+        /// Tamanho máximo do payload de um datagrama UDP/IPv4.
+        static const size_t MAX_PAYLOAD = 65507;
+
+        /// Cria um datagrama vazio.
+        /// @param capacity Tamanho máximo do payload a ser recebido.
+        Datagram(size_t capacity = MAX_PAYLOAD);
+
+        /// Endereço inicial do payload.
+        uint8_t* data() {
+            return this->buffer.data();
+        }
+
+        /// Endereço inicial do payload.
+        const uint8_t* data() const {
+            return this->buffer.data();
+        }
+
+        /// Número de bytes válidos no payload.
+        size_t size() const {
+            return this->length;
+        }
+
+        /// Tamanho máximo do payload.
+        size_t capacity() const {
+            return this->buffer.size();
+        }
+
+        /// Altera o tamanho máximo do payload, descartando o conteúdo atual.
+        /// @param capacity Novo tamanho máximo do payload.
+        void reserve(size_t capacity);
+
+        /// Define quantos bytes do payload são válidos, após o payload ter
+        /// sido escrito diretamente em data().
+        /// @param length Número de bytes válidos, no máximo capacity().
+        void resize(size_t length);
+
+        /// Copia uma mensagem para o payload, aumentando a capacidade caso
+        /// seja necessário.
+        /// @param message Endereço inicial da mensagem.
+        /// @param length  Número de bytes da mensagem.
+        void assign(const uint8_t* message, size_t length);
+
+        /// Indica se o último datagrama recebido era maior que capacity()
+        /// e foi truncado.
+        bool is_truncated() const {
+            return this->truncated;
+        }
+
+        /// Endereço do transmissor do último datagrama recebido.
+        const sockaddr_storage& get_peer() const {
+            return this->peer;
+        }
+
+        /// Define o destino do datagrama para UDPSocket::send_batch().
+        /// @param peer Endereço IPv4 ou IPv6 de destino.
+        void set_peer(const sockaddr_storage& peer) {
+            this->peer = peer;
+        }
+
+        /// Define o destino do datagrama para UDPSocket::send_batch().
+        /// @param endpoint Endpoint de destino.
+        void set_peer(const Endpoint& endpoint) {
+            this->peer = endpoint.get_sockaddr();
+        }
+
+        /// Endereço IP do transmissor, formatado como texto.
+        std::string get_address() const {
+            return format_address(this->peer);
+        }
+
+        /// Porta do transmissor.
+        uint32_t get_port() const {
+            return address_port(this->peer);
+        }
+
+        /// Cópia do payload como std::string.
+        std::string get_msg() const {
+            return std::string((const char *) this->buffer.data(), this->length);
+        }
+
+    private:
+
+        /// Buffer do payload, sempre com capacity() bytes.
+        std::vector<uint8_t> buffer;
+
+        /// Número de bytes válidos no payload.
+        size_t length = 0;
+
+        /// Se o último datagrama recebido foi truncado.
+        bool truncated = false;
+
+        /// Endereço do transmissor.
+        sockaddr_storage peer;
+};
+
+
+/** Wrapper de um socket UDP sobre IPv4 ou IPv6 sem possiblidade de connect().
  *  
  *      Para usar como um servidor (recebendo conexões) construa o objeto,
  *  faça o bind() receba mensagens usando recv() e as responda com send().
@@ -256,9 +1364,10 @@ class UDPRecv {
 class UDPSocket : public BaseSocket {
     public:
 
-        /// Cria um socket UDP/IPv4.
-        /// @param flags Flags opcionais para a chamada de getaddrinfo()
-        UDPSocket(int flags = 0);
+        /// Cria um socket UDP.
+        /// @param flags  Flags opcionais para a chamada de getaddrinfo()
+        /// @param family AF_INET, ou AF_INET6 para uma socket dual-stack.
+        UDPSocket(int flags = 0, int family = AF_INET);
 
         /// Envia uma string ao endereço definido.
         /// @param address std::string contendo o endereço IP ou domínio de destino.
@@ -268,14 +1377,236 @@ class UDPSocket : public BaseSocket {
         void sendto(const std::string& address, uint32_t port,
                     const std::string& message, int flags = 0);
 
+        /// Envia uma mensagem a um endpoint já resolvido, sem converter
+        /// endereços nem consultar o DNS.
+        /// @param endpoint Destino da mensagem.
+        /// @param message  Endereço inicial da mensagem a ser enviada.
+        /// @param length   Indica quantos bytes devem ser enviados.
+        /// @param flags    Flags opcionais para o envio da mensagem ao socket.
+        void sendto(const Endpoint& endpoint, const uint8_t* message, size_t length, int flags = 0);
+
+        /// Envia uma string a um endpoint já resolvido.
+        /// @param endpoint Destino da mensagem.
+        /// @param message  Mensagem a ser enviada.
+        /// @param flags    Flags opcionais para o envio da mensagem ao socket.
+        void sendto(const Endpoint& endpoint, const std::string& message, int flags = 0);
+
         /// Recebe uma string do endereço definido.
         /// @param maxlen Tamanho máximo da mensagem a ser recebida.
         /// @param flags  Flags opcionais para o recebimento da mensagem.
         /// @return std::string contendo a mensagem recebida.
         UDPRecv recvfrom(uint64_t maxlen, int flags = 0);
 
+        /// Recebe um datagrama diretamente no buffer de um Datagram
+        /// reutilizável, sem alocar memória nem formatar o endereço.
+        /// @param datagram Datagrama a ser preenchido com o payload e o transmissor.
+        /// @param flags    Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos no payload.
+        size_t recvfrom(Datagram& datagram, int flags = 0);
+
+        /// Recebe um datagrama em um buffer do pool, que pode ser guardado ou
+        /// repassado sem cópias. Datagramas maiores que o buffer são truncados,
+        /// o que é indicado por BufferHandle::is_truncated().
+        /// @param pool   Pool de onde o buffer é retirado.
+        /// @param sender Preenchido com o transmissor. Pode ser NULL.
+        /// @param flags  Flags opcionais para o recebimento da mensagem.
+        /// @return Buffer com o payload recebido.
+        BufferHandle recvfrom(BufferPool& pool, Endpoint* sender = NULL, int flags = 0);
+
+        /// Recebe um datagrama sem lançar exceções, como recvfrom(Datagram&).
+        /// @param datagram Datagrama a ser preenchido com o payload e o transmissor.
+        /// @param flags    Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos no payload ou o erro.
+        Result<size_t> try_recvfrom(Datagram& datagram, int flags = 0) noexcept;
+
+        /// Envia uma mensagem a um endpoint sem lançar exceções.
+        /// @param endpoint Destino da mensagem.
+        /// @param message  Endereço inicial da mensagem a ser enviada.
+        /// @param length   Indica quantos bytes devem ser enviados.
+        /// @param flags    Flags opcionais para o envio da mensagem ao socket.
+        /// @return Número de bytes enviados ou o erro.
+        Result<size_t> try_sendto(const Endpoint& endpoint, const uint8_t* message,
+            size_t length, int flags = 0) noexcept;
+
+        /// Recebe vários datagramas com uma única chamada de sistema (recvmmsg).
+        /// Bloqueia até o primeiro datagrama chegar e então recebe apenas os
+        /// que já estiverem disponíveis.
+        /// @param datagrams Datagramas pré-alocados a serem preenchidos.
+        /// @param max       Número máximo de datagramas, limitado a datagrams.size().
+        /// @param flags     Flags opcionais para o recebimento das mensagens.
+        /// @return Número de datagramas recebidos, preenchidos a partir do início do vetor.
+        size_t recv_batch(std::vector<Datagram>& datagrams, size_t max, int flags = 0);
+
+        /// Envia vários datagramas com o mínimo de chamadas de sistema (sendmmsg).
+        /// Cada datagrama é enviado ao endereço definido por Datagram::set_peer().
+        /// @param datagrams Datagramas a serem enviados.
+        /// @param count     Número de datagramas, a partir do início do vetor.
+        /// @param flags     Flags opcionais para o envio das mensagens.
+        /// @return Número de datagramas enviados, menor que count apenas
+        ///         quando uma socket não bloqueante não tem mais espaço.
+        size_t send_batch(const std::vector<Datagram>& datagrams, size_t count, int flags = 0);
+
+    private:
+
+        /// Prepara batch_headers e batch_iovecs para count datagramas.
+        void prepare_batch(const std::vector<Datagram>& datagrams, size_t first, size_t count);
+
+        /// Cabeçalhos reutilizados por recv_batch() e send_batch().
+        std::vector<mmsghdr> batch_headers;
+
+        /// Vetores de I/O reutilizados por recv_batch() e send_batch().
+        std::vector<iovec> batch_iovecs;
+
+};
+
+
+/** Wrapper de um socket Unix (AF_UNIX), para comunicação na mesma máquina.
+ *  
+ *      Tem o mesmo formato de TCPSocket e UDPSocket, mas os endereços são
+ *  caminhos no sistema de arquivos. Caminhos começando com '@' usam o
+ *  namespace abstrato do Linux, que não cria arquivos.
+ *      Em modo SOCK_STREAM funciona como um TCPSocket: bind(), listen() e
+ *  accept() no servidor, connect() no cliente e send()/recv() nos dois.
+ *  Em modo SOCK_DGRAM as mensagens preservam seus limites e podem ser
+ *  enviadas com sendto() sem connect().
+ *      Também permite passar descritores de arquivo para outro processo
+ *  (SCM_RIGHTS) com send_fds() e recv_fds().
+ */
+class UnixSocket : public BaseSocket {
+    public:
+
+        /// Cria um socket Unix.
+        /// @param type SOCK_STREAM ou SOCK_DGRAM.
+        UnixSocket(int type = SOCK_STREAM);
+
+        /// Assume a posse de uma socket Unix já conectada.
+        /// @param socket Descritor de arquivo da socket.
+        /// @param type   SOCK_STREAM ou SOCK_DGRAM.
+        UnixSocket(int socket, int type);
+
+        /// Destrutor. Remove o arquivo criado por bind(), se houver.
+        ~UnixSocket();
+
+        /// Cria duas sockets conectadas entre si (socketpair()).
+        /// @param type SOCK_STREAM ou SOCK_DGRAM.
+        /// @return As duas pontas da conexão.
+        static std::pair<std::shared_ptr<UnixSocket>, std::shared_ptr<UnixSocket>>
+            pair(int type = SOCK_STREAM);
+
+        /// Vincula a socket a um caminho.
+        /// @param path            Caminho do arquivo, ou "@nome" para o namespace abstrato.
+        /// @param remove_existing Remove um arquivo antigo no caminho antes do bind().
+        void bind(const std::string& path, bool remove_existing = false);
+
+        /// Recebe conexões no caminho definido previamente por bind().
+        /// @param backlog Número máximo de conexões pendentes.
+        void listen(uint32_t backlog = SOMAXCONN);
+
+        /// Aceita uma conexão pendente após chamar a função listen().
+        /// @return Objeto UnixSocket conectado ao cliente aceito.
+        std::shared_ptr<UnixSocket> accept();
+
+        /// Conecta a socket a um caminho.
+        /// @param path Caminho do servidor, ou "@nome" para o namespace abstrato.
+        void connect(const std::string& path);
+
+        /// Envia bytes ao outro lado da conexão. Em SOCK_STREAM repete a
+        /// chamada até enviar tudo; em SOCK_DGRAM envia uma única mensagem.
+        /// @param message Endereço inicial da mensagem a ser enviada.
+        /// @param length  Indica quantos bytes devem ser enviados.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void send(const uint8_t* message, size_t length, int flags = 0);
+
+        /// Envia uma string ao outro lado da conexão.
+        /// @param message Mensagem a ser enviada.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void send(const std::string& message, int flags = 0);
+
+        /// Recebe bytes em um buffer do chamador.
+        /// @param buffer   Endereço inicial do buffer que receberá os bytes.
+        /// @param capacity Número máximo de bytes a serem recebidos.
+        /// @param flags    Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos.
+        size_t recv_into(uint8_t* buffer, size_t capacity, int flags = 0);
+
+        /// Recebe uma string.
+        /// @param maxlen Tamanho máximo da mensagem a ser recebida.
+        /// @param flags  Flags opcionais para o recebimento da mensagem.
+        /// @return std::string contendo a mensagem recebida.
+        std::string recv(uint64_t maxlen, int flags = 0);
+
+        /// Envia uma mensagem a um caminho, em SOCK_DGRAM.
+        /// @param path    Caminho de destino, ou "@nome" para o namespace abstrato.
+        /// @param message Endereço inicial da mensagem a ser enviada.
+        /// @param length  Indica quantos bytes devem ser enviados.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void sendto(const std::string& path, const uint8_t* message, size_t length, int flags = 0);
+
+        /// Envia uma string a um caminho, em SOCK_DGRAM.
+        /// @param path    Caminho de destino, ou "@nome" para o namespace abstrato.
+        /// @param message Mensagem a ser enviada.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void sendto(const std::string& path, const std::string& message, int flags = 0);
+
+        /// Recebe uma mensagem e o caminho do transmissor, em SOCK_DGRAM.
+        /// @param buffer   Endereço inicial do buffer que receberá os bytes.
+        /// @param capacity Número máximo de bytes a serem recebidos.
+        /// @param sender   Preenchido com o caminho do transmissor, vazio se
+        ///                 ele não estiver vinculado. Pode ser NULL.
+        /// @param flags    Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos.
+        size_t recvfrom(uint8_t* buffer, size_t capacity, std::string* sender = NULL, int flags = 0);
+
+        /// Envia descritores de arquivo junto com uma mensagem (SCM_RIGHTS).
+        /// O outro processo recebe cópias dos descritores, que continuam
+        /// abertos neste processo.
+        /// @param fds     Descritores a serem enviados, no máximo MAX_FDS.
+        /// @param count   Número de descritores.
+        /// @param message Bytes enviados junto, ao menos um em SOCK_STREAM.
+        /// @param length  Número de bytes da mensagem.
+        /// @param flags   Flags opcionais para o envio da mensagem ao socket.
+        void send_fds(const int* fds, size_t count, const uint8_t* message, size_t length, int flags = 0);
+
+        /// Envia descritores de arquivo com uma mensagem de um byte.
+        /// @param fds Descritores a serem enviados, no máximo MAX_FDS.
+        void send_fds(const std::vector<int>& fds);
+
+        /// Recebe uma mensagem e os descritores enviados com ela. Os
+        /// descritores recebidos são criados com FD_CLOEXEC e pertencem ao
+        /// chamador, que deve fechá-los.
+        /// @param fds      Vetor esvaziado e preenchido com os descritores recebidos.
+        /// @param buffer   Endereço inicial do buffer que receberá os bytes.
+        /// @param capacity Número máximo de bytes a serem recebidos.
+        /// @param max_fds  Número máximo de descritores aceitos, no máximo MAX_FDS.
+        /// @param flags    Flags opcionais para o recebimento da mensagem.
+        /// @return Número de bytes recebidos.
+        size_t recv_fds(std::vector<int>& fds, uint8_t* buffer, size_t capacity,
+            size_t max_fds = MAX_FDS, int flags = 0);
+
+        /// Encerra o socket, removendo o arquivo criado por bind().
+        void close();
+
+        /// Número máximo de descritores por mensagem (SCM_MAX_FD do kernel).
+        static const size_t MAX_FDS = 253;
+
     private:
 
+        /// Preenche um sockaddr_un a partir de um caminho.
+        /// @return Tamanho do endereço preenchido.
+        static socklen_t make_address(const std::string& path, sockaddr_un& address);
+
+        /// Tipo da socket, SOCK_STREAM ou SOCK_DGRAM.
+        int type;
+
+        /// Caminho criado por bind(), removido ao fechar a socket. Vazio no
+        /// namespace abstrato, que não cria arquivos.
+        std::string bound_path;
+
+        /// Se o socket está conectada a algum caminho
+        bool is_connected = false;
+
+        /// Se o socket está ouvindo conexões
+        bool is_listening = false;
 };
 
 
@@ -0,0 +1,341 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "workpool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+using namespace Socket;
+
+namespace {
+
+/** Deque de Chase-Lev, na versão para modelos de memória fracos de Lê et al.
+ *
+ *      Apenas a thread dona chama push() e take(), pelo fundo; qualquer
+ *  thread chama steal(), pelo topo. Quando o vetor circular enche, a dona o
+ *  substitui por um com o dobro do tamanho; os vetores antigos podem estar
+ *  sendo lidos por ladrões e só são liberados na destruição.
+ */
+template<typename T>
+class ChaseLevDeque {
+    public:
+
+        ChaseLevDeque(size_t capacity = 1024) : top(0), bottom(0) {
+            array.store(new Array(capacity), std::memory_order_relaxed);
+        }
+
+        ~ChaseLevDeque() {
+            delete array.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < retired.size(); i++) delete retired[i];
+        }
+
+        void push(T* item) {
+
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            Array* a = array.load(std::memory_order_relaxed);
+
+            if (b - t > (int64_t) a->capacity - 1) a = grow(a, t, b);
+
+            a->put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        T* take() {
+
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            Array* a = array.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return NULL;
+            }
+
+            T* item = a->get(b);
+            if (t == b) {
+                // Último item: disputa com os ladrões pelo topo.
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed)) {
+                    item = NULL;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        T* steal() {
+
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+
+            if (t >= b) return NULL;
+
+            Array* a = array.load(std::memory_order_acquire);
+            T* item = a->get(t);
+
+            // Falha se a dona ou outro ladrão levou o item primeiro.
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed)) {
+                return NULL;
+            }
+            return item;
+        }
+
+    private:
+
+        /// Vetor circular de tamanho potência de 2.
+        struct Array {
+            size_t capacity;
+            std::unique_ptr<std::atomic<T*>[]> items;
+
+            Array(size_t capacity) : capacity(capacity), items(new std::atomic<T*>[capacity]) {}
+
+            T* get(int64_t index) const {
+                return items[index & (capacity - 1)].load(std::memory_order_relaxed);
+            }
+
+            void put(int64_t index, T* item) {
+                items[index & (capacity - 1)].store(item, std::memory_order_relaxed);
+            }
+        };
+
+        Array* grow(Array* old, int64_t t, int64_t b) {
+
+            Array* bigger = new Array(old->capacity * 2);
+            for (int64_t i = t; i < b; i++) bigger->put(i, old->get(i));
+
+            retired.push_back(old);
+            array.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+        std::atomic<int64_t> top;
+        std::atomic<int64_t> bottom;
+        std::atomic<Array*> array;
+
+        /// Vetores substituídos, acessados apenas pela dona.
+        std::vector<Array*> retired;
+};
+
+/// Pool da thread atual, se ela pertencer a um, e o índice dela.
+thread_local WorkStealingPool* current_pool = NULL;
+thread_local unsigned current_index = 0;
+
+/// Fixa a thread atual em um núcleo.
+void pin_current_thread(unsigned cpu) {
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+
+    // Falhar em fixar a thread não impede o funcionamento do pool.
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
+
+} // End anonymous namespace
+
+/// Tarefa na deque ou na caixa de entrada de uma thread.
+struct WorkStealingPool::Task {
+    Job job;
+
+    /// Próxima tarefa da caixa de entrada.
+    Task* next;
+
+    Task(Job job) : job(std::move(job)), next(NULL) {}
+};
+
+struct WorkStealingPool::Worker {
+    ChaseLevDeque<Task> deque;
+    std::thread thread;
+
+    /// Tarefas submetidas de fora do pool, da mais nova para a mais antiga.
+    /// Os produtores empilham com compare_exchange; a lista é sempre tomada
+    /// inteira com exchange(), o que dispensa locks e evita o problema ABA.
+    std::atomic<Task*> inbox;
+
+    /// Estado do gerador que escolhe a primeira vítima de um roubo.
+    uint32_t random;
+
+    Worker() : inbox(NULL), random(0) {}
+};
+
+WorkStealingPool::WorkStealingPool(unsigned threads, bool pin_threads) :
+    total_threads(threads), next_inbox(0), queued(0), sleeping(0), stopping(false), steals(0) {
+
+    if (total_threads == 0) total_threads = std::thread::hardware_concurrency();
+    if (total_threads == 0) total_threads = 1;
+
+    // Todas as deques existem antes de qualquer thread, que pode roubar de
+    // qualquer uma delas.
+    for (unsigned i = 0; i < total_threads; i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        workers[i]->random = 2654435761u * (i + 1);
+    }
+
+    unsigned cpus = std::thread::hardware_concurrency();
+    for (unsigned i = 0; i < total_threads; i++) {
+        bool pin = pin_threads && cpus > 0;
+        workers[i]->thread = std::thread([this, pin, i, cpus]() {
+            if (pin) pin_current_thread(i % cpus);
+            run_worker(i);
+        });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    stop();
+    join();
+}
+
+void WorkStealingPool::submit(Job job) {
+
+    if (stopping) return;
+
+    Task* item = new Task(std::move(job));
+
+    if (current_pool == this) {
+        workers[current_index]->deque.push(item);
+    }
+    else {
+        // Rodízio entre as caixas de entrada, para que as threads de I/O não
+        // disputem a mesma lista.
+        unsigned target = next_inbox.fetch_add(1, std::memory_order_relaxed) % total_threads;
+        std::atomic<Task*>& inbox = workers[target]->inbox;
+
+        Task* head = inbox.load(std::memory_order_relaxed);
+        do {
+            item->next = head;
+        } while (!inbox.compare_exchange_weak(head, item, std::memory_order_release,
+                                              std::memory_order_relaxed));
+    }
+
+    // A contagem vem antes da leitura de sleeping, e uma thread que vai
+    // dormir conta a si mesma antes de ler queued: ao menos uma das duas vê
+    // a outra, então a tarefa não fica parada com todas as threads dormindo.
+    queued.fetch_add(1);
+    if (sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        wakeup.notify_one();
+    }
+}
+
+void WorkStealingPool::stop() {
+
+    stopping = true;
+
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    wakeup.notify_all();
+}
+
+void WorkStealingPool::join() {
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (workers[i]->thread.joinable()) workers[i]->thread.join();
+    }
+
+    // Com as threads paradas, as deques e as caixas de entrada podem ser
+    // esvaziadas por aqui.
+    for (size_t i = 0; i < workers.size(); i++) {
+        while (Task* task = workers[i]->deque.steal()) delete task;
+
+        Task* task = workers[i]->inbox.exchange(NULL, std::memory_order_acquire);
+        while (task) {
+            Task* next = task->next;
+            delete task;
+            task = next;
+        }
+    }
+
+    queued = 0;
+}
+
+void WorkStealingPool::run_worker(unsigned index) {
+
+    current_pool = this;
+    current_index = index;
+
+    while (!stopping) {
+
+        Task* task = find_job(index);
+
+        if (task) {
+            queued.fetch_sub(1);
+            try {
+                task->job();
+            }
+            catch (...) {
+                // Uma tarefa com erro não derruba a thread.
+            }
+            delete task;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleeping.fetch_add(1);
+        wakeup.wait(lock, [this]() { return queued.load() > 0 || stopping; });
+        sleeping.fetch_sub(1);
+    }
+
+    current_pool = NULL;
+}
+
+WorkStealingPool::Task* WorkStealingPool::find_job(unsigned index) {
+
+    Worker& self = *workers[index];
+
+    if (Task* task = self.deque.take()) return task;
+    if (Task* task = take_inbox(self, self)) return task;
+
+    // Começa por uma vítima aleatória, para que os ladrões não disputem
+    // sempre o topo da mesma deque.
+    self.random ^= self.random << 13;
+    self.random ^= self.random >> 17;
+    self.random ^= self.random << 5;
+
+    unsigned first = self.random % total_threads;
+    for (unsigned i = 0; i < total_threads; i++) {
+
+        unsigned victim = (first + i) % total_threads;
+        if (victim == index) continue;
+
+        // A caixa de entrada de uma thread ocupada também pode ser tomada:
+        // submit() acorda uma thread qualquer, não necessariamente a dona.
+        Task* task = workers[victim]->deque.steal();
+        if (!task) task = take_inbox(*workers[victim], self);
+
+        if (task) {
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+WorkStealingPool::Task* WorkStealingPool::take_inbox(Worker& from, Worker& self) {
+
+    if (!from.inbox.load(std::memory_order_relaxed)) return NULL;
+
+    Task* task = from.inbox.exchange(NULL, std::memory_order_acquire);
+    if (!task) return NULL;
+
+    // A lista vem da mais nova para a mais antiga. Empilhadas nessa ordem,
+    // a mais antiga fica no fundo e sai primeiro em take(), enquanto os
+    // ladrões levam as mais novas pelo topo.
+    while (task) {
+        Task* next = task->next;
+        self.deque.push(task);
+        task = next;
+    }
+
+    return self.deque.take();
+}
@@ -0,0 +1,132 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "sockets.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <thread>
+
+namespace Socket {
+
+/** Pool de threads com roubo de trabalho, para tarefas que gastam CPU.
+ *
+ *      Cada thread possui uma deque própria (Chase-Lev), sem locks: a dona
+ *  empilha e desempilha pelo fundo, e as demais roubam pelo topo quando
+ *  ficam sem trabalho. Assim uma tarefa cara não atrasa as que estão atrás
+ *  dela: outra thread livre as rouba. Tarefas submetidas por threads de fora
+ *  do pool (como as de I/O) são distribuídas em rodízio entre as caixas de
+ *  entrada das threads, listas sem locks que a dona esvazia na sua deque e
+ *  que uma thread ociosa pode tomar inteiras; tarefas submetidas por uma
+ *  tarefa vão para a deque da própria thread.
+ *      Threads sem trabalho dormem em uma variável de condição e são
+ *  acordadas por submit(). Exceções lançadas por uma tarefa são descartadas.
+ */
+class WorkStealingPool {
+    public:
+
+        typedef std::function<void()> Job;
+
+        /// Cria o pool e inicia suas threads.
+        /// @param threads     Número de threads, 0 para uma por núcleo.
+        /// @param pin_threads Fixa cada thread em um núcleo distinto.
+        WorkStealingPool(unsigned threads = 0, bool pin_threads = false);
+
+        /// Destrutor. Interrompe e aguarda as threads.
+        ~WorkStealingPool();
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        /// Agenda uma tarefa. Pode ser chamada de qualquer thread, sem
+        /// bloquear atrás de tarefas em execução. Ignorada depois de stop().
+        /// @param job Tarefa a ser executada por uma das threads do pool.
+        void submit(Job job);
+
+        /// Interrompe as threads depois das tarefas em execução. As tarefas
+        /// que ainda não começaram são descartadas por join(). Pode ser
+        /// chamada de qualquer thread.
+        void stop();
+
+        /// Aguarda o término das threads. Não deve ser chamada por uma tarefa.
+        void join();
+
+        /// Número de threads.
+        unsigned get_threads() const {
+            return this->total_threads;
+        }
+
+        /// Número aproximado de tarefas que ainda não começaram.
+        size_t pending() const {
+            int64_t queued = this->queued.load(std::memory_order_relaxed);
+            return queued > 0 ? (size_t) queued : 0;
+        }
+
+        /// Número de tarefas executadas por uma thread diferente da que as
+        /// recebeu.
+        uint64_t get_steals() const {
+            return this->steals.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        struct Worker;
+        struct Task;
+
+        /// Laço de uma thread do pool.
+        /// @param index Índice da thread.
+        void run_worker(unsigned index);
+
+        /// Procura uma tarefa: na própria deque, na própria caixa de entrada
+        /// e, por fim, nas deques e caixas de entrada das outras threads.
+        /// @param index Índice da thread que procura.
+        /// @return Tarefa encontrada, NULL se não houver nenhuma.
+        Task* find_job(unsigned index);
+
+        /// Toma todas as tarefas da caixa de entrada de uma thread e as
+        /// coloca na deque da thread atual.
+        /// @param from Thread cuja caixa de entrada é esvaziada.
+        /// @param self Thread atual, dona da deque.
+        /// @return Uma das tarefas tomadas, NULL se a caixa estava vazia.
+        Task* take_inbox(Worker& from, Worker& self);
+
+        /// Número de threads.
+        unsigned total_threads;
+
+        /// Deques e threads.
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        /// Próxima caixa de entrada que recebe uma tarefa de fora do pool.
+        std::atomic<unsigned> next_inbox;
+
+        /// Tarefas submetidas que ainda não foram retiradas. Pode ficar
+        /// negativo por um instante, entre a publicação e a contagem.
+        std::atomic<int64_t> queued;
+
+        /// Threads dormindo ou prestes a dormir.
+        std::atomic<unsigned> sleeping;
+
+        /// Acorda as threads sem trabalho.
+        std::mutex sleep_mutex;
+        std::condition_variable wakeup;
+
+        /// Se as threads devem terminar.
+        std::atomic<bool> stopping;
+
+        /// Tarefas roubadas.
+        std::atomic<uint64_t> steals;
+};
+
+} // End namespace Socket
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "writer.hpp"
+
+#include <netinet/tcp.h>
+
+using namespace Socket;
+
+BufferedWriter::BufferedWriter(TCPSocket& socket, size_t flush_threshold, Coalesce coalesce) :
+    socket(socket), flush_threshold(flush_threshold), coalesce(coalesce) {
+
+    buffer.reserve(flush_threshold);
+}
+
+BufferedWriter::~BufferedWriter() {
+    try {
+        flush();
+    }
+    catch (const std::exception& e) {
+        // Destrutores não devem lançar exceções.
+    }
+}
+
+void BufferedWriter::write(const uint8_t* message, size_t length) {
+
+    if (buffer.size() + length < flush_threshold) {
+        buffer.insert(buffer.end(), message, message + length);
+        return;
+    }
+
+    // O buffer e a nova escrita vão juntos, sem copiar a escrita para o buffer.
+    send_buffered(message, length, false);
+}
+
+void BufferedWriter::write(const std::string& message) {
+    write((const uint8_t *) message.data(), message.length());
+}
+
+void BufferedWriter::flush() {
+
+    if (!buffer.empty()) send_buffered(NULL, 0, true);
+
+    // Com o buffer vazio, o último envio pode ter saído com MSG_MORE e ainda
+    // estar retido pelo kernel. Desativar TCP_CORK empurra os segmentos
+    // pendentes, então basta ativá-lo e desativá-lo.
+    if (more_pending && !corked) set_cork(true);
+    if (corked) set_cork(false);
+
+    more_pending = false;
+}
+
+void BufferedWriter::send_buffered(const uint8_t* message, size_t length, bool last) {
+
+    int flags = 0;
+    if (!last) {
+        if (coalesce == COALESCE_CORK && !corked) set_cork(true);
+        if (coalesce == COALESCE_MSG_MORE) flags |= MSG_MORE;
+    }
+
+    iovec buffers[2];
+    buffers[0].iov_base = buffer.data();
+    buffers[0].iov_len = buffer.size();
+    buffers[1].iov_base = const_cast<uint8_t*>(message);
+    buffers[1].iov_len = length;
+
+    // Limpa o buffer mesmo em caso de erro, para não reenviar bytes
+    // que podem já ter sido parcialmente enviados.
+    try {
+        socket.sendv(buffers, length > 0 ? 2 : 1, flags);
+    }
+    catch (...) {
+        buffer.clear();
+        throw;
+    }
+
+    buffer.clear();
+    more_pending = (flags & MSG_MORE) != 0;
+}
+
+void BufferedWriter::set_cork(bool enable) {
+
+    int optval = enable ? 1 : 0;
+    if (setsockopt(socket.get_fd(), IPPROTO_TCP, TCP_CORK, &optval, sizeof(optval)) == -1) {
+        throw SocketException("Could not set TCP_CORK. Error: " +
+            std::string(strerror(errno)));
+    }
+
+    corked = enable;
+}
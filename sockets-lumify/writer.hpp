@@ -0,0 +1,106 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "sockets.hpp"
+
+namespace Socket {
+
+/** Escrita com buffer sobre um TCPSocket.
+ *
+ *      Acumula várias escritas pequenas em um buffer e as envia ao kernel de
+ *  uma só vez, quando o buffer atinge flush_threshold bytes ou quando flush()
+ *  é chamada. Opcionalmente usa TCP_CORK ou MSG_MORE para que os envios
+ *  intermediários de uma mesma resposta não gerem pacotes pequenos.
+ *      Feito para sockets bloqueantes: com uma socket não bloqueante, um
+ *  WouldBlock durante o envio descarta o conteúdo do buffer.
+ */
+class BufferedWriter {
+    public:
+
+        /// Forma de agrupar os envios intermediários em segmentos TCP.
+        enum Coalesce {
+            /// Cada envio é entregue ao TCP imediatamente.
+            COALESCE_NONE,
+
+            /// Ativa TCP_CORK no primeiro envio intermediário e o desativa em flush().
+            COALESCE_CORK,
+
+            /// Marca os envios intermediários com MSG_MORE.
+            COALESCE_MSG_MORE
+        };
+
+        /// Cria o writer sobre uma socket conectada, que deve continuar viva
+        /// enquanto o writer for usado.
+        /// @param socket          Socket conectada.
+        /// @param flush_threshold Número de bytes acumulados que dispara um envio.
+        /// @param coalesce        Forma de agrupar os envios intermediários.
+        BufferedWriter(TCPSocket& socket, size_t flush_threshold = 64 * 1024,
+            Coalesce coalesce = COALESCE_NONE);
+
+        /// Destrutor. Envia o que ainda estiver no buffer, ignorando erros.
+        ~BufferedWriter();
+
+        BufferedWriter(const BufferedWriter&) = delete;
+        BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+        /// Acrescenta bytes ao buffer, enviando-os caso flush_threshold seja atingido.
+        /// @param message Endereço inicial dos bytes.
+        /// @param length  Número de bytes.
+        void write(const uint8_t* message, size_t length);
+
+        /// Acrescenta uma string ao buffer.
+        /// @param message String a ser escrita.
+        void write(const std::string& message);
+
+        /// Envia tudo o que está no buffer e libera os segmentos retidos por
+        /// TCP_CORK ou MSG_MORE.
+        void flush();
+
+        /// Número de bytes no buffer que ainda não foram enviados.
+        size_t buffered() const {
+            return this->buffer.size();
+        }
+
+    private:
+
+        /// Envia o buffer seguido de message em uma única chamada de sistema.
+        /// @param message Endereço inicial dos bytes adicionais.
+        /// @param length  Número de bytes adicionais.
+        /// @param last    Se é o último envio antes de flush().
+        void send_buffered(const uint8_t* message, size_t length, bool last);
+
+        /// Ativa ou desativa TCP_CORK.
+        void set_cork(bool enable);
+
+        /// Socket conectada.
+        TCPSocket& socket;
+
+        /// Bytes ainda não enviados.
+        std::vector<uint8_t> buffer;
+
+        /// Número de bytes acumulados que dispara um envio.
+        size_t flush_threshold;
+
+        /// Forma de agrupar os envios intermediários.
+        Coalesce coalesce;
+
+        /// Se TCP_CORK está ativo.
+        bool corked = false;
+
+        /// Se o último envio saiu com MSG_MORE, deixando bytes retidos pelo kernel.
+        bool more_pending = false;
+};
+
+} // End namespace Socket
+
+#endif
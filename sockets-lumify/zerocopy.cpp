@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "zerocopy.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <linux/errqueue.h>
+
+using namespace Socket;
+
+ZeroCopySender::ZeroCopySender(TCPSocket& socket, size_t min_size) :
+    socketfd(socket.get_fd()), min_size(min_size) {
+    enable();
+}
+
+ZeroCopySender::ZeroCopySender(TCPConnection& connection, size_t min_size) :
+    socketfd(connection.get_fd()), min_size(min_size) {
+    enable();
+}
+
+void ZeroCopySender::enable() {
+
+    if (socketfd == -1) {
+        throw SocketException("Can't send from a socket that is closed");
+    }
+
+    // Kernels anteriores ao 4.14 não conhecem a opção; nesse caso os envios
+    // são sempre copiados.
+    int optval = 1;
+    enabled = ::setsockopt(socketfd, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) == 0;
+}
+
+size_t ZeroCopySender::send(const uint8_t* message, size_t length, Completion on_complete, int flags) {
+
+    Result<size_t> result = try_send(message, length, std::move(on_complete), flags);
+    if (result.ok()) return result.value();
+
+    if (result.error() == Errc::would_block || result.error() == Errc::timed_out) {
+        throw WouldBlock("Send buffer is full.");
+    }
+
+    throw ConnectionException("Could not send message. Error: " + std::string(result.message()));
+}
+
+Result<size_t> ZeroCopySender::try_send(const uint8_t* message, size_t length,
+    Completion on_complete, int flags) {
+
+    uint64_t first = next_sequence;
+    bool zerocopy = enabled && length >= min_size;
+    size_t bytes_sent = 0;
+    int error = 0;
+
+    while (bytes_sent < length) {
+
+        int call_flags = flags | MSG_NOSIGNAL;
+        if (zerocopy) call_flags |= MSG_ZEROCOPY;
+
+        ssize_t result = ::send(socketfd, message + bytes_sent, length - bytes_sent, call_flags);
+
+        // ENOBUFS indica que o limite de memória para confirmações pendentes
+        // (optmem_max) foi atingido; o restante é copiado.
+        if (result == -1 && errno == ENOBUFS && zerocopy) {
+            zerocopy = false;
+            continue;
+        }
+        if (result == -1) {
+            error = errno;
+            break;
+        }
+
+        // Apenas chamadas com MSG_ZEROCOPY consomem um número de sequência.
+        if (zerocopy) next_sequence++;
+        bytes_sent += result;
+    }
+
+    if (bytes_sent == 0 && length > 0) {
+        bool nonblocking = (::fcntl(socketfd, F_GETFL) & O_NONBLOCK) != 0;
+        return Result<size_t>(errc_from_errno(error, nonblocking), error);
+    }
+
+    // Sem nenhuma chamada com MSG_ZEROCOPY, o buffer já pode ser reutilizado.
+    if (next_sequence == first) {
+        if (on_complete) on_complete(true);
+        return bytes_sent;
+    }
+
+    InFlight send;
+    send.first = first;
+    send.count = next_sequence - first;
+    send.completed = 0;
+    send.copied = false;
+    send.on_complete = std::move(on_complete);
+    in_flight.push_back(std::move(send));
+
+    return bytes_sent;
+}
+
+size_t ZeroCopySender::process_completions() {
+
+    size_t completed = 0;
+
+    for (;;) {
+
+        uint8_t control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_storage))];
+
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        if (::recvmsg(socketfd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            throw ConnectionException("Could not read send completions. Error: "
+                + std::string(strerror(errno)));
+        }
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+
+            bool recverr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                           (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!recverr) continue;
+
+            sock_extended_err error;
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            // ee_info e ee_data são a primeira e a última sequência confirmadas.
+            bool copied_by_kernel = (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+            completed += complete(error.ee_info, error.ee_data, copied_by_kernel);
+        }
+    }
+
+    // A fila de erros e um erro da conexão geram o mesmo EPOLLERR.
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    if (::getsockopt(socketfd, SOL_SOCKET, SO_ERROR, &error, &error_length) == 0 && error != 0) {
+        throw ConnectionException("Connection failed with pending zero-copy sends. Error: "
+            + std::string(strerror(error)));
+    }
+
+    return completed;
+}
+
+size_t ZeroCopySender::wait_completions(int timeout_ms) {
+
+    size_t completed = process_completions();
+    if (completed > 0 || in_flight.empty()) return completed;
+
+    // Sem eventos pedidos, poll() retorna apenas com POLLERR ou POLLHUP, e
+    // POLLERR indica mensagens na fila de erros.
+    pollfd error_queue;
+    error_queue.fd = socketfd;
+    error_queue.events = 0;
+    error_queue.revents = 0;
+
+    int result;
+    do {
+        result = ::poll(&error_queue, 1, timeout_ms);
+    } while (result == -1 && errno == EINTR);
+
+    if (result == -1) {
+        throw SocketException("Error while waiting for send completions. Error: "
+            + std::string(strerror(errno)));
+    }
+    if (result == 0) return 0;
+
+    return process_completions();
+}
+
+size_t ZeroCopySender::complete(uint32_t low, uint32_t high, bool copied_by_kernel) {
+
+    if (in_flight.empty()) return 0;
+
+    // Converte as sequências de 32 bits do kernel para o contador de 64 bits,
+    // usando como referência o envio pendente mais antigo.
+    uint64_t base = in_flight.front().first;
+    uint64_t first = base + (uint32_t) (low - (uint32_t) base);
+    uint64_t last = first + (uint32_t) (high - low);
+
+    // Callbacks dos envios concluídos e se o kernel copiou os bytes.
+    std::vector<std::pair<Completion, bool>> finished;
+
+    for (auto it = in_flight.begin(); it != in_flight.end();) {
+
+        uint64_t send_last = it->first + it->count - 1;
+        uint64_t overlap_first = first > it->first ? first : it->first;
+        uint64_t overlap_last = last < send_last ? last : send_last;
+
+        if (overlap_first <= overlap_last) {
+            it->completed += overlap_last - overlap_first + 1;
+            it->copied = it->copied || copied_by_kernel;
+        }
+
+        if (it->completed < it->count) {
+            ++it;
+            continue;
+        }
+
+        if (it->copied) copied++;
+        finished.push_back(std::make_pair(std::move(it->on_complete), it->copied));
+        it = in_flight.erase(it);
+    }
+
+    // Os callbacks podem chamar send(), então só rodam depois de in_flight
+    // estar consistente.
+    for (size_t i = 0; i < finished.size(); i++) {
+        if (finished[i].first) finished[i].first(finished[i].second);
+    }
+
+    return finished.size();
+}
@@ -0,0 +1,144 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+/**
+ * Copyright (c) 2018 Mikael Mello
+ * Licensed under the MIT license.
+ * https://opensource.org/licenses/MIT
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                  INCLUDES E DEFINES
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "sockets.hpp"
+
+#include <functional>
+
+namespace Socket {
+
+/** Envio sem cópia (MSG_ZEROCOPY) sobre uma socket TCP conectada.
+ *
+ *      Em vez de copiar a mensagem para o buffer do kernel, as páginas do
+ *  chamador são enviadas diretamente para a placa de rede. Em troca, o
+ *  buffer não pode ser alterado nem liberado até que o kernel avise, pela
+ *  fila de erros da socket, que terminou de usá-lo. Cada chamada de send()
+ *  recebe um callback que é chamado nesse momento.
+ *      As confirmações são lidas por process_completions(). Com um
+ *  EventLoop, chame-a no callback on_error da socket; sem laço, use
+ *  wait_completions(), que chamam os callbacks dos envios concluídos.
+ *      Compensa apenas para mensagens grandes: mensagens menores que
+ *  min_size são copiadas normalmente e o callback é chamado antes de send()
+ *  retornar. Se o kernel não suportar SO_ZEROCOPY, todas as mensagens são
+ *  copiadas. Em loopback o kernel sempre copia, o que é indicado por copied
+ *  no callback.
+ *      Deve ser usado por uma única thread, e a socket deve continuar viva
+ *  enquanto o sender existir.
+ */
+class ZeroCopySender {
+    public:
+
+        /// Chamado quando o buffer de um send() pode ser reutilizado.
+        /// copied indica que o kernel acabou copiando os bytes.
+        typedef std::function<void(bool copied)> Completion;
+
+        /// Ativa SO_ZEROCOPY em uma socket conectada.
+        /// @param socket   Socket TCP conectada.
+        /// @param min_size Tamanho mínimo de uma mensagem para não ser copiada.
+        ZeroCopySender(TCPSocket& socket, size_t min_size = 16 * 1024);
+
+        /// Ativa SO_ZEROCOPY em uma conexão.
+        /// @param connection Conexão TCP.
+        /// @param min_size   Tamanho mínimo de uma mensagem para não ser copiada.
+        ZeroCopySender(TCPConnection& connection, size_t min_size = 16 * 1024);
+
+        ZeroCopySender(const ZeroCopySender&) = delete;
+        ZeroCopySender& operator=(const ZeroCopySender&) = delete;
+
+        /// Envia bytes sem copiá-los. Em uma socket bloqueante repete a
+        /// chamada até enviar tudo; em uma não bloqueante pode enviar parte.
+        /// @param message     Endereço inicial da mensagem, que deve continuar
+        ///                    válida até on_complete ser chamado.
+        /// @param length      Indica quantos bytes devem ser enviados.
+        /// @param on_complete Chamado quando os bytes enviados por esta chamada
+        ///                    não são mais usados pelo kernel. Não é chamado se
+        ///                    nenhum byte for enviado.
+        /// @param flags       Flags opcionais para o envio da mensagem ao socket.
+        /// @return Número de bytes enviados. Os restantes devem ser enviados
+        ///         em outra chamada, com seu próprio callback.
+        size_t send(const uint8_t* message, size_t length, Completion on_complete, int flags = 0);
+
+        /// Envia bytes sem copiá-los e sem lançar exceções, como send().
+        /// @return Número de bytes enviados ou o erro se nenhum byte foi enviado.
+        Result<size_t> try_send(const uint8_t* message, size_t length, Completion on_complete,
+            int flags = 0);
+
+        /// Lê as confirmações pendentes da fila de erros sem bloquear e chama
+        /// os callbacks dos envios concluídos. Lança ConnectionException se a
+        /// socket tiver um erro pendente (SO_ERROR).
+        /// @return Número de callbacks chamados.
+        size_t process_completions();
+
+        /// Espera até que uma confirmação chegue e a processa.
+        /// @param timeout_ms Tempo máximo de espera, -1 para sem limite.
+        /// @return Número de callbacks chamados, 0 se o tempo acabou.
+        size_t wait_completions(int timeout_ms = -1);
+
+        /// Número de envios aguardando confirmação do kernel.
+        size_t pending() const {
+            return this->in_flight.size();
+        }
+
+        /// Indica se o kernel aceitou SO_ZEROCOPY.
+        bool is_enabled() const {
+            return this->enabled;
+        }
+
+        /// Envios confirmados em que o kernel copiou os bytes mesmo assim.
+        uint64_t get_copied() const {
+            return this->copied;
+        }
+
+    private:
+
+        /// Envio aguardando confirmação. Cada chamada de sistema bem sucedida
+        /// com MSG_ZEROCOPY recebe um número de sequência; um envio cobre as
+        /// sequências [first, first + count).
+        struct InFlight {
+            uint64_t first;
+            uint32_t count;
+            uint32_t completed;
+            bool copied;
+            Completion on_complete;
+        };
+
+        /// Ativa SO_ZEROCOPY na socket.
+        void enable();
+
+        /// Marca as sequências [low, high] como concluídas.
+        /// @return Número de callbacks chamados.
+        size_t complete(uint32_t low, uint32_t high, bool copied);
+
+        /// Descritor da socket.
+        int socketfd;
+
+        /// Tamanho mínimo de uma mensagem para não ser copiada.
+        size_t min_size;
+
+        /// Se o kernel aceitou SO_ZEROCOPY.
+        bool enabled = false;
+
+        /// Sequência da próxima chamada de sistema com MSG_ZEROCOPY. O kernel
+        /// usa 32 bits; aqui o contador não dá a volta.
+        uint64_t next_sequence = 0;
+
+        /// Envios aguardando confirmação, em ordem de sequência.
+        std::deque<InFlight> in_flight;
+
+        /// Confirmações em que o kernel copiou os bytes.
+        uint64_t copied = 0;
+};
+
+} // End namespace Socket
+
+#endif